@@ -0,0 +1,96 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-07-06
+ * @copyleft Apache 2.0
+ */
+#include <memory>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include "../code/http/httpconn.h"
+#include "../code/cache/filecache.h"
+
+/*
+ * 空闲长连接的常驻内存: 每个连接用socketpair模拟, 完成一次请求/响应后保持空闲,
+ * 统计建立连接前后进程RSS的增量, 换算成每1万个连接
+ * 分别在子进程里关闭/打开HttpConn::releaseIdle运行, 互不影响
+ */
+
+static const char REQUEST[] = "GET /index.html HTTP/1.1\r\nHost: 127.0.0.1\r\n"
+                              "Connection: keep-alive\r\nUser-Agent: idle_bench\r\n\r\n";
+
+static long RssKB() {
+    long pages = 0, rss = 0;
+    FILE* fp = fopen("/proc/self/statm", "r");
+    if(fp) {
+        if(fscanf(fp, "%ld %ld", &pages, &rss) != 2) { rss = 0; }
+        fclose(fp);
+    }
+    return rss * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+static void Run(int n, bool release) {
+    HttpConn::releaseIdle = release;
+    /* 文件缓存有后台线程, 在fork出的子进程里再初始化 */
+    FileCache::Instance()->Init(HttpConn::srcDir);
+    long before = RssKB();
+    std::unique_ptr<HttpConn[]> conns(new HttpConn[n]);
+    sockaddr_in addr = {};
+    char sink[16384];
+    for(int i = 0; i < n; i++) {
+        int sv[2];
+        if(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+            perror("socketpair");
+            exit(1);
+        }
+        HttpConn& conn = conns[i];
+        conn.init(sv[0], addr);
+        if(write(sv[1], REQUEST, sizeof(REQUEST) - 1) < 0) { exit(1); }
+        int err = 0;
+        conn.read(&err);
+        /* 与SubReactor一样: 处理, 发送, 发完后再process一次等待下一个请求 */
+        if(conn.process()) {
+            conn.write(&err);
+            if(conn.ToWriteBytes() == 0) { conn.process(); }
+        }
+        while(read(sv[1], sink, sizeof(sink)) == sizeof(sink)) {}
+        close(sv[1]);
+    }
+    long after = RssKB();
+    printf("releaseIdle=%-5s %d个空闲连接: RSS增加 %6.1f MB, 每1万个连接 %6.1f MB, 占用数据块 %zu\n",
+           release ? "true" : "false", n, (after - before) / 1024.0,
+           (after - before) / 1024.0 * 10000 / n, BlockPool::Instance()->InUse());
+}
+
+int main(int argc, char* argv[]) {
+    int n = argc > 1 ? atoi(argv[1]) : 10000;
+    /* 每个连接占两个描述符(对端处理完就关闭), 受打开文件数上限限制 */
+    struct rlimit rl;
+    getrlimit(RLIMIT_NOFILE, &rl);
+    rl.rlim_cur = rl.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &rl);
+    if(static_cast<rlim_t>(n) + 64 > rl.rlim_cur) {
+        n = static_cast<int>(rl.rlim_cur) - 64;
+    }
+
+    static char srcDir[256];
+    if(!getcwd(srcDir, sizeof(srcDir) - 32)) { return 1; }
+    strcat(srcDir, "/../resources/");
+    HttpConn::srcDir = srcDir;
+    HttpConn::isET = false;
+
+    for(bool release: { false, true }) {
+        pid_t pid = fork();
+        if(pid == 0) {
+            Run(n, release);
+            fflush(stdout);
+            _exit(0);
+        }
+        waitpid(pid, nullptr, 0);
+    }
+    return 0;
+}
@@ -0,0 +1,35 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-29
+ * @copyleft Apache 2.0
+ */
+#include <thread>
+#include <vector>
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include "../code/log/log.h"
+
+/*
+ * 多个线程同时写日志, 统计写日志调用的吞吐量(行/秒), 即工作线程被日志拖慢的程度
+ * 用法: ./log_bench [线程数] [每线程行数]
+ */
+int main(int argc, char* argv[]) {
+    int threads = argc > 1 ? atoi(argv[1]) : 8;
+    int lines = argc > 2 ? atoi(argv[2]) : 200000;
+    Log::Instance()->init(0, "/tmp/log_bench", ".log", 1024);
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> workers;
+    for(int i = 0; i < threads; i++) {
+        workers.emplace_back([i, lines] {
+            for(int j = 0; j < lines; j++) {
+                LOG_INFO("Client[%d] in Reactor[%d]! request %s line %d", j & 1023, i, "/index.html", j);
+            }
+        });
+    }
+    for(auto& t: workers) { t.join(); }
+    double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    printf("%d threads x %d lines: %.2fs, %.2f M lines/s\n", threads, lines, sec, threads * lines / sec / 1e6);
+    return 0;
+}
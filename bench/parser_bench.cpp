@@ -0,0 +1,115 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-20
+ * @copyleft Apache 2.0
+ */
+#include <chrono>
+#include <regex>
+#include <stdio.h>
+#include <stdlib.h>
+#include "../code/http/httprequest.h"
+
+using namespace std;
+
+/* 原来的正则解析器: 每行构造regex, 每行拷贝成string, 请求头放进unordered_map */
+class LegacyRequest {
+public:
+    bool parse(Buffer& buff) {
+        const char CRLF[] = "\r\n";
+        method_ = path_ = version_ = body_ = "";
+        state_ = 0;
+        header_.clear();
+        if(buff.ReadableBytes() <= 0) {
+            return false;
+        }
+        while(buff.ReadableBytes() && state_ != 3) {
+            const char* lineEnd = search(buff.Peek(), buff.BeginWriteConst(), CRLF, CRLF + 2);
+            std::string line(buff.Peek(), lineEnd);
+            switch(state_)
+            {
+            case 0: {
+                regex patten("^([^ ]*) ([^ ]*) HTTP/([^ ]*)$");
+                smatch subMatch;
+                if(!regex_match(line, subMatch, patten)) { return false; }
+                method_ = subMatch[1];
+                path_ = subMatch[2];
+                version_ = subMatch[3];
+                state_ = 1;
+                break;
+            }
+            case 1: {
+                regex patten("^([^:]*): ?(.*)$");
+                smatch subMatch;
+                if(regex_match(line, subMatch, patten)) {
+                    header_[subMatch[1]] = subMatch[2];
+                } else {
+                    state_ = 2;
+                }
+                if(buff.ReadableBytes() <= 2) { state_ = 3; }
+                break;
+            }
+            case 2:
+                body_ = line;
+                state_ = 3;
+                break;
+            default:
+                break;
+            }
+            if(lineEnd == buff.BeginWrite()) { break; }
+            buff.RetrieveUntil(lineEnd + 2);
+        }
+        return true;
+    }
+
+    int state_;
+    std::string method_, path_, version_, body_;
+    std::unordered_map<std::string, std::string> header_;
+};
+
+static const char REQUEST[] =
+    "GET /assets/bootstrap/css/bootstrap.min.css HTTP/1.1\r\n"
+    "Host: 127.0.0.1:1316\r\n"
+    "Connection: keep-alive\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/117.0 Safari/537.36\r\n"
+    "Accept: text/css,*/*;q=0.1\r\n"
+    "Referer: http://127.0.0.1:1316/index.html\r\n"
+    "Accept-Encoding: gzip, deflate, br\r\n"
+    "Accept-Language: zh-CN,zh;q=0.9,en;q=0.8\r\n"
+    "Cache-Control: no-cache\r\n"
+    "\r\n";
+
+template<class F>
+static double NsPerOp(int iters, F&& f) {
+    auto start = chrono::steady_clock::now();
+    for(int i = 0; i < iters; i++) { f(); }
+    auto end = chrono::steady_clock::now();
+    return chrono::duration<double, nano>(end - start).count() / iters;
+}
+
+int main(int argc, char* argv[]) {
+    int iters = argc > 1 ? atoi(argv[1]) : 200000;
+    size_t len = sizeof(REQUEST) - 1;
+    Buffer buff;
+    size_t sink = 0;
+
+    LegacyRequest legacy;
+    double legacyNs = NsPerOp(iters / 10, [&] {
+        buff.Append(REQUEST, len);
+        legacy.parse(buff);
+        sink += legacy.header_.size();
+    });
+
+    HttpRequest request;
+    double newNs = NsPerOp(iters, [&] {
+        buff.Append(REQUEST, len);
+        request.Init();
+        if(request.parse(buff) != HttpRequest::GET_REQUEST) { abort(); }
+        sink += request.GetHeader("Host").size();
+    });
+
+    printf("request size   : %zu bytes\n", len);
+    printf("regex parser   : %10.1f ns/request\n", legacyNs);
+    printf("state machine  : %10.1f ns/request\n", newNs);
+    printf("speedup        : %10.1fx  (sink %zu)\n", legacyNs / newNs, sink);
+    return 0;
+}
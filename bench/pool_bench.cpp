@@ -0,0 +1,102 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-30
+ * @copyleft Apache 2.0
+ */
+#include <chrono>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include "../code/pool/threadpool.h"
+
+/* 原来的线程池: 一个std::queue, 一把锁, 每次AddTask都notify_one */
+class LegacyThreadPool {
+public:
+    explicit LegacyThreadPool(size_t threadCount = 8): pool_(std::make_shared<Pool>()) {
+        for(size_t i = 0; i < threadCount; i++) {
+            std::thread([pool = pool_] {
+                std::unique_lock<std::mutex> locker(pool->mtx);
+                while(true) {
+                    if(!pool->tasks.empty()) {
+                        auto task = std::move(pool->tasks.front());
+                        pool->tasks.pop();
+                        locker.unlock();
+                        task();
+                        locker.lock();
+                    }
+                    else if(pool->isClosed) break;
+                    else pool->cond.wait(locker);
+                }
+            }).detach();
+        }
+    }
+
+    ~LegacyThreadPool() {
+        {
+            std::lock_guard<std::mutex> locker(pool_->mtx);
+            pool_->isClosed = true;
+        }
+        pool_->cond.notify_all();
+    }
+
+    template<class T>
+    void AddTask(T&& task) {
+        {
+            std::lock_guard<std::mutex> locker(pool_->mtx);
+            pool_->tasks.emplace(std::forward<T>(task));
+        }
+        pool_->cond.notify_one();
+    }
+
+private:
+    struct Pool {
+        std::mutex mtx;
+        std::condition_variable cond;
+        bool isClosed = false;
+        std::queue<std::function<void()>> tasks;
+    };
+    std::shared_ptr<Pool> pool_;
+};
+
+/*
+ * 4个提交线程(相当于4个Reactor)各提交total/4个小任务, 每个任务做一点计算,
+ * 统计从开始提交到全部执行完的吞吐量(任务/秒)
+ */
+template<class P>
+static double Run(int threads, int total) {
+    const int SUBMITTERS = 4;
+    std::atomic<int> done(0);
+    auto start = std::chrono::steady_clock::now();
+    {
+        P pool(threads);
+        std::vector<std::thread> submitters;
+        for(int s = 0; s < SUBMITTERS; s++) {
+            submitters.emplace_back([&pool, &done, total] {
+                for(int i = 0; i < total / SUBMITTERS; i++) {
+                    pool.AddTask([&done, i] {
+                        volatile int x = i;
+                        for(int k = 0; k < 50; k++) { x = x * 31 + k; }
+                        done.fetch_add(1, std::memory_order_relaxed);
+                    });
+                }
+            });
+        }
+        for(auto& t: submitters) { t.join(); }
+        while(done.load() < total / SUBMITTERS * SUBMITTERS) {
+            std::this_thread::yield();
+        }
+    }
+    double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return total / sec;
+}
+
+int main(int argc, char* argv[]) {
+    int total = argc > 1 ? atoi(argv[1]) : 400000;
+    printf("%8s %16s %16s\n", "threads", "legacy tasks/s", "stealing tasks/s");
+    for(int threads = 1; threads <= 64; threads *= 2) {
+        double legacy = Run<LegacyThreadPool>(threads, total);
+        double stealing = Run<ThreadPool>(threads, total);
+        printf("%8d %14.2fM %14.2fM\n", threads, legacy / 1e6, stealing / 1e6);
+    }
+    return 0;
+}
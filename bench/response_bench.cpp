@@ -0,0 +1,72 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-07-07
+ * @copyleft Apache 2.0
+ */
+#include <chrono>
+#include <new>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "../code/http/httpresponse.h"
+
+/*
+ * 生成一个缓存命中的200响应头(不含文件内容)的耗时和堆分配次数
+ * 分别对比现场生成响应头和使用FileCache装入时预先生成的响应头
+ */
+
+static size_t allocCount = 0;
+
+void* operator new(size_t size) {
+    allocCount++;
+    void* p = malloc(size ? size : 1);
+    if(!p) { throw std::bad_alloc(); }
+    return p;
+}
+
+void operator delete(void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+
+static void Run(const char* name, const char* srcDir, std::string path, bool keepAlive, int n) {
+    HttpResponse response;
+    Buffer buff;
+    size_t bytes = 0;
+    /* 先热身一次, 让文件进缓存、字符串和缓冲区都有了容量 */
+    for(int i = 0; i < 2; i++) {
+        response.Init(srcDir, path, keepAlive, 200);
+        response.MakeResponse(buff);
+        bytes = buff.ReadableBytes();
+        buff.RetrieveAll();
+    }
+    size_t allocs = allocCount;
+    auto start = std::chrono::steady_clock::now();
+    for(int i = 0; i < n; i++) {
+        response.Init(srcDir, path, keepAlive, 200);
+        response.MakeResponse(buff);
+        buff.RetrieveAll();
+    }
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    printf("%-12s keep-alive=%-5s 响应头%3zu字节  %6.1f ns/次  堆分配 %.2f 次/次\n", name,
+           keepAlive ? "true" : "false", bytes, ns / n, double(allocCount - allocs) / n);
+}
+
+int main(int argc, char* argv[]) {
+    int n = argc > 1 ? atoi(argv[1]) : 1000000;
+    static char srcDir[256];
+    if(!getcwd(srcDir, sizeof(srcDir) - 32)) { return 1; }
+    strcat(srcDir, "/../resources/");
+
+    FileCache::Instance()->Init(srcDir);
+    for(bool keepAlive: { false, true }) {
+        Run("现场生成", srcDir, "/index.html", keepAlive, n);
+    }
+    /* 设置回调后清空缓存, 文件重新装入时生成响应头 */
+    FileCache::Instance()->SetOnLoad(HttpResponse::PrepareFile);
+    FileCache::Instance()->Clear();
+    for(bool keepAlive: { false, true }) {
+        Run("预先生成", srcDir, "/index.html", keepAlive, n);
+    }
+    FileCache::Instance()->Close();
+    return 0;
+}
@@ -0,0 +1,145 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-20
+ * @copyleft Apache 2.0
+ */
+#include <thread>
+#include <string>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <sys/sendfile.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+/*
+ * 对比两种发送文件的方式每发送1GB消耗的CPU时间(只统计发送线程):
+ *   mmap+writev: 与原来的HttpConn一样, 每个响应mmap文件, writev(响应头, 映射区), munmap
+ *   sendfile   : TCP_CORK, write(响应头), sendfile(文件), 拔掉TCP_CORK
+ * 接收端是同一进程里的另一个线程, 通过回环TCP连接读走并丢弃数据
+ */
+
+static const char HEADER[] = "HTTP/1.1 200 OK\r\nConnection: keep-alive\r\n"
+                             "Content-type: text/html\r\nContent-length: 0000000\r\n\r\n";
+
+static double ThreadCpuSec() {
+    struct rusage ru;
+    getrusage(RUSAGE_THREAD, &ru);
+    return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec +
+           (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+}
+
+static void Connect(int* sender, int* receiver) {
+    int lfd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    bind(lfd, (struct sockaddr*)&addr, sizeof(addr));
+    listen(lfd, 1);
+    getsockname(lfd, (struct sockaddr*)&addr, &len);
+    *sender = socket(AF_INET, SOCK_STREAM, 0);
+    if(connect(*sender, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        perror("connect");
+        exit(1);
+    }
+    *receiver = accept(lfd, nullptr, nullptr);
+    close(lfd);
+}
+
+static void Drain(int fd) {
+    static char buf[1 << 18];
+    while(read(fd, buf, sizeof(buf)) > 0) {}
+}
+
+static bool WriteAll(int fd, struct iovec* iov, int cnt) {
+    while(cnt > 0) {
+        ssize_t len = writev(fd, iov, cnt);
+        if(len <= 0) { return false; }
+        while(cnt > 0 && static_cast<size_t>(len) >= iov->iov_len) {
+            len -= iov->iov_len;
+            iov++;
+            cnt--;
+        }
+        if(cnt > 0) {
+            iov->iov_base = (char*)iov->iov_base + len;
+            iov->iov_len -= len;
+        }
+    }
+    return true;
+}
+
+static void SendMmap(int sock, const char* path, size_t size) {
+    int fd = open(path, O_RDONLY);
+    void* mm = mmap(0, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    struct iovec iov[2];
+    iov[0].iov_base = const_cast<char*>(HEADER);
+    iov[0].iov_len = sizeof(HEADER) - 1;
+    iov[1].iov_base = mm;
+    iov[1].iov_len = size;
+    WriteAll(sock, iov, 2);
+    munmap(mm, size);
+}
+
+static void SendFile(int sock, const char* path, size_t size) {
+    int fd = open(path, O_RDONLY);
+    int on = 1, off = 0;
+    setsockopt(sock, IPPROTO_TCP, TCP_CORK, &on, sizeof(on));
+    struct iovec iov = { const_cast<char*>(HEADER), sizeof(HEADER) - 1 };
+    WriteAll(sock, &iov, 1);
+    off_t offset = 0;
+    while(static_cast<size_t>(offset) < size) {
+        if(sendfile(sock, fd, &offset, size - offset) <= 0) { break; }
+    }
+    setsockopt(sock, IPPROTO_TCP, TCP_CORK, &off, sizeof(off));
+    close(fd);
+}
+
+template<class F>
+static void Run(const char* name, const char* path, size_t size, size_t total, F&& send) {
+    int sender, receiver;
+    Connect(&sender, &receiver);
+    std::thread reader(Drain, receiver);
+    size_t sent = 0;
+    double cpu = ThreadCpuSec();
+    while(sent < total) {
+        send(sender, path, size);
+        sent += size + sizeof(HEADER) - 1;
+    }
+    cpu = ThreadCpuSec() - cpu;
+    shutdown(sender, SHUT_WR);
+    reader.join();
+    close(sender);
+    close(receiver);
+    double gb = sent / double(1 << 30);
+    printf("%-12s file %7zuKB: %6.3f CPU s/GB  (%.1fGB sent)\n", name, size >> 10, cpu / gb, gb);
+}
+
+int main(int argc, char* argv[]) {
+    size_t totalMB = argc > 1 ? atoi(argv[1]) : 2048;
+    const size_t sizes[] = { 120 << 10, 1 << 20, 8 << 20 };
+    char path[] = "/tmp/sendfile_bench_XXXXXX";
+    int fd = mkstemp(path);
+    std::string data(sizes[2], 'x');
+    if(fd < 0 || write(fd, data.data(), data.size()) != (ssize_t)data.size()) {
+        perror("tmpfile");
+        return 1;
+    }
+    close(fd);
+    for(size_t size: sizes) {
+        if(truncate(path, size) < 0) { perror("truncate"); }
+        Run("mmap+writev", path, size, totalMB << 20, SendMmap);
+        Run("sendfile", path, size, totalMB << 20, SendFile);
+    }
+    unlink(path);
+    return 0;
+}
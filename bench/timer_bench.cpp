@@ -0,0 +1,69 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-28
+ * @copyleft Apache 2.0
+ */
+#include <thread>
+#include <random>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include "../code/timer/heaptimer.h"
+#include "../code/timer/timewheel.h"
+
+/*
+ * HeapTimer与TimeWheel对比, 模拟服务器上的用法:
+ *   add    : N个连接各自加一个定时器
+ *   adjust : 随机挑连接延后超时(每次收到数据都会调一次), 占定时器操作的绝大部分
+ *   expire : N个定时器在100ms内陆续到期, 统计tick()处理全部到期的总耗时
+ */
+
+static double NowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+template<class T>
+static void Run(const char* name, int conns, int adjusts) {
+    std::mt19937 rng(12345);
+    std::vector<int> ids(adjusts);
+    for(int& id: ids) { id = rng() % conns; }
+    int fired = 0;
+
+    T timer;
+    double t0 = NowNs();
+    for(int i = 0; i < conns; i++) {
+        timer.add(i, 60000, [&fired] { fired++; });
+    }
+    double t1 = NowNs();
+    for(int id: ids) {
+        timer.adjust(id, 60000);
+    }
+    double t2 = NowNs();
+    timer.clear();
+
+    // 到期: 1~100ms后陆续过期
+    T expiring;
+    for(int i = 0; i < conns; i++) {
+        expiring.add(i, 1 + i % 100, [&fired] { fired++; });
+    }
+    double busy = 0;
+    while(fired < conns) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        double t = NowNs();
+        expiring.GetNextTick();
+        busy += NowNs() - t;
+    }
+    printf("%-10s conns %6d: add %6.1f ns/op  adjust %6.1f ns/op  expire %6.1f ns/timer\n",
+           name, conns, (t1 - t0) / conns, (t2 - t1) / adjusts, busy / conns);
+}
+
+int main(int argc, char* argv[]) {
+    int conns = argc > 1 ? atoi(argv[1]) : 50000;
+    int adjusts = conns * 20;
+    for(int i = 0; i < 2; i++) {
+        Run<HeapTimer>("HeapTimer", conns, adjusts);
+        Run<TimeWheel>("TimeWheel", conns, adjusts);
+    }
+    return 0;
+}
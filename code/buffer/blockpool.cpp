@@ -0,0 +1,101 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-07-05
+ * @copyleft Apache 2.0
+ */
+#include "blockpool.h"
+#include <new>
+#include <algorithm>
+#include <assert.h>
+
+BlockPool::BlockPool(): inUse_(0) {}
+
+BlockPool::~BlockPool() {
+    std::lock_guard<std::mutex> locker(mtx_);
+    for(auto block: free_) { Delete_(block); }
+    free_.clear();
+}
+
+BlockPool* BlockPool::Instance() {
+    static BlockPool inst;
+    return &inst;
+}
+
+// 线程退出时把缓存的块交还全局
+BlockPool::LocalCache_::~LocalCache_() {
+    BlockPool::Instance()->PutBatch_(blocks.data(), blocks.size());
+    blocks.clear();
+}
+
+BlockPool::LocalCache_& BlockPool::Local_() {
+    static thread_local LocalCache_ cache;
+    return cache;
+}
+
+BufferBlock* BlockPool::New_(size_t cap) {
+    void* mem = ::operator new(sizeof(BufferBlock) + cap);
+    BufferBlock* block = static_cast<BufferBlock*>(mem);
+    block->cap = cap;
+    return block;
+}
+
+void BlockPool::Delete_(BufferBlock* block) {
+    ::operator delete(static_cast<void*>(block));
+}
+
+BufferBlock* BlockPool::Get(size_t minCap) {
+    BufferBlock* block = nullptr;
+    if(minCap > BLOCK_DATA) {
+        block = New_(minCap);
+    } else {
+        auto& local = Local_().blocks;
+        if(local.empty()) {
+            // 线程缓存空了, 从全局批量取一些
+            std::lock_guard<std::mutex> locker(mtx_);
+            size_t n = std::min(BATCH, free_.size());
+            local.insert(local.end(), free_.end() - n, free_.end());
+            free_.resize(free_.size() - n);
+        }
+        if(local.empty()) {
+            block = New_(BLOCK_DATA);
+        } else {
+            block = local.back();
+            local.pop_back();
+        }
+    }
+    block->next = nullptr;
+    block->readPos = block->writePos = 0;
+    inUse_.fetch_add(1, std::memory_order_relaxed);
+    return block;
+}
+
+void BlockPool::Put(BufferBlock* block) {
+    assert(block);
+    inUse_.fetch_sub(1, std::memory_order_relaxed);
+    if(block->cap != BLOCK_DATA) {
+        Delete_(block);
+        return;
+    }
+    auto& local = Local_().blocks;
+    local.push_back(block);
+    if(local.size() > LOCAL_MAX) {
+        PutBatch_(local.data() + local.size() - BATCH, BATCH);
+        local.resize(local.size() - BATCH);
+    }
+}
+
+void BlockPool::PutBatch_(BufferBlock** blocks, size_t n) {
+    std::lock_guard<std::mutex> locker(mtx_);
+    for(size_t i = 0; i < n; i++) {
+        if(free_.size() < GLOBAL_MAX) {
+            free_.push_back(blocks[i]);
+        } else {
+            Delete_(blocks[i]);
+        }
+    }
+}
+
+size_t BlockPool::FreeCount() {
+    std::lock_guard<std::mutex> locker(mtx_);
+    return free_.size();
+}
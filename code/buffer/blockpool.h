@@ -0,0 +1,75 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-07-05
+ * @copyleft Apache 2.0
+ */
+#ifndef BLOCK_POOL_H
+#define BLOCK_POOL_H
+
+#include <mutex>
+#include <vector>
+#include <atomic>
+#include <stddef.h>
+
+// 缓冲区的数据块, 数据紧跟在块头后面; readPos到writePos之间是未读数据
+struct BufferBlock {
+    BufferBlock* next;
+    size_t cap;
+    size_t readPos;
+    size_t writePos;
+
+    char* data() { return reinterpret_cast<char*>(this + 1); }
+    const char* data() const { return reinterpret_cast<const char*>(this + 1); }
+    size_t Readable() const { return writePos - readPos; }
+    size_t Writable() const { return cap - writePos; }
+};
+
+/*
+ * 定长数据块池, 所有Buffer共用
+ * 每个线程先从自己的缓存里取还块, 不加锁; 线程缓存超过上限时把一半交还全局空闲链表, 空了再从全局批量取
+ * 超过块大小的请求(Pullup拼接大请求体)单独分配, 归还时直接释放
+ */
+class BlockPool {
+public:
+    // 每块连同块头共4KB
+    static const size_t BLOCK_SIZE = 4096;
+    static const size_t BLOCK_DATA = BLOCK_SIZE - sizeof(BufferBlock);
+
+    static BlockPool* Instance();
+
+    // 取一个容量至少为minCap的空块
+    BufferBlock* Get(size_t minCap = BLOCK_DATA);
+    void Put(BufferBlock* block);
+
+    // 已经分配出去(正在被Buffer使用)的块数
+    size_t InUse() const { return inUse_.load(std::memory_order_relaxed); }
+    // 全局空闲链表中的块数, 不含各线程缓存
+    size_t FreeCount();
+
+private:
+    BlockPool();
+    ~BlockPool();
+
+    // 线程缓存的上限和每次与全局交换的块数
+    static const size_t LOCAL_MAX = 64;
+    static const size_t BATCH = LOCAL_MAX / 2;
+    // 全局空闲块的上限(16MB), 超过的直接释放
+    static const size_t GLOBAL_MAX = 4096;
+
+    struct LocalCache_ {
+        std::vector<BufferBlock*> blocks;
+        ~LocalCache_();
+    };
+    static LocalCache_& Local_();
+
+    static BufferBlock* New_(size_t cap);
+    static void Delete_(BufferBlock* block);
+
+    void PutBatch_(BufferBlock** blocks, size_t n);
+
+    std::mutex mtx_;
+    std::vector<BufferBlock*> free_;
+    std::atomic<size_t> inUse_;
+};
+
+#endif //BLOCK_POOL_H
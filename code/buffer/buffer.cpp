@@ -2,68 +2,170 @@
  * @Author       : mark
  * @Date         : 2020-06-26
  * @copyleft Apache 2.0
- */ 
+ */
 #include "buffer.h"
-// 传入默认的缓冲区并且初始化缓冲区的大小，并且将读与写位置置零
-Buffer::Buffer(int initBuffSize) : buffer_(initBuffSize), readPos_(0), writePos_(0) {}
+#include <algorithm>
+// 缓冲区在第一次写入时才从块池取块
+Buffer::Buffer() : head_(nullptr), tail_(nullptr), retired_(nullptr), readable_(0) {}
+
+Buffer::~Buffer() {
+    FreeAll_();
+}
 // 返回未读字节大小
 size_t Buffer::ReadableBytes() const {
-    return writePos_ - readPos_;
+    return readable_;
 }
-// 返回可写字节大小
+// 返回最后一块的可写字节大小
 size_t Buffer::WritableBytes() const {
-    return buffer_.size() - writePos_;
+    return tail_ ? tail_->Writable() : 0;
 }
-// 返回已读大小(可以删除的大小)
+// 返回第一块中已读大小
 size_t Buffer::PrependableBytes() const {
-    return readPos_;
+    return head_ ? head_->readPos : 0;
 }
 // 返回当前读取位置的指针
 const char* Buffer::Peek() const {
-    // 通过缓冲区的起始指针加上读取位置的偏移量
-    return BeginPtr_() + readPos_;
+    return head_ ? head_->data() + head_->readPos : nullptr;
+}
+
+size_t Buffer::ContiguousBytes() const {
+    return head_ ? head_->Readable() : 0;
+}
+
+// 开头的数据跨块时拼接到一个块里: 第一块放得下就在第一块里整理, 否则取一个两倍大小的块,
+// 之后读进来的数据接着写在这个块的剩余空间里, 大请求体反复拼接的总代价仍是线性的
+const char* Buffer::Pullup(size_t len) {
+    assert(len <= readable_);
+    if(len == 0 || head_->Readable() >= len) {
+        return Peek();
+    }
+    BufferBlock* dst;
+    BufferBlock* src;
+    if(head_->cap >= len) {
+        dst = head_;
+        src = head_->next;
+        size_t readable = dst->Readable();
+        memmove(dst->data(), dst->data() + dst->readPos, readable);
+        dst->readPos = 0;
+        dst->writePos = readable;
+    } else {
+        dst = BlockPool::Instance()->Get(std::max(len * 2, readable_));
+        src = head_;
+    }
+    while(dst->Readable() < len) {
+        assert(src);
+        size_t n = std::min(src->Readable(), len - dst->Readable());
+        memcpy(dst->data() + dst->writePos, src->data() + src->readPos, n);
+        dst->writePos += n;
+        src->readPos += n;
+        if(src->Readable() == 0) {
+            BufferBlock* next = src->next;
+            if(src == tail_) { tail_ = dst; }
+            BlockPool::Instance()->Put(src);
+            src = next;
+        }
+    }
+    dst->next = src;
+    if(src == nullptr) { tail_ = dst; }
+    head_ = dst;
+    return Peek();
 }
-// 移动读取的位置
+
+int Buffer::PeekIov(size_t offset, size_t len, struct iovec* iov, int maxCnt, size_t* covered) const {
+    assert(offset + len <= readable_);
+    int cnt = 0;
+    size_t done = 0;
+    for(BufferBlock* b = head_; b && done < len && cnt < maxCnt; b = b->next) {
+        size_t readable = b->Readable();
+        if(offset >= readable) {
+            offset -= readable;
+            continue;
+        }
+        size_t n = std::min(readable - offset, len - done);
+        iov[cnt].iov_base = b->data() + b->readPos + offset;
+        iov[cnt].iov_len = n;
+        cnt++;
+        done += n;
+        offset = 0;
+    }
+    if(covered) { *covered = done; }
+    return cnt;
+}
+
+// 移动读取的位置, 读完的块先放到retired_, 下次写入时再归还
 void Buffer::Retrieve(size_t len) {
     assert(len <= ReadableBytes());
-    readPos_ += len;
+    readable_ -= len;
+    while(len > 0 || (head_ != tail_ && head_->Readable() == 0)) {
+        size_t n = std::min(len, head_->Readable());
+        head_->readPos += n;
+        len -= n;
+        if(head_->Readable() == 0 && head_ != tail_) {
+            BufferBlock* block = head_;
+            head_ = block->next;
+            block->next = retired_;
+            retired_ = block;
+        }
+    }
+    if(readable_ == 0 && tail_) {
+        // 全部读完, 下次从块头开始写
+        tail_->readPos = tail_->writePos = 0;
+    }
 }
-// 移动读取位置直到指定位置
+// 移动读取位置直到指定位置, end必须在第一块内
 void Buffer::RetrieveUntil(const char* end) {
-    // 这可读位置只能是之后可读的位置
-    assert(Peek() <= end );
-    // 两个指针相减就是两个指针之间的偏移量
+    assert(Peek() <= end && end <= Peek() + head_->Readable());
     Retrieve(end - Peek());
 }
-// 重置缓冲区，清空所有数据
+// 清空所有数据, 只留一个标准块
 void Buffer::RetrieveAll() {
-    bzero(&buffer_[0], buffer_.size());
-    readPos_ = 0;
-    writePos_ = 0;
+    Recycle_();
+    if(!head_) { return; }
+    BufferBlock* keep = head_->cap == BlockPool::BLOCK_DATA ? head_ : nullptr;
+    BufferBlock* block = keep ? head_->next : head_;
+    while(block) {
+        BufferBlock* next = block->next;
+        BlockPool::Instance()->Put(block);
+        block = next;
+    }
+    if(keep) {
+        keep->next = nullptr;
+        keep->readPos = keep->writePos = 0;
+    }
+    head_ = tail_ = keep;
+    readable_ = 0;
+}
+
+bool Buffer::Release() {
+    if(readable_ > 0) { return false; }
+    FreeAll_();
+    return true;
 }
 // 读取所有数据并返回字符串
 std::string Buffer::RetrieveAllToStr() {
-    // 当前读取位置指针加上可以读大小的偏移量
-    std::string str(Peek(), ReadableBytes());
-    // 清空
+    std::string str;
+    str.reserve(readable_);
+    for(BufferBlock* b = head_; b; b = b->next) {
+        str.append(b->data() + b->readPos, b->Readable());
+    }
     RetrieveAll();
-    // 控制台输出日志
-    std::cout << str << std::endl;
     return str;
 }
 // 返回当前可写位置的常量指针
 const char* Buffer::BeginWriteConst() const {
-    // 缓冲区起始指针加减已写大小的偏移量
-    return BeginPtr_() + writePos_;
+    return tail_ ? tail_->data() + tail_->writePos : nullptr;
 }
-// 返回当前可写位置的常量指针
+// 返回当前可写位置的指针
 char* Buffer::BeginWrite() {
-    return BeginPtr_() + writePos_;
+    return tail_ ? tail_->data() + tail_->writePos : nullptr;
 }
 // 更新写入位置
 void Buffer::HasWritten(size_t len) {
-    writePos_ += len;
-} 
+    assert(len == 0 || (tail_ && tail_->Writable() >= len));
+    if(len == 0) { return; }
+    tail_->writePos += len;
+    readable_ += len;
+}
 // 追加字符串
 void Buffer::Append(const std::string& str) {
     // 将string转为char*
@@ -77,94 +179,120 @@ void Buffer::Append(const void* data, size_t len) {
     Append(static_cast<const char*>(data), len);
 }
 
+// 填满最后一块后再挂新块, 已有数据不搬移
 void Buffer::Append(const char* str, size_t len) {
     // 判空
     assert(str);
-    // 确保有可用大小的缓冲区
-    EnsureWriteable(len);
-    // TODO：copy函数是直接复制的，复杂度是线性的
-    // 将要写入的数据复制到可写位置
-    std::copy(str, str + len, BeginWrite());
-    // 更新写入位置
-    HasWritten(len);
+    Recycle_();
+    readable_ += len;
+    while(len > 0) {
+        if(!tail_ || tail_->Writable() == 0) {
+            PushBlock_(BlockPool::Instance()->Get());
+        }
+        size_t n = std::min(len, tail_->Writable());
+        memcpy(tail_->data() + tail_->writePos, str, n);
+        tail_->writePos += n;
+        str += n;
+        len -= n;
+    }
 }
 
 void Buffer::Append(const Buffer& buff) {
-    Append(buff.Peek(), buff.ReadableBytes());
+    for(BufferBlock* b = buff.head_; b; b = b->next) {
+        if(b->Readable() > 0) {
+            Append(b->data() + b->readPos, b->Readable());
+        }
+    }
 }
-// 确保可写字节数足够
+// 确保最后一块有len个连续的可写字节, 不够时挂一个新块
 void Buffer::EnsureWriteable(size_t len) {
-    // 如果可写空间不够直接腾出一片空间
-    if(WritableBytes() < len) {
-        MakeSpace_(len);
+    Recycle_();
+    if(WritableBytes() >= len) {
+        return;
     }
+    PushBlock_(BlockPool::Instance()->Get(len));
     assert(WritableBytes() >= len);
 }
 // 从文件描述符 fd 中读取数据到缓冲区（仿照moduo网络库）
+// 分散读到最后一块的剩余空间和栈上的临时空间, 只有真正读到的字节才拷进新块
 ssize_t Buffer::ReadFd(int fd, int* saveErrno) {
-    char buff[65535];
+    Recycle_();
+    char extra[READ_EXTRA];
     struct iovec iov[2];
+    int cnt = 0;
     const size_t writable = WritableBytes();
-    /* 分散读， 保证数据全部读完 */
-    iov[0].iov_base = BeginPtr_() + writePos_;
-    iov[0].iov_len = writable;
-    // 这表示如果数据长度超过了可写入的字节数，剩余的数据将被读取到 buff 中。
-    iov[1].iov_base = buff;
-    iov[1].iov_len = sizeof(buff);
-    // len（已读字节数） =readv (文件描述符socketfd iovec结构体 iovec缓冲区区块个数)
-    const ssize_t len = readv(fd, iov, 2);
+    if(writable > 0) {
+        iov[cnt].iov_base = BeginWrite();
+        iov[cnt].iov_len = writable;
+        cnt++;
+    }
+    iov[cnt].iov_base = extra;
+    iov[cnt].iov_len = sizeof(extra);
+    cnt++;
+    const ssize_t len = readv(fd, iov, cnt);
     if(len < 0) {
         *saveErrno = errno;
-    }
-    else if(static_cast<size_t>(len) <= writable) {
-        // 写入本身的缓冲区
-        writePos_ += len;
-    }
-    else {
-        // 将可读位置直接设置为buffer最后
-        writePos_ = buffer_.size();
-        // 将文件剩余部分直接添加到buffer里（一定会触发makespace）
-        Append(buff, len - writable);
+    } else if(static_cast<size_t>(len) <= writable) {
+        HasWritten(len);
+    } else {
+        HasWritten(writable);
+        Append(extra, len - writable);
     }
     return len;
 }
-
+// 聚集写整条链
 ssize_t Buffer::WriteFd(int fd, int* saveErrno) {
-    size_t readSize = ReadableBytes();
-    //len==已经写入的数据长度， 将所有要发送的数据都写入发送缓冲区
-    ssize_t len = write(fd, Peek(), readSize);
+    struct iovec iov[WRITE_IOV];
+    int cnt = PeekIov(0, readable_, iov, WRITE_IOV, nullptr);
+    ssize_t len = writev(fd, iov, cnt);
     if(len < 0) {
         *saveErrno = errno;
         return len;
-    } 
+    }
     // 读完数据==发送完数据
-    readPos_ += len;
+    Retrieve(len);
     return len;
 }
-// 返回缓冲区数据起始位置的非常量指针
-char* Buffer::BeginPtr_() {
-    return &*buffer_.begin();
+
+// 把块挂到链尾; 原来的尾块如果是空的就换掉
+void Buffer::PushBlock_(BufferBlock* block) {
+    block->next = nullptr;
+    if(!tail_) {
+        head_ = tail_ = block;
+        return;
+    }
+    if(tail_->Readable() == 0) {
+        BufferBlock* empty = tail_;
+        if(head_ == empty) {
+            head_ = block;
+        } else {
+            BufferBlock* prev = head_;
+            while(prev->next != empty) { prev = prev->next; }
+            prev->next = block;
+        }
+        tail_ = block;
+        BlockPool::Instance()->Put(empty);
+        return;
+    }
+    tail_->next = block;
+    tail_ = block;
 }
-// 返回缓冲区数据起始位置的常量指针
-const char* Buffer::BeginPtr_() const {
-    return &*buffer_.begin();
+
+void Buffer::Recycle_() {
+    while(retired_) {
+        BufferBlock* next = retired_->next;
+        BlockPool::Instance()->Put(retired_);
+        retired_ = next;
+    }
 }
 
-// 如果缓冲区大小可以满足要求写入的大小，那么就直接删除已经读过的数据，并且将未读的数据移动到最前面
-// 如果缓冲区大小不够，那么就扩大缓冲区大小
-void Buffer::MakeSpace_(size_t len) {
-    if(WritableBytes() + PrependableBytes() < len) {
-        // TODO：我认为直接拓展缓冲区大小的整数倍最好(reszie是非常耗时的)
-        // 直接扩展出所需的空间大小
-        buffer_.resize(writePos_ + len + 1);
-    } 
-    else {
-        size_t readable = ReadableBytes();
-        // BeginPtr_() + readPos_ 到 BeginPtr_() + writePos_ 之间的数据将被复制到 BeginPtr_() 开始的位置
-        std::copy(BeginPtr_() + readPos_, BeginPtr_() + writePos_, BeginPtr_());
-        readPos_ = 0;
-        writePos_ = readPos_ + readable;
-        // TODO：这不是一定会触发断言嘛？
-        assert(readable == ReadableBytes());
-    }
-}
\ No newline at end of file
+void Buffer::FreeAll_() {
+    Recycle_();
+    while(head_) {
+        BufferBlock* next = head_->next;
+        BlockPool::Instance()->Put(head_);
+        head_ = next;
+    }
+    tail_ = nullptr;
+    readable_ = 0;
+}
@@ -2,29 +2,46 @@
  * @Author       : mark
  * @Date         : 2020-06-26
  * @copyleft Apache 2.0
- */ 
+ */
 
 #ifndef BUFFER_H
 #define BUFFER_H
 #include <cstring>   //perror
-#include <iostream>
+#include <string>
 #include <unistd.h>  // write
 #include <sys/uio.h> //readv
-#include <vector> //readv
-#include <atomic>
 #include <assert.h>
+#include "blockpool.h"
+
+/*
+ * 由定长数据块串成的缓冲区, 数据块从BlockPool中取用
+ * 写入时接在最后一块后面, 写满了再挂一个新块, 不会整体扩容搬移; 读写套接字用readv/writev直接覆盖整条链
+ * 读完的块在下一次写入时还给块池, 所以取走数据后、再次写入前, 指向这些数据的指针仍然有效
+ * 需要连续内存时(解析请求)用Pullup把开头的数据拼到一个块里
+ */
 class Buffer {
 public:
-    // 初始化缓冲区大小，如果没有指定默认1024
-    Buffer(int initBuffSize = 1024);
-    ~Buffer() = default;
+    Buffer();
+    ~Buffer();
+
+    Buffer(const Buffer&) = delete;
+    Buffer& operator=(const Buffer&) = delete;
 
     //返回相关的参数
-    size_t WritableBytes() const;       
+    size_t WritableBytes() const;
     size_t ReadableBytes() const ;
     size_t PrependableBytes() const;
 
+    // 第一块中的未读数据; 数据跨块时只有第一块是连续的
     const char* Peek() const;
+    // Peek()开始连续存放的字节数
+    size_t ContiguousBytes() const;
+    // 让开头len个字节连续存放并返回起始地址
+    const char* Pullup(size_t len);
+    // 把从第offset个未读字节开始的len个字节填进iovec, 返回用掉的个数, covered带回实际覆盖的字节数
+    int PeekIov(size_t offset, size_t len, struct iovec* iov, int maxCnt, size_t* covered) const;
+
+    // 保证最后一块有len个连续的可写字节
     void EnsureWriteable(size_t len);
     void HasWritten(size_t len);
 
@@ -33,6 +50,8 @@ public:
 
     void RetrieveAll() ;
     std::string RetrieveAllToStr();
+    // 没有未读数据时把所有块还给块池, 下次写入时再取; 返回是否释放了
+    bool Release();
 
     const char* BeginWriteConst() const;
     char* BeginWrite();
@@ -47,15 +66,21 @@ public:
     ssize_t WriteFd(int fd, int* Errno);
 
 private:
-    char* BeginPtr_();
-    const char* BeginPtr_() const;
-    void MakeSpace_(size_t len);
-
-    //使用STL vector来做缓冲区大小
-    std::vector<char> buffer_;
-    // 原子化读写大小。
-    std::atomic<std::size_t> readPos_;
-    std::atomic<std::size_t> writePos_;
+    void PushBlock_(BufferBlock* block);
+    // 把已读完的块还给块池
+    void Recycle_();
+    void FreeAll_();
+
+    // ReadFd除了最后一块的剩余空间外, 一次最多再读这么多字节(栈上的临时空间)
+    static const size_t READ_EXTRA = 65536;
+    static const int WRITE_IOV = 64;
+
+    // 未读数据从head_开始, 新数据写在tail_
+    BufferBlock* head_;
+    BufferBlock* tail_;
+    // 已读完、等待下次写入时归还的块
+    BufferBlock* retired_;
+    size_t readable_;
 };
 
-#endif //BUFFER_H
\ No newline at end of file
+#endif //BUFFER_H
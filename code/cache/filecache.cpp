@@ -0,0 +1,303 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-27
+ * @copyleft Apache 2.0
+ */
+#include "filecache.h"
+
+using namespace std;
+
+FrequencySketch::FrequencySketch(size_t width) {
+    size_t w = 1;
+    while(w < width) { w <<= 1; }
+    mask_ = w - 1;
+    additions_ = 0;
+    sampleSize_ = w * 10;
+    table_.assign(w * DEPTH, 0);
+}
+
+size_t FrequencySketch::Index_(uint64_t hash, int row) const {
+    // 每一行用不同的种子重新打散
+    uint64_t h = (hash + row * 0x9E3779B97F4A7C15ULL) * 0xBF58476D1CE4E5B9ULL;
+    h ^= h >> 31;
+    return row * (mask_ + 1) + (h & mask_);
+}
+
+void FrequencySketch::Increment(uint64_t hash) {
+    bool added = false;
+    for(int i = 0; i < DEPTH; i++) {
+        uint8_t& c = table_[Index_(hash, i)];
+        if(c < 15) {
+            c++;
+            added = true;
+        }
+    }
+    if(added && ++additions_ >= sampleSize_) {
+        Reset_();
+    }
+}
+
+uint8_t FrequencySketch::Estimate(uint64_t hash) const {
+    uint8_t freq = 15;
+    for(int i = 0; i < DEPTH; i++) {
+        freq = min(freq, table_[Index_(hash, i)]);
+    }
+    return freq;
+}
+
+// 所有计数减半
+void FrequencySketch::Reset_() {
+    for(auto& c: table_) { c >>= 1; }
+    additions_ /= 2;
+}
+
+FileCache::FileCache(): capacity_(0), maxFileSize_(0), bytes_(0), epoch_(0),
+            hits_(0), misses_(0), inotifyFd_(-1), isClose_(true) {
+    hand_ = clock_.end();
+}
+
+FileCache::~FileCache() {
+    Close();
+}
+
+FileCache* FileCache::Instance() {
+    static FileCache cache;
+    return &cache;
+}
+
+void FileCache::Init(const string& srcDir, size_t capacity, size_t maxFileSize) {
+    assert(srcDir != "");
+    Close();
+    srcDir_ = srcDir;
+    // 统一去掉末尾的'/', 键都以'/'开头
+    while(srcDir_.size() > 1 && srcDir_.back() == '/') { srcDir_.pop_back(); }
+    capacity_ = capacity;
+    maxFileSize_ = min(maxFileSize, capacity);
+    isClose_ = false;
+
+    inotifyFd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if(inotifyFd_ < 0) {
+        LOG_ERROR("FileCache inotify init error!");
+        return;
+    }
+    AddWatch_("");
+    watchThread_.reset(new thread(&FileCache::Watch_, this));
+}
+
+void FileCache::Close() {
+    isClose_ = true;
+    if(watchThread_ && watchThread_->joinable()) {
+        watchThread_->join();
+    }
+    watchThread_.reset();
+    if(inotifyFd_ >= 0) {
+        close(inotifyFd_);
+        inotifyFd_ = -1;
+    }
+    watchDirs_.clear();
+    Clear();
+}
+
+shared_ptr<const CachedFile> FileCache::Find(const string& path) {
+    if(capacity_ == 0) { return nullptr; }
+    uint64_t hash = std::hash<string>()(path);
+    lock_guard<mutex> locker(mtx_);
+    auto it = table_.find(path);
+    if(it == table_.end()) { return nullptr; }
+    sketch_.Increment(hash);
+    it->second->ref = true;
+    hits_++;
+    return it->second->file;
+}
+
+shared_ptr<const CachedFile> FileCache::Get(const string& path, size_t maxFileSize) {
+    if(capacity_ == 0) { return nullptr; }
+    uint64_t hash = std::hash<string>()(path);
+    uint64_t epoch;
+    {
+        lock_guard<mutex> locker(mtx_);
+        epoch = epoch_;
+        sketch_.Increment(hash);
+        auto it = table_.find(path);
+        if(it != table_.end()) {
+            it->second->ref = true;
+            hits_++;
+            return it->second->file;
+        }
+    }
+    misses_++;
+
+    struct stat st;
+    if(stat((srcDir_ + path).data(), &st) < 0 || !S_ISREG(st.st_mode)
+        || !(st.st_mode & S_IROTH)
+        || static_cast<size_t>(st.st_size) > min(maxFileSize ? maxFileSize : maxFileSize_, capacity_)) {
+        return nullptr;
+    }
+    {
+        // 缓存已满时, 第一次出现的文件不读入(门卫), 交给调用者直接读取
+        lock_guard<mutex> locker(mtx_);
+        if(bytes_ + st.st_size > capacity_ && sketch_.Estimate(hash) < 2) {
+            return nullptr;
+        }
+    }
+
+    shared_ptr<CachedFile> file = Load_(path, st);
+    if(!file) { return nullptr; }
+
+    lock_guard<mutex> locker(mtx_);
+    auto it = table_.find(path);
+    if(it != table_.end()) {
+        // 其他线程已经装入
+        return it->second->file;
+    }
+    if(epoch == epoch_ && MakeRoom_(hash, file->Bytes())) {
+        EntryIter pos = clock_.insert(hand_, {hash, false, file});
+        table_[path] = pos;
+        bytes_ += file->Bytes();
+    }
+    // 没被准入时本次仍然用读出来的内容响应
+    return file;
+}
+
+// 读取整个文件, 读取过程中文件被修改(大小变化)则放弃
+shared_ptr<CachedFile> FileCache::Load_(const string& path, const struct stat& st) {
+    int fd = open((srcDir_ + path).data(), O_RDONLY | O_CLOEXEC);
+    if(fd < 0) { return nullptr; }
+    shared_ptr<CachedFile> file = make_shared<CachedFile>();
+    file->path = path;
+    file->st = st;
+    file->data.reset(new char[st.st_size > 0 ? st.st_size : 1]);
+    size_t done = 0;
+    while(done < static_cast<size_t>(st.st_size)) {
+        ssize_t len = read(fd, file->data.get() + done, st.st_size - done);
+        if(len < 0 && errno == EINTR) { continue; }
+        if(len <= 0) { break; }
+        done += len;
+    }
+    close(fd);
+    if(done != static_cast<size_t>(st.st_size)) {
+        LOG_WARN("FileCache load %s error!", path.c_str());
+        return nullptr;
+    }
+    if(onLoad_) { onLoad_(*file); }
+    return file;
+}
+
+// CLOCK选出牺牲者: 访问位为1的清零后跳过, 遇到访问位为0的就是牺牲者
+// 牺牲者的估计频率不低于候选者时拒绝准入
+bool FileCache::MakeRoom_(uint64_t hash, size_t size) {
+    if(size > capacity_) { return false; }
+    uint8_t freq = sketch_.Estimate(hash);
+    while(bytes_ + size > capacity_) {
+        assert(!clock_.empty());
+        if(hand_ == clock_.end()) { hand_ = clock_.begin(); }
+        if(hand_->ref) {
+            hand_->ref = false;
+            ++hand_;
+            continue;
+        }
+        if(sketch_.Estimate(hand_->hash) >= freq) {
+            return false;
+        }
+        Remove_(hand_++);
+    }
+    return true;
+}
+
+void FileCache::Remove_(EntryIter it) {
+    bytes_ -= it->file->Bytes();
+    table_.erase(it->file->path);
+    if(hand_ == it) { ++hand_; }
+    clock_.erase(it);
+}
+
+void FileCache::Invalidate(const string& path) {
+    lock_guard<mutex> locker(mtx_);
+    epoch_++;
+    auto it = table_.find(path);
+    if(it != table_.end()) {
+        LOG_DEBUG("FileCache invalidate %s", path.c_str());
+        Remove_(it->second);
+    }
+}
+
+void FileCache::Clear() {
+    lock_guard<mutex> locker(mtx_);
+    epoch_++;
+    table_.clear();
+    clock_.clear();
+    hand_ = clock_.end();
+    bytes_ = 0;
+}
+
+size_t FileCache::Bytes() {
+    lock_guard<mutex> locker(mtx_);
+    return bytes_;
+}
+
+size_t FileCache::Count() {
+    lock_guard<mutex> locker(mtx_);
+    return table_.size();
+}
+
+// 递归监听目录, dir是相对于srcDir的路径("" 表示srcDir本身)
+void FileCache::AddWatch_(const string& dir) {
+    string full = srcDir_ + dir;
+    int wd = inotify_add_watch(inotifyFd_, full.data(),
+                IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB | IN_CREATE | IN_DELETE |
+                IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF);
+    if(wd < 0) {
+        LOG_WARN("FileCache watch %s error!", full.c_str());
+        return;
+    }
+    watchDirs_[wd] = dir;
+    DIR* dp = opendir(full.data());
+    if(!dp) { return; }
+    while(struct dirent* ent = readdir(dp)) {
+        if(ent->d_name[0] == '.') { continue; }
+        string sub = dir + "/" + ent->d_name;
+        struct stat st;
+        if(stat((srcDir_ + sub).data(), &st) == 0 && S_ISDIR(st.st_mode)) {
+            AddWatch_(sub);
+        }
+    }
+    closedir(dp);
+}
+
+// 后台线程: 读取inotify事件并使对应条目失效
+void FileCache::Watch_() {
+    alignas(struct inotify_event) char buf[4096];
+    struct pollfd pfd = { inotifyFd_, POLLIN, 0 };
+    while(!isClose_) {
+        if(poll(&pfd, 1, 500) <= 0) { continue; }
+        ssize_t len = read(inotifyFd_, buf, sizeof(buf));
+        for(ssize_t i = 0; i < len; ) {
+            struct inotify_event* ev = reinterpret_cast<struct inotify_event*>(buf + i);
+            i += sizeof(struct inotify_event) + ev->len;
+            if(ev->mask & IN_Q_OVERFLOW) {
+                // 事件丢失, 无法知道哪些文件变了
+                Clear();
+                continue;
+            }
+            auto dir = watchDirs_.find(ev->wd);
+            if(dir == watchDirs_.end()) { continue; }
+            if(ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) {
+                watchDirs_.erase(dir);
+                Clear();
+                continue;
+            }
+            if(ev->len == 0) { continue; }
+            string path = dir->second + "/" + ev->name;
+            if((ev->mask & IN_ISDIR) && (ev->mask & (IN_CREATE | IN_MOVED_TO))) {
+                AddWatch_(path);
+            }
+            else if(ev->mask & IN_ISDIR) {
+                // 目录被删除或移走, 目录下的条目全部作废
+                Clear();
+            }
+            else {
+                Invalidate(path);
+            }
+        }
+    }
+}
@@ -0,0 +1,142 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-27
+ * @copyleft Apache 2.0
+ */
+#ifndef FILE_CACHE_H
+#define FILE_CACHE_H
+
+#include <unordered_map>
+#include <list>
+#include <vector>
+#include <string>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <stdint.h>
+#include <fcntl.h>          // open
+#include <unistd.h>         // read, close
+#include <dirent.h>         // opendir
+#include <poll.h>
+#include <sys/stat.h>       // stat
+#include <sys/inotify.h>
+
+#include "../log/log.h"
+
+// 缓存中的一个静态文件: 内容与元数据, 创建之后只读
+struct CachedFile {
+    std::string path;   // 相对于srcDir的路径, 例如 /index.html
+    struct stat st;
+    std::unique_ptr<char[]> data;
+    // 以下由onLoad回调在装入时生成, 为空时由使用者现场生成
+    // gzip压缩后的内容, 不是文本或者压缩效果不好时为空
+    std::string gzip;
+    // 校验器: ETag和Last-Modified的值, etag[1]是gzip版本的ETag
+    std::string etag[2];
+    std::string lastModified;
+    // 200响应头, 下标为[是否gzip][是否长连接]
+    std::string header[2][2];
+
+    // 占用的缓存容量
+    size_t Bytes() const { return st.st_size + gzip.size(); }
+};
+
+/*
+ * 频率估计(Count-Min Sketch), TinyLFU的准入依据
+ * 4行4位计数器(这里用uint8_t存放, 上限15), 计数总量达到采样窗口后全部减半, 让旧的热度逐渐衰减
+ */
+class FrequencySketch {
+public:
+    explicit FrequencySketch(size_t width = 4096);
+
+    void Increment(uint64_t hash);
+    uint8_t Estimate(uint64_t hash) const;
+
+private:
+    size_t Index_(uint64_t hash, int row) const;
+    void Reset_();
+
+    static const int DEPTH = 4;
+    size_t mask_;
+    size_t additions_;
+    size_t sampleSize_;
+    std::vector<uint8_t> table_;
+};
+
+/*
+ * 静态文件缓存, 所有Reactor和工作线程共享
+ * 按字节数限制容量, 淘汰用CLOCK(二次机会), 准入用TinyLFU:
+ * 需要淘汰时, 候选文件至少被访问过两次且比CLOCK选出的牺牲者更热才会被放进来,
+ * 所以偶尔访问一次的大文件不会把热点文件挤出去
+ * 后台线程通过inotify监听srcDir(含子目录), 文件被修改、删除、移动时使对应条目失效
+ */
+class FileCache {
+public:
+    static FileCache* Instance();
+
+    void Init(const std::string& srcDir, size_t capacity = 64 << 20,
+              size_t maxFileSize = 4 << 20);
+    void Close();
+
+    // 命中或者成功装入时返回文件, 否则返回空(不可缓存或未被准入), 由调用者自行读取
+    // maxFileSize不为0时代替Init设置的单个文件大小上限
+    std::shared_ptr<const CachedFile> Get(const std::string& path, size_t maxFileSize = 0);
+    // 只查已缓存的文件, 不读磁盘; 未命中时不计入统计, 由之后的Get处理
+    std::shared_ptr<const CachedFile> Find(const std::string& path);
+    void Invalidate(const std::string& path);
+    void Clear();
+    // 文件读入后、放进缓存前调用, 用来准备和文件内容一起缓存的数据; 在Init之后、开始服务之前设置
+    void SetOnLoad(std::function<void(CachedFile&)> onLoad) { onLoad_ = std::move(onLoad); }
+
+    size_t Capacity() const { return capacity_; }
+    size_t Hits() const { return hits_; }
+    size_t Misses() const { return misses_; }
+    size_t Bytes();
+    size_t Count();
+
+private:
+    FileCache();
+    ~FileCache();
+
+    struct Entry_ {
+        uint64_t hash;
+        bool ref;
+        std::shared_ptr<const CachedFile> file;
+    };
+    typedef std::list<Entry_>::iterator EntryIter;
+
+    std::shared_ptr<CachedFile> Load_(const std::string& path, const struct stat& st);
+    bool MakeRoom_(uint64_t hash, size_t size);
+    void Remove_(EntryIter it);
+
+    void AddWatch_(const std::string& dir);
+    void Watch_();
+
+    std::string srcDir_;
+    size_t capacity_;
+    size_t maxFileSize_;
+    size_t bytes_;
+    // 每次失效加一, 装入文件期间发生过失效则不放进缓存
+    uint64_t epoch_;
+
+    std::atomic<size_t> hits_;
+    std::atomic<size_t> misses_;
+    std::function<void(CachedFile&)> onLoad_;
+
+    // CLOCK环: hand_指向下一个被检查的条目, 新条目插在hand_之前
+    std::list<Entry_> clock_;
+    EntryIter hand_;
+    std::unordered_map<std::string, EntryIter> table_;
+    FrequencySketch sketch_;
+    std::mutex mtx_;
+
+    int inotifyFd_;
+    // inotify的watch描述符 -> 相对于srcDir的目录
+    std::unordered_map<int, std::string> watchDirs_;
+    std::atomic<bool> isClose_;
+    std::unique_ptr<std::thread> watchThread_;
+};
+
+#endif //FILE_CACHE_H
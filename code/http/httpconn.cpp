@@ -10,11 +10,16 @@ using namespace std;
 const char* HttpConn::srcDir;
 std::atomic<int> HttpConn::userCount; 
 bool HttpConn::isET;
+bool HttpConn::releaseIdle = true;
 
 HttpConn::HttpConn() { 
     fd_ = -1;
+    gen_ = 0;
     addr_ = { 0 };
     isClose_ = true;
+    isKeepAlive_ = false;
+    isCorked_ = false;
+    sent_ = bodyBytes_ = segHead_ = 0;
 };
 
 HttpConn::~HttpConn() { 
@@ -26,16 +31,23 @@ void HttpConn::init(int fd, const sockaddr_in& addr) {
     userCount++;
     addr_ = addr;
     fd_ = fd;
+    gen_.fetch_add(1, std::memory_order_release);
     writeBuff_.RetrieveAll();
     readBuff_.RetrieveAll();
+    ClearOutput_();
+    request_.Init();
+    isKeepAlive_ = false;
+    isCorked_ = false;
     isClose_ = false;
     LOG_INFO("Client[%d](%s:%d) in, userCount:%d", fd_, GetIP(), GetPort(), (int)userCount);
 }
 
 void HttpConn::Close() {
     response_.UnmapFile();
+    ClearOutput_();
     if(isClose_ == false){
         isClose_ = true; 
+        gen_.fetch_add(1, std::memory_order_release);
         userCount--;
         close(fd_);
         LOG_INFO("Client[%d](%s:%d) quit, UserCount:%d", fd_, GetIP(), GetPort(), (int)userCount);
@@ -72,64 +84,199 @@ ssize_t HttpConn::read(int* saveErrno) {
 
 ssize_t HttpConn::write(int* saveErrno) {
     ssize_t len = -1;
+    struct iovec iov[MAX_IOV];
     do {
-        len = writev(fd_, iov_, iovCnt_);
+        int iovCnt = FillIov_(iov, MAX_IOV);
+        if(iovCnt > 0) {
+            len = writev(fd_, iov, iovCnt);
+        } else if(segHead_ < bodies_.size()) {
+            /* 队头是需要sendfile的文件 */
+            len = SendFile_(saveErrno);
+        } else {
+            break; /* 传输结束 */
+        }
         if(len <= 0) {
             *saveErrno = errno;
             break;
         }
-        if(iov_[0].iov_len + iov_[1].iov_len  == 0) { break; } /* 传输结束 */
-        // 如果写入长度大于第一个缓冲区的长度
-        else if(static_cast<size_t>(len) > iov_[0].iov_len) {
-            // 移动第二个缓冲区的指针
-            iov_[1].iov_base = (uint8_t*) iov_[1].iov_base + (len - iov_[0].iov_len);
-            // 更新第二个缓冲区的长度
-            iov_[1].iov_len -= (len - iov_[0].iov_len);
-            if(iov_[0].iov_len) {
-                writeBuff_.RetrieveAll();
-                iov_[0].iov_len = 0;
-            }
-        }
-        else {
-            // 移动第一个缓冲区的指针
-            iov_[0].iov_base = (uint8_t*)iov_[0].iov_base + len; 
-            //  更新第一个缓冲区的长度
-            iov_[0].iov_len -= len; 
-            writeBuff_.Retrieve(len);
-        }
+        Consume_(len);
         // 循环直到写入结束或达到最大写入字节数（10,240 字节
-    } while(isET || ToWriteBytes() > 10240);
+    } while(ToWriteBytes() > 0 && (isET || ToWriteBytes() > 10240));
     return len;
 }
 
-// 第一个缓冲区存储 HTTP 响应的头部信息和其他文本数据。
-// 第二个缓冲区存储实际的文件数据（如果有）
+// 用sendfile把页缓存中的文件直接发到套接字, 不经过用户态内存
+// 发送期间打开TCP_CORK, 让响应头和文件开头合并成满的报文段, 写完后再拔掉塞子
+ssize_t HttpConn::SendFile_(int* saveErrno) {
+    BodySeg_& seg = bodies_[segHead_];
+    assert(seg.data == nullptr && seg.fd >= 0);
+    ssize_t len = sendfile(fd_, seg.fd, &seg.offset, seg.len);
+    if(len < 0) {
+        *saveErrno = errno;
+    }
+    else if(len == 0) {
+        /* 文件被截断 */
+        LOG_WARN("Client[%d] sendfile short read", fd_);
+        errno = EIO;
+        return -1;
+    }
+    return len;
+}
 
-// iovCnt_ 的值将设置为1，表示只有一个缓冲区需要写入。
-bool HttpConn::process() {
-    request_.Init();
-    if(readBuff_.ReadableBytes() <= 0) {
-        return false;
+void HttpConn::SetCork_(bool on) {
+    if(isCorked_ == on) { return; }
+    int opt = on ? 1 : 0;
+    setsockopt(fd_, IPPROTO_TCP, TCP_CORK, &opt, sizeof(opt));
+    isCorked_ = on;
+}
+
+// 按发送顺序把写缓冲区与各个响应体交替填进iovec, 遇到需要sendfile的片段为止
+// 写缓冲区由多个块组成, 一段响应头可能占用多个iovec
+int HttpConn::FillIov_(struct iovec* iov, int maxCnt) const {
+    int cnt = 0;
+    size_t bufLen = writeBuff_.ReadableBytes();
+    size_t off = 0;
+    for(size_t i = segHead_; i < bodies_.size() && cnt < maxCnt; i++) {
+        const BodySeg_& seg = bodies_[i];
+        size_t pos = seg.pos - sent_;
+        if(pos > off) {
+            size_t covered;
+            cnt += writeBuff_.PeekIov(off, pos - off, iov + cnt, maxCnt - cnt, &covered);
+            if(covered < pos - off || cnt == maxCnt) { return cnt; }
+            off = pos;
+        }
+        if(seg.data == nullptr) {
+            return cnt;
+        }
+        iov[cnt].iov_base = const_cast<char*>(seg.data);
+        iov[cnt].iov_len = seg.len;
+        cnt++;
+    }
+    if(off < bufLen && cnt < maxCnt) {
+        cnt += writeBuff_.PeekIov(off, bufLen - off, iov + cnt, maxCnt - cnt, nullptr);
+    }
+    return cnt;
+}
+
+// 从写队列头部去掉已经发送的len个字节
+void HttpConn::Consume_(size_t len) {
+    while(len > 0) {
+        size_t bufFirst = writeBuff_.ReadableBytes();
+        if(segHead_ < bodies_.size()) {
+            bufFirst = bodies_[segHead_].pos - sent_;
+        }
+        if(bufFirst > 0) {
+            size_t n = std::min(len, bufFirst);
+            writeBuff_.Retrieve(n);
+            sent_ += n;
+            len -= n;
+            continue;
+        }
+        BodySeg_& seg = bodies_[segHead_];
+        size_t n = std::min(len, seg.len);
+        if(seg.data) {
+            seg.data += n;
+        }
+        /* sendfile自己推进了offset */
+        seg.len -= n;
+        bodyBytes_ -= n;
+        len -= n;
+        if(seg.len == 0) {
+            seg.hold.reset();
+            segHead_++;
+        }
     }
-    else if(request_.parse(readBuff_)) {
-        LOG_DEBUG("%s", request_.path().c_str());
-        response_.Init(srcDir, request_.path(), request_.IsKeepAlive(), 200);
-    } else {
-        response_.Init(srcDir, request_.path(), false, 400);
+    if(ToWriteBytes() == 0) {
+        ClearOutput_();
+        writeBuff_.RetrieveAll();
+        SetCork_(false);
     }
+}
+
+void HttpConn::ClearOutput_() {
+    bodies_.clear();
+    segHead_ = 0;
+    sent_ = 0;
+    bodyBytes_ = 0;
+}
+
+// 依次处理读缓冲区中所有完整的请求(HTTP/1.1 pipelining)
+// 响应头写进写缓冲区, 文件内容作为响应体片段引用映射内存, 最后一次writev全部发出
+// 不完整的请求保留解析状态, 等读到更多数据后继续
+bool HttpConn::process(bool cachedOnly) {
+    int cnt = 0;
+    while(cnt < MAX_PIPELINE) {
+        HttpRequest::HTTP_CODE ret;
+        if(request_.IsFinished()) {
+            /* 上次停在等待数据库验证或者留给线程池的请求上 */
+            ret = HttpRequest::GET_REQUEST;
+        } else {
+            if(readBuff_.ReadableBytes() == 0) { break; }
+            ret = request_.parse(readBuff_);
+        }
+        if(ret == HttpRequest::NO_REQUEST) {
+            break;
+        }
+        std::shared_ptr<const CachedFile> cached;
+        if(cachedOnly && ret == HttpRequest::GET_REQUEST && (request_.NeedVerify() ||
+                          !(cached = FileCache::Instance()->Find(request_.path())))) {
+            /* 不是简单的缓存命中, 留给调用者换到线程池里处理 */
+            break;
+        }
+        if(ret == HttpRequest::GET_REQUEST && request_.NeedVerify()) {
+            /* 先把前面的响应发出去, 由Reactor异步查询数据库 */
+            break;
+        }
+        else if(ret == HttpRequest::GET_REQUEST) {
+            LOG_DEBUG("%s", request_.path().c_str());
+            isKeepAlive_ = request_.IsKeepAlive();
+            response_.Init(srcDir, request_.path(), isKeepAlive_, request_.code());
+            response_.SetCachedFile(std::move(cached));
+            response_.SetSession(request_.NewSession());
+            if(request_.method() == "GET") {
+                response_.SetConditional(request_.GetHeader("If-None-Match"),
+                                         request_.GetHeader("If-Modified-Since"));
+                response_.SetRange(request_.GetHeader("Range"), request_.GetHeader("If-Range"));
+                response_.SetAcceptEncoding(request_.GetHeader("Accept-Encoding"));
+            }
+        } else {
+            isKeepAlive_ = false;
+            response_.Init(srcDir, request_.path(), false, 400);
+        }
+        cnt++;
+
+        response_.MakeResponse(writeBuff_);
+        /* 文件片段: 映射/缓存的内存, 或者用sendfile发送的文件描述符 */
+        const char* file = response_.File();
+        for(const HttpResponse::Slice& slice: response_.Slices()) {
+            assert(file || response_.FileFd() >= 0);
+            bodies_.push_back({sent_ + slice.pos, file ? file + slice.offset : nullptr, slice.len,
+                               response_.FileFd(), slice.offset, response_.FileRef()});
+            bodyBytes_ += slice.len;
+            if(!file) { SetCork_(true); }
+        }
+        request_.Init();
+        LOG_DEBUG("filesize:%d, %d to %d", (int)response_.FileLen(), cnt, (int)ToWriteBytes());
+        if(!isKeepAlive_) {
+            /* 短连接或错误请求, 之后的请求不再处理 */
+            break;
+        }
+    }
+    response_.UnmapFile();
+    if(ToWriteBytes() > 0) {
+        return true;
+    }
+    ReleaseIdle_();
+    return false;
+}
 
-    response_.MakeResponse(writeBuff_);
-    /* 响应头 */
-    iov_[0].iov_base = const_cast<char*>(writeBuff_.Peek());
-    iov_[0].iov_len = writeBuff_.ReadableBytes();
-    iovCnt_ = 1;
-
-    /* 文件 */
-    if(response_.FileLen() > 0  && response_.File()) {
-        iov_[1].iov_base = response_.File();
-        iov_[1].iov_len = response_.FileLen();
-        iovCnt_ = 2;
+// 没有要发送的响应, 也没有收到一半的请求: 等待下一个请求期间不占用缓冲区
+// 解析完还没处理的请求(等待验证或者留给线程池)引用着读缓冲区, 不能释放
+void HttpConn::ReleaseIdle_() {
+    if(!releaseIdle || request_.IsFinished() || !readBuff_.Release()) {
+        return;
     }
-    LOG_DEBUG("filesize:%d, %d  to %d", response_.FileLen() , iovCnt_, ToWriteBytes());
-    return true;
+    writeBuff_.Release();
+    request_.Release();
+    response_.Release();
 }
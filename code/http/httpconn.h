@@ -9,9 +9,15 @@
 
 #include <sys/types.h>
 #include <sys/uio.h>     // readv/writev
+#include <sys/sendfile.h> // sendfile
+#include <netinet/in.h>
+#include <netinet/tcp.h> // TCP_CORK
 #include <arpa/inet.h>   // sockaddr_in
 #include <stdlib.h>      // atoi()
 #include <errno.h>      
+#include <memory>
+#include <vector>
+#include <atomic>
 
 #include "../log/log.h"
 #include "../pool/sqlconnRAII.h"
@@ -35,35 +41,77 @@ public:
 
     int GetFd() const;
 
+    // 代数: 每次init和Close都加一, 事件、任务、定时器记下当时的代数, 不一致说明连接已经关闭或换了客户端
+    uint32_t Gen() const { return gen_.load(std::memory_order_acquire); }
+
     int GetPort() const;
 
     const char* GetIP() const;
     
     sockaddr_in GetAddr() const;
     
-    bool process();
-
-    int ToWriteBytes() { 
-        return iov_[0].iov_len + iov_[1].iov_len; 
+    // 处理读缓冲区中所有完整的请求, 响应依次追加到写队列; 有数据要发送时返回true
+    // 遇到需要查询数据库的登录/注册请求时停下(NeedVerify()为true),
+    // 查询结束后调用SetVerifyResult, 再次process会从这个请求继续
+    // cachedOnly为true时只处理命中静态文件缓存的GET请求, 遇到其他请求时停下,
+    // 这个请求保持解析完成的状态(HasPendingRequest()为true), 之后再调用process()处理
+    bool process(bool cachedOnly = false);
+
+    bool NeedVerify() const { return request_.NeedVerify(); }
+    bool HasPendingRequest() const { return request_.IsFinished(); }
+    const HttpRequest& request() const { return request_; }
+    void SetVerifyResult(HttpRequest::VERIFY_RESULT result) { request_.SetVerifyResult(result); }
+
+    size_t ToWriteBytes() const { 
+        return writeBuff_.ReadableBytes() + bodyBytes_; 
     }
 
     bool IsKeepAlive() const {
-        return request_.IsKeepAlive();
+        return isKeepAlive_;
     }
 
     static bool isET;
+    // 为true时连接空闲(响应发完且没有未读数据)后把缓冲区等内存还回去, 下次读到数据时再分配
+    static bool releaseIdle;
     static const char* srcDir;
     static std::atomic<int> userCount;
     
 private:
-   
+    // 响应体片段: 插在写缓冲区中第pos个字节(从本批响应开始计)之后发送
+    // data为空时用sendfile从文件描述符fd的offset处发送
+    struct BodySeg_ {
+        size_t pos;
+        const char* data;
+        size_t len;
+        int fd;
+        off_t offset;
+        std::shared_ptr<void> hold;
+    };
+
+    int FillIov_(struct iovec* iov, int maxCnt) const;
+    ssize_t SendFile_(int* saveErrno);
+    void Consume_(size_t len);
+    void ClearOutput_();
+    void ReleaseIdle_();
+    void SetCork_(bool on);
+
+    // 一次process最多生成的响应数, 其余请求留在读缓冲区等这批响应发完再处理
+    static const int MAX_PIPELINE = 64;
+    static const int MAX_IOV = 64;
+
     int fd_;
+    std::atomic<uint32_t> gen_;
     struct  sockaddr_in addr_;
 
     bool isClose_;
-    
-    int iovCnt_;
-    struct iovec iov_[2];
+    bool isKeepAlive_;
+    bool isCorked_;
+
+    // 写缓冲区里已经发出去的字节数, 用来换算BodySeg_::pos
+    size_t sent_;
+    size_t bodyBytes_;
+    size_t segHead_;
+    std::vector<BodySeg_> bodies_;
     
     Buffer readBuff_; // 读缓冲区
     Buffer writeBuff_; // 写缓冲区
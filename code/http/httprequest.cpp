@@ -4,10 +4,10 @@
  * @copyleft Apache 2.0
  */ 
 #include "httprequest.h"
+#include "../pool/userverify.h"
+#include "../pool/dbbreaker.h"
 using namespace std;
 
-// TODO：将HTTP和Mysql查询结合在一起耦合性太高了，几乎没有拓展性
-
 // 设置页面路径
 const unordered_set<string> HttpRequest::DEFAULT_HTML{
             "/login", "/register", "/index" ,"/error" ,"/JSON",
@@ -20,147 +20,262 @@ const unordered_map<string, int> HttpRequest::DEFAULT_HTML_TAG {
             {"/register.html", 0}, {"/login.html", 1},  };
 
 void HttpRequest::Init() {
-    method_ = path_ = version_ = body_ = "";
+    path_.clear();
+    method_ = version_ = body_ = string_view();
     state_ = REQUEST_LINE;
+    cursor_ = 0;
+    base_ = nullptr;
+    contentLen_ = 0;
+    verifyTag_ = -1;
+    code_ = 200;
+    session_.clear();
     header_.clear();
     post_.clear();
 }
 
+void HttpRequest::Release() {
+    Init();
+    std::string().swap(path_);
+    std::string().swap(session_);
+    decltype(header_)().swap(header_);
+    decltype(post_)().swap(post_);
+}
+
 // 判断HTTP是否为长连接
 bool HttpRequest::IsKeepAlive() const {
-    if(header_.count("Connection") == 1) {
-        // 当连接里含有keep-alive并且为1.1版本时，返回true
-        return header_.find("Connection")->second == "keep-alive" && version_ == "1.1";
+    string_view conn = GetHeader("Connection");
+    // 当连接里含有keep-alive并且为1.1版本时，返回true
+    return conn.size() == 10 && strncasecmp(conn.data(), "keep-alive", 10) == 0 && version_ == "1.1";
+}
+
+// 按名字查找请求头(大小写不敏感), 没有时返回空
+string_view HttpRequest::GetHeader(string_view key) const {
+    for(auto& item: header_) {
+        if(item.first.size() == key.size() &&
+           strncasecmp(item.first.data(), key.data(), key.size()) == 0) {
+            return item.second;
+        }
     }
-    // 没有连接直接返回flase
-    return false;
+    return string_view();
 }
-// 从缓冲区内解析HTTp请求报文
-bool HttpRequest::parse(Buffer& buff) {
-    const char CRLF[] = "\r\n";
-    // 判断是否有信息
-    if(buff.ReadableBytes() <= 0) {
-        return false;
+
+// Cookie: a=1; sid=xxx
+string_view HttpRequest::GetCookie(string_view name) const {
+    string_view cookie = GetHeader("Cookie");
+    while(!cookie.empty()) {
+        size_t semi = cookie.find(';');
+        string_view item = cookie.substr(0, semi);
+        cookie = semi == string_view::npos ? string_view() : cookie.substr(semi + 1);
+        while(!item.empty() && item.front() == ' ') { item.remove_prefix(1); }
+        if(item.size() > name.size() && item.substr(0, name.size()) == name && item[name.size()] == '=') {
+            return item.substr(name.size() + 1);
+        }
+    }
+    return string_view();
+}
+
+// 从缓冲区内解析HTTP请求报文
+// 先在缓冲区第一块的连续数据上解析, 请求跨块时才把需要的部分拼接到一起:
+// 请求体按Content-length一次拼够, 请求头每次多拼至少1KB
+HttpRequest::HTTP_CODE HttpRequest::parse(Buffer& buff) {
+    size_t len = buff.ContiguousBytes();
+    while(true) {
+        HTTP_CODE ret = Parse_(buff, len);
+        if(ret != NO_REQUEST || len == buff.ReadableBytes()) {
+            return ret;
+        }
+        size_t need = state_ == BODY ? cursor_ + contentLen_ : len + std::max<size_t>(len, 1024);
+        len = std::min(buff.ReadableBytes(), need);
+        buff.Pullup(len);
+    }
+}
+
+// 以行为单位推进状态机: memchr定位行尾, 每一行在原地切分, 解析完一个完整请求后才从缓冲区取走
+HttpRequest::HTTP_CODE HttpRequest::Parse_(Buffer& buff, size_t len) {
+    const char* begin = buff.Peek();
+    const char* end = begin + len;
+    if(cursor_ > 0 && begin != base_) {
+        // 上次解析到一半, 之后缓冲区扩容或整理过
+        Rebase_(begin);
     }
-    while(buff.ReadableBytes() && state_ != FINISH) {
-        // 这行代码通过搜索 buff 中的数据，查找HTTP请求头的结束位置，也就是找到第一个出现的 "\r\n\r\n"，并将其指针保存在 lineEnd 变量中。
-        // 当搜索到一个完整的HTTP换行符时，指针向后移动2个字符，以便于继续解析下一行。
-        const char* lineEnd = search(buff.Peek(), buff.BeginWriteConst(), CRLF, CRLF + 2);
-        // 读取HTTP请求头的信息
-        std::string line(buff.Peek(), lineEnd);
+    base_ = begin;
+    const char* pos = begin + cursor_;
+    while(state_ != FINISH) {
+        if(state_ == BODY) {
+            if(static_cast<size_t>(end - pos) < contentLen_) {
+                cursor_ = pos - begin;
+                return NO_REQUEST;
+            }
+            ParseBody_(pos, contentLen_);
+            pos += contentLen_;
+            break;
+        }
+        const char* lineEnd = static_cast<const char*>(memchr(pos, '\n', end - pos));
+        if(lineEnd == nullptr) {
+            // 一行还没收完
+            cursor_ = pos - begin;
+            if(static_cast<size_t>(end - begin) > MAX_HEADER_SIZE) {
+                LOG_ERROR("Request header too large");
+                return BAD_REQUEST;
+            }
+            return NO_REQUEST;
+        }
+        const char* next = lineEnd + 1;
+        // 兼容只有\n的换行
+        if(lineEnd > pos && *(lineEnd - 1) == '\r') { lineEnd--; }
         switch(state_)
         {
         //  解析HTTP请求行，包括请求方法、请求路径和HTTP版本
         case REQUEST_LINE:
-            if(!ParseRequestLine_(line)) {
-                return false;
+            // 请求行之前的空行直接忽略
+            if(lineEnd == pos) { break; }
+            if(!ParseRequestLine_(pos, lineEnd)) {
+                return BAD_REQUEST;
             }
             ParsePath_();
-            break;   
-        // 解析HTTP请求头部字段。 
+            break;
+        // 解析HTTP请求头部字段, 空行表示请求头结束
         case HEADERS:
-            ParseHeader_(line);
-            // 跳过两个换行符
-            if(buff.ReadableBytes() <= 2) {
-                state_ = FINISH;
+            if(!ParseHeader_(pos, lineEnd)) {
+                return BAD_REQUEST;
             }
             break;
-        // 这部分代码可能是处理POST请求的数据，根据具体情况进行解析。
-        case BODY:
-            ParseBody_(line);
-            break;
         default:
             break;
         }
-        if(lineEnd == buff.BeginWrite()) { break; }
-        // 清除两个换行符
-        buff.RetrieveUntil(lineEnd + 2);
+        pos = next;
+        if(state_ <= HEADERS && static_cast<size_t>(pos - begin) > MAX_HEADER_SIZE) {
+            LOG_ERROR("Request header too large");
+            return BAD_REQUEST;
+        }
+    }
+    // 整个请求(含请求体)从缓冲区中取走, 切片指向的内存在下次写入缓冲区前仍然有效
+    buff.Retrieve(pos - begin);
+    cursor_ = 0;
+    CheckSession_();
+    LOG_DEBUG("[%.*s], [%s], [%.*s]", (int)method_.size(), method_.data(), path_.c_str(),
+                                      (int)version_.size(), version_.data());
+    return GET_REQUEST;
+}
+// 把指向旧地址的切片平移到新地址, 未取走的数据在缓冲区中的相对位置是不变的
+void HttpRequest::Rebase_(const char* base) {
+    auto move = [this, base](string_view& v) {
+        if(v.data()) { v = string_view(base + (v.data() - base_), v.size()); }
+    };
+    move(method_);
+    move(version_);
+    for(auto& item: header_) {
+        move(item.first);
+        move(item.second);
     }
-    LOG_DEBUG("[%s], [%s], [%s]", method_.c_str(), path_.c_str(), version_.c_str());
-    return true;
 }
 // 解析请求路径
 void HttpRequest::ParsePath_() {
     // 请求为空时，默认返回index
     if(path_ == "/") {
-        path_ = "/index.html"; 
+        path_ = "/index.html";
     }
-    else {
-        //逐个去匹配路径
-        // TODO：是否应该加上未找到返回的404页面？ 
-        for(auto &item: DEFAULT_HTML) {
-            if(item == path_) {
-                path_ += ".html";
-                break;
-            }
-        }
+    // TODO：是否应该加上未找到返回的404页面？
+    else if(DEFAULT_HTML.count(path_) == 1) {
+        path_ += ".html";
+    }
+}
+
+void HttpRequest::CheckSession_() {
+    SessionStore* store = SessionStore::Instance();
+    if(!store->Enabled()) { return; }
+    bool isWelcome = path_ == "/welcome.html";
+    bool isLogin = path_ == "/login.html" && (verifyTag_ == 1 || method_ == "GET");
+    if(!isWelcome && !isLogin) { return; }
+    string user;
+    bool valid = store->Check(GetCookie("sid"), &user);
+    if(isWelcome) {
+        if(!valid) { path_ = "/login.html"; }
+        return;
+    }
+    // 以会话中的用户登录时不用再查数据库, 换了用户名的仍然要验证
+    if(valid && (verifyTag_ != 1 || GetPost("username") == user)) {
+        verifyTag_ = -1;
+        path_ = "/welcome.html";
     }
 }
-// GET /index.html HTTP/1.1
-// regex pattern("^([^ ]*) ([^ ]*) HTTP/([^ ]*)$");定义了一个正则表达式模式 pattern，用于匹配 HTTP 请求行的格式
-// ^：匹配行的起始位置。
-// ([^ ]*)：匹配一个或多个非空格字符，这里用括号捕获了匹配结果，分别代表请求方法、请求路径和协议版本。
-// （空格）：匹配一个空格字符，用于分隔不同部分。
-// HTTP/：匹配文本字符串 "HTTP/"。
-// ([^ ]*)：再次匹配一个或多个非空格字符，用于捕获协议版本。
-// $：匹配行的结束位置。
 // 解析HTTP请求行 请求方法 ，请求路径和协议版本
-bool HttpRequest::ParseRequestLine_(const string& line) {
-    regex patten("^([^ ]*) ([^ ]*) HTTP/([^ ]*)$");
-    // 用于存储正则表达式匹配的子串结果。C11
-    smatch subMatch;
-    // 尝试匹配输入的 line 字符串和正则表达式模式 pattern。如果匹配成功，就会将匹配结果存储在 subMatch 中。
-    if(regex_match(line, subMatch, patten)) {   
-        method_ = subMatch[1];
-        path_ = subMatch[2];
-        version_ = subMatch[3];
-        state_ = HEADERS;
-        return true;
+// GET /index.html HTTP/1.1
+// 方法与路径中都不能包含空格, 版本号必须以HTTP/开头
+bool HttpRequest::ParseRequestLine_(const char* begin, const char* end) {
+    const char* sp1 = static_cast<const char*>(memchr(begin, ' ', end - begin));
+    if(sp1 == nullptr || sp1 == begin) {
+        LOG_ERROR("RequestLine Error");
+        return false;
+    }
+    const char* target = sp1 + 1;
+    const char* sp2 = static_cast<const char*>(memchr(target, ' ', end - target));
+    if(sp2 == nullptr || sp2 == target) {
+        LOG_ERROR("RequestLine Error");
+        return false;
     }
-    LOG_ERROR("RequestLine Error");
-    return false;
+    const char* ver = sp2 + 1;
+    if(end - ver <= 5 || memcmp(ver, "HTTP/", 5) != 0 ||
+       memchr(ver, ' ', end - ver) != nullptr) {
+        LOG_ERROR("RequestLine Error");
+        return false;
+    }
+    method_ = string_view(begin, sp1 - begin);
+    path_.assign(target, sp2 - target);
+    version_ = string_view(ver + 5, end - ver - 5);
+    state_ = HEADERS;
+    return true;
 }
-// ^：匹配行的起始位置。
-// ([^:]*)：匹配零个或多个非冒号字符，用于捕获键名（即头部字段的名称）。
-// :：匹配一个冒号字符，用于分隔键名和键值。
-// ?：匹配零个或一个空格字符，允许键值之间有可选的空格。
-// (.*)：匹配零个或多个字符，用于捕获键值（即头部字段的值）。
-// $：匹配行的结束位置。
-// 解析HTTP请求头
-void HttpRequest::ParseHeader_(const string& line) {
-    regex patten("^([^:]*): ?(.*)$");
-    smatch subMatch;
-    if(regex_match(line, subMatch, patten)) {
-   
-    // Host: www.example.com
-    // User-Agent: Mozilla/5.0
-    // Accept-Language: en-US,en;q=0.5
-    // Content-Type: application/json
-
-    // "Host" 对应的值为 "www.example.com"
-    // 将匹配结果中第一个括号捕获的内容（即键名）作为键，将第二个括号捕获的内容（即键值）作为值，存储在 header_ 中。
-        header_[subMatch[1]] = subMatch[2];
+// 解析HTTP请求头  Host: www.example.com
+// 冒号之前是键名, 冒号之后去掉首尾空白是键值; 空行表示请求头结束
+bool HttpRequest::ParseHeader_(const char* begin, const char* end) {
+    if(begin == end) {
+        string_view len = GetHeader("Content-Length");
+        contentLen_ = 0;
+        for(char ch: len) {
+            if(ch < '0' || ch > '9') {
+                LOG_ERROR("Content-Length Error");
+                return false;
+            }
+            contentLen_ = contentLen_ * 10 + (ch - '0');
+            if(contentLen_ > MAX_BODY_SIZE) {
+                LOG_ERROR("Body too large");
+                return false;
+            }
+        }
+        state_ = contentLen_ > 0 ? BODY : FINISH;
+        return true;
     }
-    else {
-        state_ = BODY;
+    const char* colon = static_cast<const char*>(memchr(begin, ':', end - begin));
+    if(header_.capacity() == 0) { header_.reserve(16); }
+    if(colon == nullptr || colon == begin || header_.size() >= MAX_HEADER_NUM) {
+        LOG_ERROR("Header Error");
+        return false;
     }
+    const char* val = colon + 1;
+    while(val < end && (*val == ' ' || *val == '\t')) { val++; }
+    const char* valEnd = end;
+    while(valEnd > val && (*(valEnd - 1) == ' ' || *(valEnd - 1) == '\t')) { valEnd--; }
+    header_.emplace_back(string_view(begin, colon - begin), string_view(val, valEnd - val));
+    return true;
 }
 // 解析请求体（POST请求数据）
-void HttpRequest::ParseBody_(const string& line) {
-    body_ = line;
+void HttpRequest::ParseBody_(const char* begin, size_t len) {
+    body_ = string_view(begin, len);
     ParsePost_();
     state_ = FINISH;
-    LOG_DEBUG("Body:%s, len:%d", line.c_str(), line.size());
+    LOG_DEBUG("Body:%.*s, len:%d", (int)len, begin, (int)len);
 }
 // 将十六进制转化为整数
 int HttpRequest::ConverHex(char ch) {
     if(ch >= 'A' && ch <= 'F') return ch -'A' + 10;
     if(ch >= 'a' && ch <= 'f') return ch -'a' + 10;
-    return ch;
+    if(ch >= '0' && ch <= '9') return ch -'0';
+    return -1;
 }
 // 解析POST请求表单数据
 void HttpRequest::ParsePost_() {
-    if(method_ == "POST" && header_["Content-Type"] == "application/x-www-form-urlencoded") {
+    if(method_ == "POST" && GetHeader("Content-Type") == "application/x-www-form-urlencoded") {
         // 解析Post请求
         ParseFromUrlencoded_();
         // 查找是否存在路径
@@ -170,141 +285,105 @@ void HttpRequest::ParsePost_() {
             LOG_DEBUG("Tag:%d", tag);
             // 路径是注册页面（tag为0）或登录页面（tag为1）
             if(tag == 0 || tag == 1) {
-                bool isLogin = (tag == 1);
-                if(UserVerify(post_["username"], post_["password"], isLogin)) {
-                    path_ = "/welcome.html";
-                } 
-                else {
-                    path_ = "/error.html";
-                }
+                // 不在解析时查询数据库, 留给调用者异步处理
+                verifyTag_ = tag;
             }
         }
-    }   
+    }
 }
 
+// 示例name=John+Doe&age=30&city=New+York
+// 键: "name", 值: "John Doe"
+// +还原为空格, %XX还原为对应字节, 请求体本身(读缓冲区)不被改写
 void HttpRequest::ParseFromUrlencoded_() {
     if(body_.size() == 0) { return; }
 
-    // key（用于存储表单字段名）、value（用于存储表单字段值）、num（用于存储解析的十六进制数值）、n（请求体长度）、i 和 j（循环变量）。
     string key, value;
-    int num = 0;
-    int n = body_.size();
-    int i = 0, j = 0;
-
-    // 示例name=John+Doe&age=30&city=New+York
-    // 键: "name", 值: "John Doe"
-    // 键: "age", 值: "30"
-    // 键: "city", 值: "New York"
-
-    // 原始文本：你好
-    // 编码后：%E4%BD%A0%E5%A5%BD
-    for(; i < n; i++) {
-        char ch = body_[i];
+    string* cur = &key;
+    size_t n = body_.size();
+    for(size_t i = 0; i <= n; i++) {
+        char ch = i < n ? body_[i] : '&';
         switch (ch) {
         case '=':
-            // 从 j 到 i-1 的部分就是字段名
-            key = body_.substr(j, i - j);
-            j = i + 1;
+            if(cur == &key) { cur = &value; }
+            else { cur->push_back(ch); }
             break;
         case '+':
-            // +替换为空格，以正确还原 URL 编码的空格字符
-            body_[i] = ' ';
+            cur->push_back(' ');
             break;
         case '%':
-            // 它会解析出十六进制数值，并将 % 后面的两个字符转换成一个字符，然后更新 i 为 i+2
-            num = ConverHex(body_[i + 1]) * 16 + ConverHex(body_[i + 2]);
-            // 可以将数字值转换为对应的ASCII字符
-            body_[i + 2] = num % 10 + '0';
-            body_[i + 1] = num / 10 + '0';
-            i += 2;
+            if(i + 2 < n && ConverHex(body_[i + 1]) >= 0 && ConverHex(body_[i + 2]) >= 0) {
+                cur->push_back(static_cast<char>(ConverHex(body_[i + 1]) * 16 + ConverHex(body_[i + 2])));
+                i += 2;
+            } else {
+                cur->push_back(ch);
+            }
             break;
         case '&':
-            // 它会解析出字段值（value），从 j 到 i-1 的部分就是字段值。然后，它将字段名和字段值存储在 post_ 中，并打印调试信息
-            value = body_.substr(j, i - j);
-            j = i + 1;
-            post_[key] = value;
-            LOG_DEBUG("%s = %s", key.c_str(), value.c_str());
+            if(!key.empty()) {
+                LOG_DEBUG("%s = %s", key.c_str(), value.c_str());
+                post_[key] = value;
+            }
+            key.clear();
+            value.clear();
+            cur = &key;
             break;
         default:
+            cur->push_back(ch);
             break;
         }
     }
-    assert(j <= i);
-    // 当遇到 & 符号时，表示一个字段的解析结束，字段名和字段值被存储在 post_ 中。
-    // 但是，如果请求体的最后一个字段后面没有 & 符号，那么最后一个字段的值就不会被存储，因为循环结束了。
-    // 确保即使最后一个字段后没有 & 符号，最后一个字段的值仍然能够被正确解析和存储在 post_ 中。
-    if(post_.count(key) == 0 && j < i) {
-        value = body_.substr(j, i - j);
-        post_[key] = value;
+}
+void HttpRequest::SetVerifyResult(VERIFY_RESULT result) {
+    if(result == VERIFY_OK) {
+        /* 登录或注册成功, 之后的请求凭会话确认身份 */
+        session_ = SessionStore::Instance()->Create(GetPost("username"));
+    }
+    verifyTag_ = -1;
+    if(result == VERIFY_UNAVAILABLE) {
+        /* 数据库的问题不是用户名密码的问题, 让客户端稍后重试 */
+        code_ = 503;
+        return;
     }
+    path_ = result == VERIFY_OK ? "/welcome.html" : "/error.html";
 }
-// 用于验证用户信息，并且确认mysql的查询
-bool HttpRequest::UserVerify(const string &name, const string &pwd, bool isLogin) {
-    if(name == "" || pwd == "") { return false; }
-    LOG_INFO("Verify name:%s pwd:%s", name.c_str(), pwd.c_str());
-    MYSQL* sql;
-    SqlConnRAII(&sql,  SqlConnPool::Instance());
-    // 不为空
-    assert(sql);
-    
-    bool flag = false;
-    // 用于记录字段数量
-    unsigned int j = 0;
-    char order[256] = { 0 };
-    // 存储查询结果的字段信息
-    MYSQL_FIELD *fields = nullptr;
-    // 存储查询结果
-    MYSQL_RES *res = nullptr;
-    
-    // 如果不是登录操作（即注册操作），则将 flag 设置为 true，表示注册行为（因为不是登录，所以默认为注册）
-    if(!isLogin) { flag = true; }
-    /* 查询用户及密码 */
-    snprintf(order, 256, "SELECT username, password FROM user WHERE username='%s' LIMIT 1", name.c_str());
-    LOG_DEBUG("%s", order);
 
-    // 使用 MySQL API 执行 SQL 查询，如果查询失败，则释放结果集资源并返回 false
-    if(mysql_query(sql, order)) { 
-        mysql_free_result(res);
-        return false; 
-    }
-    res = mysql_store_result(sql);
-    j = mysql_num_fields(res);
-    fields = mysql_fetch_fields(res);
+HttpRequest::VERIFY_RESULT HttpRequest::VerifyResult(bool ok, bool dbError) {
+    if(dbError) { return VERIFY_UNAVAILABLE; }
+    return ok ? VERIFY_OK : VERIFY_FAILED;
+}
 
-    // 遍历查询结果集中的每一行，获取用户名和密码字段的值。
-    while(MYSQL_ROW row = mysql_fetch_row(res)) {
-        LOG_DEBUG("MYSQL ROW: %s %s", row[0], row[1]);
-        string password(row[1]);
-        /* 注册行为 且 用户名未被使用*/
-        if(isLogin) {
-            if(pwd == password) { flag = true; }
-            else {
-                flag = false;
-                LOG_DEBUG("pwd error!");
-            }
-        } 
-        else { 
-            flag = false; 
-            LOG_DEBUG("user used!");
+// 用于验证用户信息，通过UserStore查询和添加用户
+// 先查用户缓存, 同一个用户名正在被别的线程查询时阻塞等它的结果
+HttpRequest::VERIFY_RESULT HttpRequest::UserVerify(const string &name, const string &pwd, bool isLogin) {
+    UserVerifyTask task(name, pwd, isLogin);
+    while(true) {
+        promise<const UserRecord*> done;
+        UserRecord rec;
+        auto cb = [&done, &rec](const UserRecord* result) {
+            if(result) { rec = *result; }
+            done.set_value(result ? &rec : nullptr);
+        };
+        if(task.Lookup(cb) != UserCache::WAIT || task.Resume(done.get_future().get())) {
+            break;
         }
     }
-    mysql_free_result(res);
-
-    /* 注册行为 且 用户名未被使用*/
-    if(!isLogin && flag == true) {
-        LOG_DEBUG("regirster!");
-        bzero(order, 256);
-        snprintf(order, 256,"INSERT INTO user(username, password) VALUES('%s','%s')", name.c_str(), pwd.c_str());
-        LOG_DEBUG( "%s", order);
-        if(mysql_query(sql, order)) { 
-            LOG_DEBUG( "Insert error!");
-            flag = false; 
+    if(task.NeedQuery()) {
+        /* 熔断时不去等连接和查询, 立即失败 */
+        DbBreaker::ADMIT admit = DbBreaker::Instance()->Admit();
+        if(admit == DbBreaker::DENY) {
+            task.Reject();
+        } else {
+            auto start = chrono::steady_clock::now();
+            task.Run(UserStore::Instance());
+            auto cost = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start);
+            DbBreaker::Instance()->Record(admit, !task.DbError(), cost.count());
         }
-        flag = true;
     }
-    SqlConnPool::Instance()->FreeConn(sql);
-    LOG_DEBUG( "UserVerify success!!");
-    return flag;
+    task.Publish();
+    VERIFY_RESULT result = VerifyResult(task.Result(), task.DbError());
+    LOG_DEBUG("UserVerify %s", result == VERIFY_OK ? "success!!" : "failed!");
+    return result;
 }
 
 std::string HttpRequest::path() const{
@@ -314,11 +393,11 @@ std::string HttpRequest::path() const{
 std::string& HttpRequest::path(){
     return path_;
 }
-std::string HttpRequest::method() const {
+std::string_view HttpRequest::method() const {
     return method_;
 }
 
-std::string HttpRequest::version() const {
+std::string_view HttpRequest::version() const {
     return version_;
 }
 
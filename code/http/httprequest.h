@@ -2,29 +2,39 @@
  * @Author       : mark
  * @Date         : 2020-06-25
  * @copyleft Apache 2.0
- */ 
+ */
 #ifndef HTTP_REQUEST_H
 #define HTTP_REQUEST_H
 
 #include <unordered_map>
 #include <unordered_set>
+#include <vector>
+#include <algorithm>
 #include <string>
-#include <regex>
-#include <errno.h>     
-#include <mysql/mysql.h>  //mysql
+#include <string_view>
+#include <future>
+#include <errno.h>
+#include <strings.h>      // strncasecmp
 
 #include "../buffer/buffer.h"
 #include "../log/log.h"
-#include "../pool/sqlconnpool.h"
-#include "../pool/sqlconnRAII.h"
+#include "../pool/userstore.h"
+#include "sessionstore.h"
 
+/*
+ * 手写状态机解析HTTP/1.1请求, 直接在Buffer的字节上工作
+ * method/version/请求头/请求体都是指向读缓冲区的string_view切片, 不做拷贝;
+ * 这些切片在解析完成后、读缓冲区下一次写入之前有效
+ * 请求没收完整时不从缓冲区取走任何数据, 所以缓冲区搬移数据后切片之间的相对位置不变
+ * path_需要被改写(补全.html, 登录跳转), 所以单独保存一份
+ */
 class HttpRequest {
 public:
     enum PARSE_STATE {
         REQUEST_LINE,
         HEADERS,
         BODY,
-        FINISH,        
+        FINISH,
     };
 
     enum HTTP_CODE {
@@ -37,42 +47,89 @@ public:
         INTERNAL_ERROR,
         CLOSED_CONNECTION,
     };
-    
+
+    // 登录/注册的验证结果, UNAVAILABLE表示数据库不可用(出错或者被熔断), 应答503
+    enum VERIFY_RESULT {
+        VERIFY_FAILED = 0,
+        VERIFY_OK,
+        VERIFY_UNAVAILABLE,
+    };
+
     HttpRequest() { Init(); }
     ~HttpRequest() = default;
 
     void Init();
-    bool parse(Buffer& buff);
+    // 连接空闲时释放请求头数组、表单等占用的内存
+    void Release();
+    // NO_REQUEST: 数据不完整, 需要继续读; GET_REQUEST: 解析出一个完整请求; BAD_REQUEST: 报文错误
+    // 返回NO_REQUEST时解析状态会被保留, 下次读到更多数据后从上次的位置继续
+    HTTP_CODE parse(Buffer& buff);
 
     std::string path() const;
     std::string& path();
-    std::string method() const;
-    std::string version() const;
+    std::string_view method() const;
+    std::string_view version() const;
+    std::string_view GetHeader(std::string_view key) const;
+    // Cookie请求头中名为name的值, 没有时返回空
+    std::string_view GetCookie(std::string_view name) const;
     std::string GetPost(const std::string& key) const;
     std::string GetPost(const char* key) const;
 
     bool IsKeepAlive() const;
 
-    /* 
-    todo 
+    // 解析完成的登录/注册请求需要先查询数据库, 由调用者执行查询后用SetVerifyResult给出结果
+    bool NeedVerify() const { return verifyTag_ >= 0; }
+    bool IsLogin() const { return verifyTag_ == 1; }
+    bool IsFinished() const { return state_ == FINISH; }
+    void SetVerifyResult(VERIFY_RESULT result);
+    // 这个请求验证成功后新建的会话ID, 响应中用Set-Cookie发给客户端
+    const std::string& NewSession() const { return session_; }
+    // 应答的状态码, 数据库不可用时为503
+    int code() const { return code_; }
+
+    // 阻塞地验证用户(查用户缓存或UserStore)
+    static VERIFY_RESULT UserVerify(const std::string& name, const std::string& pwd, bool isLogin);
+    static VERIFY_RESULT VerifyResult(bool ok, bool dbError);
+
+    /*
+    todo
     void HttpConn::ParseFormData() {}
     void HttpConn::ParseJson() {}
     */
 
 private:
-    bool ParseRequestLine_(const std::string& line);
-    void ParseHeader_(const std::string& line);
-    void ParseBody_(const std::string& line);
+    // 在缓冲区开头连续的len个字节上解析
+    HTTP_CODE Parse_(Buffer& buff, size_t len);
+    bool ParseRequestLine_(const char* begin, const char* end);
+    bool ParseHeader_(const char* begin, const char* end);
+    void ParseBody_(const char* begin, size_t len);
+
+    void Rebase_(const char* base);
 
     void ParsePath_();
+    // 启用会话时: 带着有效会话的登录请求不再验证, 直接进入欢迎页; 没有有效会话访问欢迎页时改为登录页
+    void CheckSession_();
     void ParsePost_();
     void ParseFromUrlencoded_();
 
-    static bool UserVerify(const std::string& name, const std::string& pwd, bool isLogin);
+    // 请求行+请求头的最大长度, 超过仍未结束视为错误请求
+    static const size_t MAX_HEADER_SIZE = 8192;
+    static const size_t MAX_HEADER_NUM = 64;
+    static const size_t MAX_BODY_SIZE = 1 << 20;
 
     PARSE_STATE state_;
-    std::string method_, path_, version_, body_;
-    std::unordered_map<std::string, std::string> header_;
+    // 已扫描到的位置(相对于buff.Peek()的偏移)
+    size_t cursor_;
+    // 上次解析时buff.Peek()的地址, 缓冲区拼接(Pullup)后用来平移已有的切片
+    const char* base_;
+    size_t contentLen_;
+    // 待验证的表单: -1 无, 0 注册, 1 登录
+    int verifyTag_;
+    int code_;
+    std::string session_;
+    std::string path_;
+    std::string_view method_, version_, body_;
+    std::vector<std::pair<std::string_view, std::string_view>> header_;
     std::unordered_map<std::string, std::string> post_;
 
     static const std::unordered_set<std::string> DEFAULT_HTML;
@@ -81,4 +138,4 @@ private:
 };
 
 
-#endif //HTTP_REQUEST_H
\ No newline at end of file
+#endif //HTTP_REQUEST_H
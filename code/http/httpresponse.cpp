@@ -4,10 +4,12 @@
  * @copyleft Apache 2.0
  */ 
 #include "httpresponse.h"
+#include "sessionstore.h"
+#include "../pool/dbbreaker.h"
 
 using namespace std;
 
-const unordered_map<string, string> HttpResponse::SUFFIX_TYPE = {
+const unordered_map<string_view, string_view> HttpResponse::SUFFIX_TYPE = {
     { ".html",  "text/html" },
     { ".xml",   "text/xml" },
     { ".xhtml", "application/xhtml+xml" },
@@ -25,28 +27,52 @@ const unordered_map<string, string> HttpResponse::SUFFIX_TYPE = {
     { ".avi",   "video/x-msvideo" },
     { ".gz",    "application/x-gzip" },
     { ".tar",   "application/x-tar" },
-    { ".css",   "text/css "},
-    { ".js",    "text/javascript "},
+    { ".css",   "text/css" },
+    { ".js",    "text/javascript" },
 };
 
+bool HttpResponse::useSendfile = false;
+bool HttpResponse::useGzip = false;
+
 const unordered_map<int, string> HttpResponse::CODE_STATUS = {
     { 200, "OK" },
+    { 206, "Partial Content" },
+    { 304, "Not Modified" },
     { 400, "Bad Request" },
     { 403, "Forbidden" },
     { 404, "Not Found" },
+    { 416, "Range Not Satisfiable" },
+    { 503, "Service Unavailable" },
 };
 
 const unordered_map<int, string> HttpResponse::CODE_PATH = {
     { 400, "/400.html" },
     { 403, "/400.html" },
     { 404, "/400.html" },
+    { 503, "/503.html" },
 };
 
+// 非负整数转成十进制追加到缓冲区
+static void AppendUInt(Buffer& buff, size_t n) {
+    char digits[24];
+    char* p = digits + sizeof(digits);
+    do {
+        *--p = '0' + n % 10;
+        n /= 10;
+    } while(n > 0);
+    buff.Append(p, digits + sizeof(digits) - p);
+}
+
+static void AppendView(Buffer& buff, string_view str) {
+    buff.Append(str.data(), str.size());
+}
+
 HttpResponse::HttpResponse() {
     code_ = -1;
+    boundary_[0] = '\0';
     path_ = srcDir_ = "";
     isKeepAlive_ = false;
-    mmFile_ = nullptr; 
+    gzip_ = false;
     mmFileStat_ = { 0 };
 };
 
@@ -55,20 +81,55 @@ HttpResponse::~HttpResponse() {
     UnmapFile();
 }
 
-void HttpResponse::Init(const string& srcDir, string& path, bool isKeepAlive, int code){
-    assert(srcDir != "");
-    if(mmFile_) { UnmapFile(); }
+void HttpResponse::Init(string_view srcDir, string& path, bool isKeepAlive, int code){
+    assert(!srcDir.empty());
+    UnmapFile();
     code_ = code;
     isKeepAlive_ = isKeepAlive;
     path_ = path;
     srcDir_ = srcDir;
-    mmFile_ = nullptr; 
     mmFileStat_ = { 0 };
+    ifNoneMatch_ = ifModifiedSince_ = etag_ = lastModified_ = string_view();
+    range_ = ifRange_ = acceptEncoding_ = session_ = string_view();
+    gzip_ = false;
+    ranges_.clear();
+    slices_.clear();
+}
+
+void HttpResponse::SetConditional(string_view ifNoneMatch, string_view ifModifiedSince) {
+    ifNoneMatch_ = ifNoneMatch;
+    ifModifiedSince_ = ifModifiedSince;
+}
+
+void HttpResponse::SetRange(string_view range, string_view ifRange) {
+    range_ = range;
+    ifRange_ = ifRange;
+}
+void HttpResponse::Release() {
+    UnmapFile();
+    std::string().swap(path_);
+    std::string().swap(srcDir_);
+    std::vector<std::pair<off_t, off_t>>().swap(ranges_);
+    std::vector<Slice>().swap(slices_);
 }
 // 根据HTTP状态码生成HTTP响应，包括状态行、头部和内容。
 void HttpResponse::MakeResponse(Buffer& buff) {
+    if(code_ >= 400) {
+        /* 错误应答换成错误页面, 不发请求的文件 */
+        file_.reset();
+    }
+    /* 优先查静态文件缓存, 缓存里只有可读的普通文件 */
+    else if(!file_) {
+        /* 要压缩的文本文件即使在sendfile模式下也放进缓存 */
+        size_t maxFileSize = useGzip && Compressible_(path_) ? GZIP_MAX_SIZE : 0;
+        file_ = FileCache::Instance()->Get(path_, maxFileSize);
+    }
+    if(file_) {
+        mmFileStat_ = file_->st;
+        if(code_ == -1) { code_ = 200; }
+    }
     /* 判断请求的资源文件 */
-    if(stat((srcDir_ + path_).data(), &mmFileStat_) < 0 || S_ISDIR(mmFileStat_.st_mode)) {
+    else if(stat((srcDir_ + path_).data(), &mmFileStat_) < 0 || S_ISDIR(mmFileStat_.st_mode)) {
         code_ = 404;
     }
     else if(!(mmFileStat_.st_mode & S_IROTH)) {
@@ -78,17 +139,118 @@ void HttpResponse::MakeResponse(Buffer& buff) {
         code_ = 200; 
     }
     ErrorHtml_();
+    if(code_ == 200) {
+        /* 范围请求总是按原文件计算, 不发送压缩版本 */
+        gzip_ = HasVariants_() && range_.empty() && AcceptGzip_();
+        Validators_();
+        if(NotModified_()) {
+            /* 客户端缓存的副本仍然有效, 不发送文件 */
+            code_ = 304;
+            AddNotModified_(buff);
+            return;
+        }
+        if(!range_.empty() && ParseRange_()) {
+            if(ranges_.empty()) {
+                code_ = 416;
+                AddRangeNotSatisfiable_(buff);
+                return;
+            }
+            code_ = 206;
+        }
+    }
+    if(file_ && code_ == 200 && !file_->header[gzip_][isKeepAlive_].empty()) {
+        /* 缓存的文件直接拷贝预先生成的响应头, 只补上Date */
+        buff.Append(file_->header[gzip_][isKeepAlive_]);
+        if(!session_.empty()) { AppendSetCookie_(buff, session_); }
+        AppendDate_(buff);
+        buff.Append("\r\n", 2);
+        AddSlice_(buff, 0, gzip_ ? file_->gzip.size() : mmFileStat_.st_size);
+        return;
+    }
+    assert(!gzip_);
     AddStateLine_(buff);
     AddHeader_(buff);
     AddContent_(buff);
 }
+
+void HttpResponse::PrepareFile(CachedFile& file) {
+    if(useGzip && Compressible_(file.path)) {
+        Gzip_(file);
+    }
+    char buf[64];
+    size_t len = FormatETag_(file.st, buf, sizeof(buf));
+    file.etag[0].assign(buf, len);
+    /* 不同的内容要用不同的ETag, gzip版本在引号内加上后缀 */
+    file.etag[1].assign(buf, len - 1).append("-gz\"");
+    file.lastModified.assign(buf, FormatHttpDate_(file.st.st_mtime, buf, sizeof(buf)));
+    for(int gzip = 0; gzip < (file.gzip.empty() ? 1 : 2); gzip++) {
+        for(int keepAlive = 0; keepAlive < 2; keepAlive++) {
+            Buffer buff;
+            AppendStateLine_(buff, 200, CODE_STATUS.find(200)->second);
+            AppendConnection_(buff, keepAlive);
+            AppendContentType_(buff, file.path);
+            if(gzip) {
+                AppendView(buff, "Content-Encoding: gzip\r\n");
+            }
+            if(!file.gzip.empty()) {
+                AppendView(buff, "Vary: Accept-Encoding\r\n");
+            }
+            AppendValidators_(buff, file.etag[gzip], file.lastModified);
+            AppendView(buff, "Accept-Ranges: bytes\r\n");
+            AppendContentLength_(buff, gzip ? file.gzip.size() : file.st.st_size);
+            file.header[gzip][keepAlive] = buff.RetrieveAllToStr();
+        }
+    }
+}
+
+// 文本类型的文件才压缩, 图片、字体等本身已经压缩过
+bool HttpResponse::Compressible_(string_view path) {
+    string_view type = GetFileType_(path);
+    return type.substr(0, 5) == "text/" || type.find("xml") != string_view::npos;
+}
+
+// 一次性压缩整个文件, 只在装入缓存时做一次, 所以用最高压缩级别; 省不到十分之一时不保留
+void HttpResponse::Gzip_(CachedFile& file) {
+    size_t size = file.st.st_size;
+    if(size < GZIP_MIN_SIZE) { return; }
+    z_stream zs = {};
+    /* windowBits加16生成gzip格式 */
+    if(deflateInit2(&zs, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return;
+    }
+    string out(deflateBound(&zs, size), '\0');
+    zs.next_in = reinterpret_cast<Bytef*>(file.data.get());
+    zs.avail_in = size;
+    zs.next_out = reinterpret_cast<Bytef*>(&out[0]);
+    zs.avail_out = out.size();
+    int ret = deflate(&zs, Z_FINISH);
+    deflateEnd(&zs);
+    if(ret != Z_STREAM_END || zs.total_out > size - size / 10) {
+        return;
+    }
+    out.resize(zs.total_out);
+    out.shrink_to_fit();
+    file.gzip = std::move(out);
+}
 // 获取映射到内存中的文件的指针
 char* HttpResponse::File() {
+    if(file_) { return const_cast<char*>(gzip_ ? file_->gzip.data() : file_->data.get()); }
+    return mmFile_.get();
+}
+
+int HttpResponse::FileFd() const {
+    return fileFd_ ? *fileFd_ : -1;
+}
+
+std::shared_ptr<void> HttpResponse::FileRef() const {
+    if(file_) { return std::const_pointer_cast<CachedFile>(file_); }
+    if(fileFd_) { return fileFd_; }
     return mmFile_;
 }
-// 获取文件数据的长度
+// 获取文件数据的长度, 304没有响应体
 size_t HttpResponse::FileLen() const {
-    return mmFileStat_.st_size;
+    if(code_ == 304) { return 0; }
+    return gzip_ ? file_->gzip.size() : mmFileStat_.st_size;
 }
 // 如果HTTP状态码对应的错误页面存在，则设置path_为错误页面的路径，并获取错误页面的文件信息
 void HttpResponse::ErrorHtml_() {
@@ -99,64 +261,366 @@ void HttpResponse::ErrorHtml_() {
 }
 // 添加HTTP响应的状态行，包括HTTP版本、状态码和状态描述。
 void HttpResponse::AddStateLine_(Buffer& buff) {
-    string status;
-    if(CODE_STATUS.count(code_) == 1) {
-        status = CODE_STATUS.find(code_)->second;
-    }
-    else {
+    auto it = CODE_STATUS.find(code_);
+    if(it == CODE_STATUS.end()) {
         code_ = 400;
-        status = CODE_STATUS.find(400)->second;
+        it = CODE_STATUS.find(400);
     }
-    buff.Append("HTTP/1.1 " + to_string(code_) + " " + status + "\r\n");
+    AppendStateLine_(buff, code_, it->second);
 }
-//  添加HTTP响应的头部信息，包括Connection字段和Content-Type字段。
+//  添加HTTP响应的头部信息，包括Connection字段、Content-Type字段和Date字段。
 void HttpResponse::AddHeader_(Buffer& buff) {
-    buff.Append("Connection: ");
-    if(isKeepAlive_) {
-        buff.Append("keep-alive\r\n");
-        buff.Append("keep-alive: max=6, timeout=120\r\n");
-    } else{
-        buff.Append("close\r\n");
+    AppendConnection_(buff, isKeepAlive_);
+    if(code_ == 206 && ranges_.size() > 1) {
+        AppendView(buff, "Content-type: multipart/byteranges; boundary=");
+        AppendView(buff, boundary_);
+        AppendView(buff, "\r\n");
+    } else {
+        AppendContentType_(buff, path_);
     }
-    buff.Append("Content-type: " + GetFileType_() + "\r\n");
+    if(HasVariants_()) {
+        AppendView(buff, "Vary: Accept-Encoding\r\n");
+    }
+    if(code_ == 200 || code_ == 206) {
+        AppendValidators_(buff, etag_, lastModified_);
+        AppendView(buff, "Accept-Ranges: bytes\r\n");
+    }
+    if(code_ == 503) {
+        /* 数据库不可用, 建议客户端等熔断器冷却结束再试 */
+        AppendView(buff, "Retry-After: ");
+        AppendUInt(buff, DbBreaker::OPEN_MS / 1000);
+        AppendView(buff, "\r\n");
+    }
+    if(!session_.empty()) {
+        AppendSetCookie_(buff, session_);
+    }
+    AppendDate_(buff);
+}
+
+void HttpResponse::Validators_() {
+    if(file_ && !file_->etag[gzip_].empty()) {
+        etag_ = file_->etag[gzip_];
+        lastModified_ = file_->lastModified;
+        return;
+    }
+    etag_ = string_view(etagBuf_, FormatETag_(mmFileStat_, etagBuf_, sizeof(etagBuf_)));
+    lastModified_ = string_view(lastModifiedBuf_,
+                                FormatHttpDate_(mmFileStat_.st_mtime, lastModifiedBuf_, sizeof(lastModifiedBuf_)));
+}
+
+// If-None-Match优先, 有它时忽略If-Modified-Since; ETag用弱比较, 忽略W/前缀
+bool HttpResponse::NotModified_() const {
+    if(!ifNoneMatch_.empty()) {
+        string_view list = ifNoneMatch_;
+        while(!list.empty()) {
+            size_t comma = list.find(',');
+            string_view tag = list.substr(0, comma);
+            list = comma == string_view::npos ? string_view() : list.substr(comma + 1);
+            while(!tag.empty() && tag.front() == ' ') { tag.remove_prefix(1); }
+            while(!tag.empty() && tag.back() == ' ') { tag.remove_suffix(1); }
+            if(tag == "*") { return true; }
+            if(tag.substr(0, 2) == "W/") { tag.remove_prefix(2); }
+            if(tag == etag_) { return true; }
+        }
+        return false;
+    }
+    if(!ifModifiedSince_.empty()) {
+        char date[64];
+        if(ifModifiedSince_.size() >= sizeof(date)) { return false; }
+        memcpy(date, ifModifiedSince_.data(), ifModifiedSince_.size());
+        date[ifModifiedSince_.size()] = '\0';
+        struct tm tm = {};
+        const char* end = strptime(date, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+        if(end == nullptr || *end != '\0') { return false; }
+        return mmFileStat_.st_mtime <= timegm(&tm);
+    }
+    return false;
+}
+
+// 304只有状态行、连接和校验器, 没有响应体
+void HttpResponse::AddNotModified_(Buffer& buff) {
+    AppendStateLine_(buff, 304, CODE_STATUS.find(304)->second);
+    AppendConnection_(buff, isKeepAlive_);
+    if(HasVariants_()) {
+        AppendView(buff, "Vary: Accept-Encoding\r\n");
+    }
+    AppendValidators_(buff, etag_, lastModified_);
+    AppendDate_(buff);
+    buff.Append("\r\n", 2);
+}
+
+// q=0表示不接受; 没有明确提到gzip时看"*"
+bool HttpResponse::AcceptGzip_() const {
+    bool accept = false;
+    string_view list = acceptEncoding_;
+    while(!list.empty()) {
+        size_t comma = list.find(',');
+        string_view item = list.substr(0, comma);
+        list = comma == string_view::npos ? string_view() : list.substr(comma + 1);
+        size_t semi = item.find(';');
+        string_view coding = item.substr(0, semi);
+        while(!coding.empty() && coding.front() == ' ') { coding.remove_prefix(1); }
+        while(!coding.empty() && coding.back() == ' ') { coding.remove_suffix(1); }
+        bool refused = false;
+        if(semi != string_view::npos) {
+            string_view q = item.substr(semi + 1);
+            while(!q.empty() && q.front() == ' ') { q.remove_prefix(1); }
+            if(q.substr(0, 2) == "q=" || q.substr(0, 2) == "Q=") {
+                q.remove_prefix(2);
+                refused = q.find_first_not_of("0. ") == string_view::npos;
+            }
+        }
+        auto is = [coding](string_view name) {
+            return coding.size() == name.size() && strncasecmp(coding.data(), name.data(), name.size()) == 0;
+        };
+        if(is("gzip") || is("x-gzip")) { return !refused; }
+        if(coding == "*") { accept = !refused; }
+    }
+    return accept;
+}
+
+// 只支持bytes单位; 超出文件的范围不可满足, 结尾超出时截到文件末尾, "-n"表示最后n个字节
+bool HttpResponse::ParseRange_() {
+    if(!ifRange_.empty() && ifRange_ != etag_ && ifRange_ != lastModified_) {
+        /* 客户端手里的部分内容已经过期, 要重新下载整个文件 */
+        return false;
+    }
+    if(range_.substr(0, 6) != "bytes=") { return false; }
+    string_view list = range_.substr(6);
+    const off_t size = mmFileStat_.st_size;
+    bool hasSpec = false;
+    ranges_.clear();
+    while(!list.empty()) {
+        size_t comma = list.find(',');
+        string_view spec = list.substr(0, comma);
+        list = comma == string_view::npos ? string_view() : list.substr(comma + 1);
+        while(!spec.empty() && spec.front() == ' ') { spec.remove_prefix(1); }
+        while(!spec.empty() && spec.back() == ' ') { spec.remove_suffix(1); }
+        if(spec.empty()) { continue; }
+        size_t dash = spec.find('-');
+        if(dash == string_view::npos) { return false; }
+        hasSpec = true;
+        off_t first, last;
+        if(dash == 0) {
+            off_t n;
+            if(!ParseOffset_(spec.substr(1), &n)) { return false; }
+            if(n == 0 || size == 0) { continue; }
+            first = n >= size ? 0 : size - n;
+            last = size - 1;
+        } else {
+            if(!ParseOffset_(spec.substr(0, dash), &first)) { return false; }
+            if(dash + 1 == spec.size()) {
+                last = size - 1;
+            } else if(!ParseOffset_(spec.substr(dash + 1), &last) || last < first) {
+                return false;
+            }
+            if(first >= size) { continue; }
+            last = min(last, size - 1);
+        }
+        if(ranges_.size() == MAX_RANGES) { return false; }
+        ranges_.push_back({first, last});
+    }
+    if(ranges_.size() > 1) {
+        static atomic<unsigned long long> counter(0);
+        snprintf(boundary_, sizeof(boundary_), "%020llu", ++counter);
+    }
+    return hasSpec;
+}
+
+// 416没有响应体, 用Content-Range告诉客户端文件大小
+void HttpResponse::AddRangeNotSatisfiable_(Buffer& buff) {
+    AppendStateLine_(buff, 416, CODE_STATUS.find(416)->second);
+    AppendConnection_(buff, isKeepAlive_);
+    AppendView(buff, "Content-Range: bytes */");
+    AppendUInt(buff, mmFileStat_.st_size);
+    AppendView(buff, "\r\n");
+    AppendDate_(buff);
+    AppendContentLength_(buff, 0);
+    buff.Append("\r\n", 2);
+}
+
+// 单个范围直接作为响应体; 多个范围组成multipart/byteranges, 每段前面是分隔行和这一段的类型、范围
+void HttpResponse::AddRanges_(Buffer& buff) {
+    const long long size = mmFileStat_.st_size;
+    if(ranges_.size() == 1) {
+        off_t first = ranges_[0].first, last = ranges_[0].second;
+        AppendView(buff, "Content-Range: bytes ");
+        AppendUInt(buff, first);
+        AppendView(buff, "-");
+        AppendUInt(buff, last);
+        AppendView(buff, "/");
+        AppendUInt(buff, size);
+        AppendView(buff, "\r\n");
+        AppendContentLength_(buff, last - first + 1);
+        buff.Append("\r\n", 2);
+        AddSlice_(buff, first, last - first + 1);
+        return;
+    }
+    static const char PART_HEADER[] = "\r\n--%s\r\nContent-type: %.*s\r\nContent-Range: bytes %lld-%lld/%lld\r\n\r\n";
+    static const char PART_END[] = "\r\n--%s--\r\n";
+    string_view type = GetFileType_(path_);
+    /* 先算出整个响应体的长度 */
+    size_t total = snprintf(nullptr, 0, PART_END, boundary_);
+    for(auto& r: ranges_) {
+        total += snprintf(nullptr, 0, PART_HEADER, boundary_, (int)type.size(), type.data(),
+                          (long long)r.first, (long long)r.second, size);
+        total += r.second - r.first + 1;
+    }
+    AppendContentLength_(buff, total);
+    buff.Append("\r\n", 2);
+    char part[256];
+    for(auto& r: ranges_) {
+        int len = snprintf(part, sizeof(part), PART_HEADER, boundary_, (int)type.size(), type.data(),
+                           (long long)r.first, (long long)r.second, size);
+        buff.Append(part, len);
+        AddSlice_(buff, r.first, r.second - r.first + 1);
+    }
+    int len = snprintf(part, sizeof(part), PART_END, boundary_);
+    buff.Append(part, len);
+}
+
+void HttpResponse::AddSlice_(Buffer& buff, off_t offset, size_t len) {
+    if(len > 0) {
+        slices_.push_back({buff.ReadableBytes(), offset, len});
+    }
+}
+
+void HttpResponse::AppendStateLine_(Buffer& buff, int code, string_view status) {
+    AppendView(buff, "HTTP/1.1 ");
+    AppendUInt(buff, code);
+    AppendView(buff, " ");
+    AppendView(buff, status);
+    AppendView(buff, "\r\n");
+}
+
+void HttpResponse::AppendConnection_(Buffer& buff, bool isKeepAlive) {
+    if(isKeepAlive) {
+        AppendView(buff, "Connection: keep-alive\r\nkeep-alive: max=6, timeout=120\r\n");
+    } else {
+        AppendView(buff, "Connection: close\r\n");
+    }
+}
+
+void HttpResponse::AppendContentType_(Buffer& buff, string_view path) {
+    AppendView(buff, "Content-type: ");
+    AppendView(buff, GetFileType_(path));
+    AppendView(buff, "\r\n");
+}
+
+void HttpResponse::AppendContentLength_(Buffer& buff, size_t len) {
+    AppendView(buff, "Content-length: ");
+    AppendUInt(buff, len);
+    AppendView(buff, "\r\n");
+}
+
+void HttpResponse::AppendDate_(Buffer& buff) {
+    static thread_local time_t last = -1;
+    static thread_local char line[64];
+    static thread_local size_t len = 0;
+    time_t now = time(nullptr);
+    if(now != last) {
+        memcpy(line, "Date: ", 6);
+        len = 6 + FormatHttpDate_(now, line + 6, sizeof(line) - 8);
+        memcpy(line + len, "\r\n", 2);
+        len += 2;
+        last = now;
+    }
+    buff.Append(line, len);
+}
+
+// 会话Cookie只给服务器用, 不让脚本读取, 跨站请求不携带
+void HttpResponse::AppendSetCookie_(Buffer& buff, string_view sid) {
+    AppendView(buff, "Set-Cookie: sid=");
+    AppendView(buff, sid);
+    AppendView(buff, "; Max-Age=");
+    AppendUInt(buff, SessionStore::Instance()->TTL());
+    AppendView(buff, "; Path=/; HttpOnly; SameSite=Lax\r\n");
+}
+
+void HttpResponse::AppendValidators_(Buffer& buff, string_view etag, string_view lastModified) {
+    AppendView(buff, "ETag: ");
+    AppendView(buff, etag);
+    AppendView(buff, "\r\nLast-Modified: ");
+    AppendView(buff, lastModified);
+    AppendView(buff, "\r\n");
+}
+
+size_t HttpResponse::FormatETag_(const struct stat& st, char* buf, size_t size) {
+    unsigned long long mtime = static_cast<unsigned long long>(st.st_mtim.tv_sec) * 1000000000ULL
+                               + st.st_mtim.tv_nsec;
+    int len = snprintf(buf, size, "\"%llx-%llx-%llx\"", static_cast<unsigned long long>(st.st_ino),
+                       static_cast<unsigned long long>(st.st_size), mtime);
+    return len < 0 ? 0 : min(static_cast<size_t>(len), size - 1);
+}
+
+// 只接受十进制数字, 位数限制在不会溢出的范围内
+bool HttpResponse::ParseOffset_(string_view str, off_t* value) {
+    if(str.empty() || str.size() > 18) { return false; }
+    off_t n = 0;
+    for(char c: str) {
+        if(c < '0' || c > '9') { return false; }
+        n = n * 10 + (c - '0');
+    }
+    *value = n;
+    return true;
+}
+
+size_t HttpResponse::FormatHttpDate_(time_t t, char* buf, size_t size) {
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    return strftime(buf, size, "%a, %d %b %Y %H:%M:%S GMT", &tm);
 }
 // 添加HTTP响应的内容信息，包括Content-Length字段和文件内容。它通过将文件映射到内存提高了文件的访问速度
 void HttpResponse::AddContent_(Buffer& buff) {
-    int srcFd = open((srcDir_ + path_).data(), O_RDONLY);
-    if(srcFd < 0) { 
-        ErrorContent(buff, "File NotFound!");
-        return; 
-    }
+    if(!file_) {
+        int srcFd = open((srcDir_ + path_).data(), O_RDONLY);
+        if(srcFd < 0) { 
+            ErrorContent(buff, "File NotFound!");
+            return; 
+        }
 
-    /* 将文件映射到内存提高文件的访问速度 
-        MAP_PRIVATE 建立一个写入时拷贝的私有映射*/
-    LOG_DEBUG("file path %s", (srcDir_ + path_).data());
-    int* mmRet = (int*)mmap(0, mmFileStat_.st_size, PROT_READ, MAP_PRIVATE, srcFd, 0);
-    if(*mmRet == -1) {
-        ErrorContent(buff, "File NotFound!");
-        return; 
+        LOG_DEBUG("file path %s", (srcDir_ + path_).data());
+        if(useSendfile) {
+            /* 保留描述符, 发送时由sendfile直接从页缓存拷贝到套接字 */
+            fileFd_.reset(new int(srcFd), [](int* fd) { close(*fd); delete fd; });
+        } else {
+            /* 将文件映射到内存提高文件的访问速度 
+                MAP_PRIVATE 建立一个写入时拷贝的私有映射*/
+            void* mmRet = mmap(0, mmFileStat_.st_size, PROT_READ, MAP_PRIVATE, srcFd, 0);
+            if(mmRet == MAP_FAILED) {
+                close(srcFd);
+                ErrorContent(buff, "File NotFound!");
+                return; 
+            }
+            size_t mmLen = mmFileStat_.st_size;
+            mmFile_.reset((char*)mmRet, [mmLen](char* p) { munmap(p, mmLen); });
+            close(srcFd);
+        }
     }
-    mmFile_ = (char*)mmRet;
-    close(srcFd);
-    buff.Append("Content-length: " + to_string(mmFileStat_.st_size) + "\r\n\r\n");
+    if(code_ == 206) {
+        AddRanges_(buff);
+        return;
+    }
+    AppendContentLength_(buff, mmFileStat_.st_size);
+    buff.Append("\r\n", 2);
+    AddSlice_(buff, 0, mmFileStat_.st_size);
 }
 // 取消文件到内存的映射，释放内存映射的资源
 void HttpResponse::UnmapFile() {
-    if(mmFile_) {
-        munmap(mmFile_, mmFileStat_.st_size);
-        mmFile_ = nullptr;
-    }
+    file_.reset();
+    mmFile_.reset();
+    fileFd_.reset();
 }
 //  根据文件后缀名获取文件的MIME类型，用于设置Content-Type字段。
-string HttpResponse::GetFileType_() {
+string_view HttpResponse::GetFileType_(string_view path) {
     /* 判断文件类型 */
-    string::size_type idx = path_.find_last_of('.');
-    if(idx == string::npos) {
+    string_view::size_type idx = path.find_last_of('.');
+    if(idx == string_view::npos) {
         return "text/plain";
     }
-    string suffix = path_.substr(idx);
-    if(SUFFIX_TYPE.count(suffix) == 1) {
-        return SUFFIX_TYPE.find(suffix)->second;
+    auto it = SUFFIX_TYPE.find(path.substr(idx));
+    if(it != SUFFIX_TYPE.end()) {
+        return it->second;
     }
     return "text/plain";
 }
@@ -176,6 +640,7 @@ void HttpResponse::ErrorContent(Buffer& buff, string message)
     body += "<p>" + message + "</p>";
     body += "<hr><em>TinyWebServer</em></body></html>";
 
-    buff.Append("Content-length: " + to_string(body.size()) + "\r\n\r\n");
+    AppendContentLength_(buff, body.size());
+    buff.Append("\r\n", 2);
     buff.Append(body);
 }
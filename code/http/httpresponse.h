@@ -7,34 +7,110 @@
 #define HTTP_RESPONSE_H
 
 #include <unordered_map>
+#include <vector>
+#include <memory>
+#include <string_view>
+#include <time.h>        // time, gmtime_r
+#include <strings.h>     // strncasecmp
 #include <fcntl.h>       // open
 #include <unistd.h>      // close
 #include <sys/stat.h>    // stat
 #include <sys/mman.h>    // mmap, munmap
+#include <zlib.h>        // deflate
 
 #include "../buffer/buffer.h"
 #include "../log/log.h"
+#include "../cache/filecache.h"
 
 class HttpResponse {
 public:
     HttpResponse();
     ~HttpResponse();
 
-    void Init(const std::string& srcDir, std::string& path, bool isKeepAlive = false, int code = -1);
+    void Init(std::string_view srcDir, std::string& path, bool isKeepAlive = false, int code = -1);
+    // 条件请求的If-None-Match和If-Modified-Since, 校验器匹配时MakeResponse生成没有响应体的304
+    // 只对GET请求设置; 引用请求报文, 在MakeResponse之前有效即可
+    void SetConditional(std::string_view ifNoneMatch, std::string_view ifModifiedSince);
+    // 范围请求的Range和If-Range, 同样只对GET请求设置; 范围有效时生成206, 都不可满足时生成416
+    void SetRange(std::string_view range, std::string_view ifRange);
+    // 请求的Accept-Encoding, 只对GET请求设置; 缓存中有gzip版本且客户端接受时发送压缩后的内容
+    void SetAcceptEncoding(std::string_view acceptEncoding) { acceptEncoding_ = acceptEncoding; }
+    // 登录成功后新建的会话ID, 非空时响应带上Set-Cookie; 同样在MakeResponse之前有效即可
+    void SetSession(std::string_view sid) { session_ = sid; }
     void MakeResponse(Buffer& buff);
+    // 调用者已经查到缓存的文件, MakeResponse不用再查一次
+    void SetCachedFile(std::shared_ptr<const CachedFile> file) { file_ = std::move(file); }
     void UnmapFile();
+    // 连接空闲时释放路径等字符串
+    void Release();
     char* File();
+    // sendfile模式下未命中缓存的文件不做映射, 通过这个描述符发送, 否则为-1
+    int FileFd() const;
+    // 文件内容的引用(缓存条目、映射或描述符), 持有它的对象销毁前内容不会被释放
+    std::shared_ptr<void> FileRef() const;
     size_t FileLen() const;
     void ErrorContent(Buffer& buff, std::string message);
     int Code() const { return code_; }
 
+    // 响应体中引用文件内容的片段: 插在写缓冲区第pos个未读字节处, 内容是文件的[offset, offset + len)
+    // 整个文件是一个片段, 范围请求的每个范围各是一个片段, 都不拷贝文件内容
+    struct Slice {
+        size_t pos;
+        off_t offset;
+        size_t len;
+    };
+    const std::vector<Slice>& Slices() const { return slices_; }
+
+    // FileCache的onLoad回调: 为缓存的文件生成gzip版本、校验器和各个版本的200响应头
+    static void PrepareFile(CachedFile& file);
+
+    // 为true时文件内容用sendfile直接从页缓存发送, 不映射到进程地址空间
+    static bool useSendfile;
+    // sendfile模式下不小于这个大小的文件不进静态文件缓存, 直接sendfile
+    static const size_t SENDFILE_MIN_SIZE = 16 << 10;
+    // 为true时文本文件装入缓存时压缩一份gzip版本; sendfile模式下这些文件也进缓存, 上限为GZIP_MAX_SIZE
+    static bool useGzip;
+    static const size_t GZIP_MIN_SIZE = 256;
+    static const size_t GZIP_MAX_SIZE = 4 << 20;
+
 private:
     void AddStateLine_(Buffer &buff);
     void AddHeader_(Buffer &buff);
     void AddContent_(Buffer &buff);
 
     void ErrorHtml_();
-    std::string GetFileType_();
+    // 取得文件的校验器, 缓存中有就直接引用, 否则按stat信息格式化到本对象的数组里
+    void Validators_();
+    bool NotModified_() const;
+    bool AcceptGzip_() const;
+    // 文件有gzip版本时, 不论发送哪个版本都要告诉缓存代理响应随Accept-Encoding变化
+    bool HasVariants_() const { return file_ && !file_->gzip.empty(); }
+    void AddNotModified_(Buffer& buff);
+    // 解析Range到ranges_; 返回false表示忽略Range(格式错误、If-Range不匹配或者范围太多), 按整个文件响应
+    bool ParseRange_();
+    void AddRangeNotSatisfiable_(Buffer& buff);
+    void AddRanges_(Buffer& buff);
+    void AddSlice_(Buffer& buff, off_t offset, size_t len);
+
+    // 响应头直接追加到缓冲区, 不拼接临时字符串
+    static void AppendStateLine_(Buffer& buff, int code, std::string_view status);
+    static void AppendConnection_(Buffer& buff, bool isKeepAlive);
+    static void AppendContentType_(Buffer& buff, std::string_view path);
+    static void AppendContentLength_(Buffer& buff, size_t len);
+    // Date头每个线程每秒格式化一次
+    static void AppendDate_(Buffer& buff);
+    static void AppendSetCookie_(Buffer& buff, std::string_view sid);
+    static void AppendValidators_(Buffer& buff, std::string_view etag, std::string_view lastModified);
+    static bool Compressible_(std::string_view path);
+    static void Gzip_(CachedFile& file);
+    // ETag由inode、大小和修改时间组成, 返回写入的长度
+    static size_t FormatETag_(const struct stat& st, char* buf, size_t size);
+    static size_t FormatHttpDate_(time_t t, char* buf, size_t size);
+    static bool ParseOffset_(std::string_view str, off_t* value);
+
+    // 一个请求最多的范围数, 超过时忽略Range
+    static const size_t MAX_RANGES = 16;
+    static std::string_view GetFileType_(std::string_view path);
 
     int code_;
     bool isKeepAlive_;
@@ -42,12 +118,37 @@ private:
     std::string path_;
     std::string srcDir_;
     
-    // 指向映射内存区域的指针
-    char* mmFile_; 
+    // 命中静态文件缓存时使用缓存中的内容, 不再stat/open/mmap
+    std::shared_ptr<const CachedFile> file_;
+    // 指向映射内存区域的指针, 最后一个引用释放时munmap
+    std::shared_ptr<char> mmFile_;
+    // sendfile模式下打开的文件, 最后一个引用释放时close
+    std::shared_ptr<int> fileFd_;
     // 映射区域
     struct stat mmFileStat_;
 
-    static const std::unordered_map<std::string, std::string> SUFFIX_TYPE;
+    std::string_view ifNoneMatch_;
+    std::string_view ifModifiedSince_;
+    std::string_view etag_;
+    std::string_view lastModified_;
+    char etagBuf_[64];
+    char lastModifiedBuf_[32];
+
+    std::string_view session_;
+
+    std::string_view acceptEncoding_;
+    // 这次发送的是缓存中的gzip版本
+    bool gzip_;
+
+    std::string_view range_;
+    std::string_view ifRange_;
+    // 可满足的范围[first, last]
+    std::vector<std::pair<off_t, off_t>> ranges_;
+    std::vector<Slice> slices_;
+    // 多个范围时multipart/byteranges的分隔符
+    char boundary_[24];
+
+    static const std::unordered_map<std::string_view, std::string_view> SUFFIX_TYPE;
     static const std::unordered_map<int, std::string> CODE_STATUS;
     static const std::unordered_map<int, std::string> CODE_PATH;
 };
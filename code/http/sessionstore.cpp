@@ -0,0 +1,127 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-07-08
+ * @copyleft Apache 2.0
+ */
+#include "sessionstore.h"
+using namespace std;
+
+SessionStore::SessionStore(): ttlMs_(0) {}
+
+SessionStore* SessionStore::Instance() {
+    static SessionStore inst;
+    return &inst;
+}
+
+void SessionStore::Init(int ttl) {
+    ttlMs_ = ttl > 0 ? static_cast<int64_t>(ttl) * 1000 : 0;
+}
+
+int64_t SessionStore::NowMs_() {
+    return chrono::duration_cast<chrono::milliseconds>(
+        chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// 32个十六进制字符, 前16个是hi, 后16个是lo
+bool SessionStore::ParseId_(string_view sid, Id_* id) {
+    if(sid.size() != 32) { return false; }
+    uint64_t part[2] = { 0, 0 };
+    for(size_t i = 0; i < 32; i++) {
+        char ch = sid[i];
+        int v;
+        if(ch >= '0' && ch <= '9') { v = ch - '0'; }
+        else if(ch >= 'a' && ch <= 'f') { v = ch - 'a' + 10; }
+        else { return false; }
+        part[i / 16] = (part[i / 16] << 4) | v;
+    }
+    id->hi = part[0];
+    id->lo = part[1];
+    return true;
+}
+
+string SessionStore::Create(const string& user) {
+    if(!Enabled()) { return string(); }
+    Id_ id;
+    if(getrandom(&id, sizeof(id), 0) != sizeof(id)) {
+        LOG_ERROR("Session id random error!");
+        return string();
+    }
+    char sid[33];
+    snprintf(sid, sizeof(sid), "%016llx%016llx", (unsigned long long)id.hi, (unsigned long long)id.lo);
+
+    int64_t expires = NowMs_() + ttlMs_;
+    Shard_& shard = ShardOf_(id);
+    lock_guard<mutex> locker(shard.mtx);
+    while(shard.sessions.size() >= MAX_SESSIONS_PER_SHARD && !shard.order.empty()) {
+        /* 分片满了, 最早到期的会话提前失效; 已删除的跳过, 续期过的和Expire一样按新的过期时间重新排队 */
+        auto front = shard.order.front();
+        shard.order.pop_front();
+        auto it = shard.sessions.find(front.second);
+        if(it == shard.sessions.end()) { continue; }
+        if(it->second.expires != front.first) {
+            shard.order.emplace_back(it->second.expires, front.second);
+            continue;
+        }
+        shard.sessions.erase(it);
+    }
+    shard.sessions[id] = { user, expires };
+    shard.order.emplace_back(expires, id);
+    return string(sid, 32);
+}
+
+bool SessionStore::Check(string_view sid, string* user) {
+    Id_ id;
+    if(!Enabled() || !ParseId_(sid, &id)) { return false; }
+    int64_t now = NowMs_();
+    Shard_& shard = ShardOf_(id);
+    lock_guard<mutex> locker(shard.mtx);
+    auto it = shard.sessions.find(id);
+    if(it == shard.sessions.end()) { return false; }
+    if(it->second.expires <= now) {
+        shard.sessions.erase(it);
+        return false;
+    }
+    /* 续期, 清理时发现过期时间变了再重新排队 */
+    it->second.expires = now + ttlMs_;
+    if(user) { *user = it->second.user; }
+    return true;
+}
+
+void SessionStore::Remove(string_view sid) {
+    Id_ id;
+    if(!ParseId_(sid, &id)) { return; }
+    Shard_& shard = ShardOf_(id);
+    lock_guard<mutex> locker(shard.mtx);
+    /* 队列里的记录留到清理时丢弃 */
+    shard.sessions.erase(id);
+}
+
+size_t SessionStore::Expire() {
+    int64_t now = NowMs_();
+    size_t cnt = 0;
+    for(Shard_& shard: shards_) {
+        lock_guard<mutex> locker(shard.mtx);
+        while(!shard.order.empty() && shard.order.front().first <= now) {
+            Id_ id = shard.order.front().second;
+            shard.order.pop_front();
+            auto it = shard.sessions.find(id);
+            if(it == shard.sessions.end()) { continue; }
+            if(it->second.expires > now) {
+                shard.order.emplace_back(it->second.expires, id);
+            } else {
+                shard.sessions.erase(it);
+                cnt++;
+            }
+        }
+    }
+    return cnt;
+}
+
+size_t SessionStore::Count() {
+    size_t cnt = 0;
+    for(Shard_& shard: shards_) {
+        lock_guard<mutex> locker(shard.mtx);
+        cnt += shard.sessions.size();
+    }
+    return cnt;
+}
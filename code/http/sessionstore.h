@@ -0,0 +1,82 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-07-08
+ * @copyleft Apache 2.0
+ */
+#ifndef SESSION_STORE_H
+#define SESSION_STORE_H
+
+#include <unordered_map>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <mutex>
+#include <chrono>
+#include <stdint.h>
+#include <sys/random.h>     // getrandom
+
+#include "../log/log.h"
+
+/*
+ * 登录会话: 登录成功后发一个随机的会话ID(Cookie: sid=...), 之后带着它的请求在内存里确认身份, 不再查数据库
+ * 按ID分成SHARDS个分片, 每个分片一把锁, 不同连接的查询基本不会互相等待
+ * 会话在最后一次使用ttl秒后过期: 查询时发现过期就删除, 另外由定时器周期性地调用Expire清理不再访问的会话
+ * 每个分片按创建顺序记录会话, 清理时只看队头, 续期过的会话重新排到队尾
+ */
+class SessionStore {
+public:
+    static SessionStore* Instance();
+
+    // ttl秒, <=0时不启用会话
+    void Init(int ttl);
+    bool Enabled() const { return ttlMs_ > 0; }
+    int TTL() const { return static_cast<int>(ttlMs_ / 1000); }
+
+    // 为用户创建会话, 返回32个十六进制字符的会话ID, 失败时返回空
+    std::string Create(const std::string& user);
+    // 会话存在且未过期时续期并返回true, user不为空时带回用户名
+    bool Check(std::string_view sid, std::string* user = nullptr);
+    void Remove(std::string_view sid);
+    // 清理所有过期的会话, 返回清理的个数
+    size_t Expire();
+    size_t Count();
+
+    // 定时器清理的间隔
+    static const int EXPIRE_INTERVAL_MS = 1000;
+    // 每个分片最多的会话数, 满了之后最早创建的会话提前失效
+    static const size_t MAX_SESSIONS_PER_SHARD = 1 << 16;
+
+private:
+    SessionStore();
+    ~SessionStore() = default;
+
+    // 会话ID的128位随机数
+    struct Id_ {
+        uint64_t hi, lo;
+        bool operator==(const Id_& other) const { return hi == other.hi && lo == other.lo; }
+    };
+    struct IdHash_ {
+        size_t operator()(const Id_& id) const { return id.lo; }
+    };
+    struct Session_ {
+        std::string user;
+        int64_t expires;
+    };
+    struct Shard_ {
+        std::mutex mtx;
+        std::unordered_map<Id_, Session_, IdHash_> sessions;
+        // (过期时间, ID), 大致按过期时间排序
+        std::deque<std::pair<int64_t, Id_>> order;
+    };
+
+    static bool ParseId_(std::string_view sid, Id_* id);
+    static int64_t NowMs_();
+    Shard_& ShardOf_(const Id_& id) { return shards_[id.hi & (SHARDS - 1)]; }
+
+    static const int SHARDS = 16;
+
+    int64_t ttlMs_;
+    Shard_ shards_[SHARDS];
+};
+
+#endif //SESSION_STORE_H
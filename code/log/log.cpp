@@ -2,7 +2,7 @@
  * @Author       : mark
  * @Date         : 2020-06-16
  * @copyleft Apache 2.0
- */ 
+ */
 #include "log.h"
 
 using namespace std;
@@ -10,212 +10,238 @@ using namespace std;
 Log::Log() {
     lineCount_ = 0;
     isAsync_ = false;
+    isOpen_ = false;
+    level_ = 1;
     writeThread_ = nullptr;
-    deque_ = nullptr;
+    ring_ = nullptr;
     toDay_ = 0;
-    fp_ = nullptr;
+    fd_ = -1;
+    sleeping_ = false;
+    isClose_ = false;
 }
 
 Log::~Log() {
     if(writeThread_ && writeThread_->joinable()) {
-        // 消息队列非空，执行写操作
-        while(!deque_->empty()) {
-            deque_->flush();
-        };
-        deque_->Close();
+        // 后台线程退出前会写完队列里剩下的日志
+        isClose_ = true;
+        {
+            lock_guard<mutex> locker(waitMtx_);
+            cond_.notify_one();
+        }
         writeThread_->join();
     }
-    if(fp_) {
+    if(fd_ >= 0) {
         lock_guard<mutex> locker(mtx_);
-        flush();
-        fclose(fp_);
+        close(fd_);
     }
 }
 
 int Log::GetLevel() {
-    lock_guard<mutex> locker(mtx_);
-    return level_;
+    return level_.load(memory_order_relaxed);
 }
 
 void Log::SetLevel(int level) {
-    lock_guard<mutex> locker(mtx_);
-    level_ = level;
+    level_.store(level, memory_order_relaxed);
 }
 // 初始化日志系统，可以设置日志级别、日志路径、文件后缀以及最大队列大小。如果启用了异步写入，会创建一个日志写入线程。
 void Log::init(int level = 1, const char* path, const char* suffix,
     int maxQueueSize) {
     isOpen_ = true;
     level_ = level;
+
+    // 获取当前时间
+    time_t timer = time(nullptr);
+    // 将时间转化为tm时间结构体，用于格式化输出
+    struct tm t;
+    localtime_r(&timer, &t);
+    {
+        lock_guard<mutex> locker(mtx_);
+        // 设置日志文件路径
+        path_ = path;
+        // 设置日志文件后缀
+        suffix_ = suffix;
+        // toDay_置零, 让Rotate_按日期打开当天的文件
+        toDay_ = 0;
+        Rotate_((t.tm_year + 1900) * 10000 + (t.tm_mon + 1) * 100 + t.tm_mday);
+        assert(fd_ >= 0);
+    }
+
     // maxqueuesize>0表示启动了异步日志模式
     if(maxQueueSize > 0) {
-        isAsync_ = true;
-        if(!deque_) {
-            // 如果阻塞队列没有创建就创建
-            unique_ptr<BlockDeque<std::string>> newDeque(new BlockDeque<std::string>);
-            // 将新创建的队列移动给成员
-            deque_ = move(newDeque);
+        if(!ring_) {
+            // 如果环形队列没有创建就创建
+            ring_.reset(new LogRing(maxQueueSize));
             // 创建一个单例日志的线程
-            std::unique_ptr<std::thread> NewThread(new thread(FlushLogThread));
-            writeThread_ = move(NewThread);
+            writeThread_.reset(new thread(FlushLogThread));
         }
+        isAsync_ = true;
     } else {
         isAsync_ = false;
     }
+}
 
-    lineCount_ = 0;
-    // 获取当前时间
-    time_t timer = time(nullptr);
-    // 将时间转化为tm时间结构体，用于格式化输出
-    struct tm *sysTime = localtime(&timer);
-    struct tm t = *sysTime;
-    // 设置日志文件路径
-    path_ = path;
-    // 设置日志文件后缀
-    suffix_ = suffix;
-    // 初始化日志文件名
-    char fileName[LOG_NAME_LEN] = {0};
-    snprintf(fileName, LOG_NAME_LEN - 1, "%s/%04d_%02d_%02d%s", 
-            path_, t.tm_year + 1900, t.tm_mon + 1, t.tm_mday, suffix_);
-    // 设置成员变量日期
-    toDay_ = t.tm_mday;
+// 格式化一行日志: 时间 级别 内容 换行, 超长的内容截断; 返回长度, date带回日期
+int Log::Format_(char* dst, size_t cap, int* date, int level, const char* format, va_list vaList) {
+    // 同一秒内的日志复用格式化好的时间, 省掉localtime_r和snprintf
+    static thread_local time_t lastSec = -1;
+    static thread_local int lastDate = 0;
+    static thread_local char timeStr[64];
+    static const char* TITLE[] = { "[DEBUG]: ", "[INFO] : ", "[WARN] : ", "[ERROR]: " };
+    const int TITLE_LEN = 9;
 
-    {
-        lock_guard<mutex> locker(mtx_);
-        buff_.RetrieveAll();
-        // 文件如果已经打开，直接写入
-        if(fp_) { 
-            flush();
-            fclose(fp_); 
-        }
+    struct timeval now = {0, 0};
+    gettimeofday(&now, nullptr);
+    if(now.tv_sec != lastSec) {
+        struct tm t;
+        localtime_r(&now.tv_sec, &t);
+        snprintf(timeStr, sizeof(timeStr), "%d-%02d-%02d %02d:%02d:%02d",
+                 t.tm_year + 1900, t.tm_mon + 1, t.tm_mday, t.tm_hour, t.tm_min, t.tm_sec);
+        lastDate = (t.tm_year + 1900) * 10000 + (t.tm_mon + 1) * 100 + t.tm_mday;
+        lastSec = now.tv_sec;
+    }
+    *date = lastDate;
 
-        // 没有打开就重新打开
-        fp_ = fopen(fileName, "a");
-        if(fp_ == nullptr) {
-            // 没有找到路径就直接创建一个
-            mkdir(path_, 0777);
-            // 重新打开文件
-            fp_ = fopen(fileName, "a");
-        } 
-        assert(fp_ != nullptr);
+    int n = snprintf(dst, cap, "%s.%06ld ", timeStr, now.tv_usec);
+    if(level >= 0 && level <= 3) {
+        memcpy(dst + n, TITLE[level], TITLE_LEN);
+    } else {
+        memcpy(dst + n, "[UNKNOW] ", TITLE_LEN);
     }
+    n += TITLE_LEN;
+
+    // 留一个字节给换行
+    int m = vsnprintf(dst + n, cap - n - 1, format, vaList);
+    if(m < 0) { m = 0; }
+    n += min(m, static_cast<int>(cap - n - 2));
+    dst[n++] = '\n';
+    return n;
 }
 
-void Log::write(int level, const char *format, ...) {
-    // 存储当前时间
-    struct timeval now = {0, 0};
-    // TODO：这里似乎不会频繁调用，似乎那种暂存系统时间戳的方法不是很合适
-    // 使用系统调用获取当前时间戳并且存储在now中
-    gettimeofday(&now, nullptr);
-    // 获取now中的秒级时间戳
-    time_t tSec = now.tv_sec;
-    // 将时间戳转化为tm结构体，方便格式化输出
-    struct tm *sysTime = localtime(&tSec);
-    struct tm t = *sysTime;
-    // 申明一个变长参数列表
-    va_list vaList;
+// 日期变了或者当前文件写满了MAX_LINES行, 调用前需持有mtx_
+bool Log::NeedRotate_(int date) {
+    return toDay_ != date || (lineCount_ && (lineCount_ % MAX_LINES == 0));
+}
+
+// 切换日志文件, 调用前需持有mtx_
+void Log::Rotate_(int date) {
+    char newFile[LOG_NAME_LEN];
+    char tail[36] = {0};
+    snprintf(tail, 36, "%04d_%02d_%02d", date / 10000, date / 100 % 100, date % 100);
 
-    /* 日志日期 日志行数 如果日期不对或者日志已经写满了*/
-    if (toDay_ != t.tm_mday || (lineCount_ && (lineCount_  %  MAX_LINES == 0)))
+    // 如果是日期不对，那么就使用新日期，并且将行号置零
+    if (toDay_ != date)
     {
-        unique_lock<mutex> locker(mtx_);
-        locker.unlock();
-        
-        char newFile[LOG_NAME_LEN];
-        char tail[36] = {0};
-        // 先存储当前时间
-        snprintf(tail, 36, "%04d_%02d_%02d", t.tm_year + 1900, t.tm_mon + 1, t.tm_mday);
-
-        // 如果是日期不对，那么就获取当前日期，并且将行号置零
-        if (toDay_ != t.tm_mday)
-        {
-            snprintf(newFile, LOG_NAME_LEN - 72, "%s/%s%s", path_, tail, suffix_);
-            toDay_ = t.tm_mday;
-            lineCount_ = 0;
-        }
-        else {
-            // 不置零行号，直接添加为分文件
-            snprintf(newFile, LOG_NAME_LEN - 72, "%s/%s-%d%s", path_, tail, (lineCount_  / MAX_LINES), suffix_);
-        }
-        
-        locker.lock();
-        // 写入日志
-        flush();
-        // 关闭当前文件
-        fclose(fp_);
-        // 将文件标识符赋值为新文件
-        fp_ = fopen(newFile, "a");
-        assert(fp_ != nullptr);
+        snprintf(newFile, LOG_NAME_LEN - 72, "%s/%s%s", path_, tail, suffix_);
+        toDay_ = date;
+        lineCount_ = 0;
+    }
+    else {
+        // 不置零行号，直接添加为分文件
+        snprintf(newFile, LOG_NAME_LEN - 72, "%s/%s-%d%s", path_, tail, (lineCount_  / MAX_LINES), suffix_);
     }
 
-    {
-        // 加锁不仅仅使为了写缓冲区，也方便同步写入日志
-        unique_lock<mutex> locker(mtx_);
-        lineCount_++;
-        // 将格式化好的日期写入缓冲区里
-        int n = snprintf(buff_.BeginWrite(), 128, "%d-%02d-%02d %02d:%02d:%02d.%06ld ",
-                    t.tm_year + 1900, t.tm_mon + 1, t.tm_mday,
-                    t.tm_hour, t.tm_min, t.tm_sec, now.tv_usec);
-        // 更新写入的位置 
-        buff_.HasWritten(n);
-        // 添加前缀到缓冲区中
-        AppendLogLevelTitle_(level);
-
-        // 将消息格式化写入
-        va_start(vaList, format);
-        int m = vsnprintf(buff_.BeginWrite(), buff_.WritableBytes(), format, vaList);
-        va_end(vaList);
-        // 更新写入的位置
-        buff_.HasWritten(m);
-        // 最后添加换行符
-        buff_.Append("\n\0", 2);
-
-        if(isAsync_ && deque_ && !deque_->full()) {
-            // 将所有的内容当作字符串放入阻塞队列
-            deque_->push_back(buff_.RetrieveAllToStr());
-        } else {
-            // 直接写入当前的日志文件
-            fputs(buff_.Peek(), fp_);
-        }
-        buff_.RetrieveAll();
+    if(fd_ >= 0) { close(fd_); }
+    fd_ = open(newFile, O_WRONLY | O_CREAT | O_APPEND, 0666);
+    if(fd_ < 0) {
+        // 没有找到路径就直接创建一个
+        mkdir(path_, 0777);
+        fd_ = open(newFile, O_WRONLY | O_CREAT | O_APPEND, 0666);
     }
+    assert(fd_ >= 0);
+}
+
+// 在调用线程里直接写文件
+void Log::WriteSync_(const char* data, size_t len, int date) {
+    lock_guard<mutex> locker(mtx_);
+    if(NeedRotate_(date)) { Rotate_(date); }
+    lineCount_++;
+    ::write(fd_, data, len);
 }
-// 添加日志前缀标签
-void Log::AppendLogLevelTitle_(int level) {
-    switch(level) {
-    case 0:
-        buff_.Append("[DEBUG]: ", 9);
-        break;
-    case 1:
-        buff_.Append("[INFO] : ", 9);
-        break;
-    case 2:
-        buff_.Append("[WARN] : ", 9);
-        break;
-    case 3:
-        buff_.Append("[ERROR]: ", 9);
-        break;
-    default:
-        buff_.Append("[UNKNOW] : ", 9);
-        break;
+
+void Log::write(int level, const char *format, ...) {
+    // 申明一个变长参数列表
+    va_list vaList;
+    va_start(vaList, format);
+    size_t pos;
+    LogRing::Record* rec = nullptr;
+    if(isAsync_ && ring_) {
+        rec = ring_->TryClaim(&pos);
+    }
+    if(rec) {
+        // 直接格式化到环形队列的槽里
+        rec->len = Format_(rec->data, sizeof(rec->data), &rec->date, level, format, vaList);
+        ring_->Commit(rec, pos);
+        // 发布记录和检查sleeping_之间需要全屏障, 与AsyncWrite_中的屏障配对, 避免漏掉唤醒
+        atomic_thread_fence(memory_order_seq_cst);
+        if(sleeping_.load(memory_order_relaxed)) {
+            flush();
+        }
+    } else {
+        // 同步模式或者队列已满
+        char buf[LogRing::RECORD_SIZE];
+        int date;
+        int len = Format_(buf, sizeof(buf), &date, level, format, vaList);
+        WriteSync_(buf, len, date);
     }
+    va_end(vaList);
 }
-// 写入日志
+
+// 唤醒后台线程写入日志; 同步模式下直接write, 没有需要刷新的用户态缓冲
 void Log::flush() {
-    if(isAsync_) { 
-        // 确保会有生产者来消费
-        deque_->flush(); 
+    if(isAsync_) {
+        lock_guard<mutex> locker(waitMtx_);
+        cond_.notify_one();
     }
-    // 刷新文件缓冲区,确保文件写入
-    fflush(fp_);
 }
 
 void Log::AsyncWrite_() {
-    string str = "";
-    // 传入空str对象,用于换出任务
-    while(deque_->pop(str)) {
-        lock_guard<mutex> locker(mtx_);
-        // 将日志消息写入文件
-        fputs(str.c_str(), fp_);
+    struct iovec iov[BATCH];
+    while(true) {
+        int n = 0;
+        {
+            lock_guard<mutex> locker(mtx_);
+            LogRing::Record* rec;
+            while(n < BATCH && (rec = ring_->Front(n))) {
+                if(NeedRotate_(rec->date)) {
+                    // 先把攒下的写进旧文件, 下一轮再切换
+                    if(n > 0) { break; }
+                    Rotate_(rec->date);
+                }
+                iov[n].iov_base = rec->data;
+                iov[n].iov_len = rec->len;
+                lineCount_++;
+                n++;
+            }
+            // 一批日志一次系统调用写完, 写失败就丢弃
+            struct iovec* cur = iov;
+            int cnt = n;
+            while(cnt > 0) {
+                ssize_t len = writev(fd_, cur, cnt);
+                if(len <= 0) { break; }
+                while(cnt > 0 && static_cast<size_t>(len) >= cur->iov_len) {
+                    len -= cur->iov_len;
+                    cur++;
+                    cnt--;
+                }
+                if(cnt > 0) {
+                    cur->iov_base = static_cast<char*>(cur->iov_base) + len;
+                    cur->iov_len -= len;
+                }
+            }
+        }
+        if(n > 0) {
+            ring_->Release(n);
+            continue;
+        }
+        if(isClose_) { break; }
+        // 队列为空, 睡眠等待写者唤醒; 超时兜底
+        unique_lock<mutex> locker(waitMtx_);
+        sleeping_.store(true, memory_order_relaxed);
+        atomic_thread_fence(memory_order_seq_cst);
+        if(!ring_->Front(0) && !isClose_) {
+            cond_.wait_for(locker, chrono::milliseconds(100));
+        }
+        sleeping_.store(false, memory_order_relaxed);
     }
 }
 
@@ -228,4 +254,4 @@ Log* Log::Instance() {
 void Log::FlushLogThread() {
     // 启动异步写入线程
     Log::Instance()->AsyncWrite_();
-}
\ No newline at end of file
+}
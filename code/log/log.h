@@ -9,14 +9,23 @@
 #include <mutex>
 #include <string>
 #include <thread>
+#include <atomic>
+#include <condition_variable>
 #include <sys/time.h>
+#include <sys/uio.h>          // writev
 #include <string.h>
 #include <stdarg.h>           // vastart va_end
 #include <assert.h>
+#include <fcntl.h>            // open
+#include <unistd.h>           // write, close
 #include <sys/stat.h>         //mkdir
-#include "blockqueue.h"
-#include "../buffer/buffer.h"
+#include "logring.h"
 
+/*
+ * 异步模式下写日志的线程在LogRing里抢一个槽, 直接把日志格式化进槽里, 全程不加锁
+ * 后台线程成批取出已写好的记录, 一次writev写入文件, 日志文件的按天/按行切换也只在后台线程做
+ * 队列满或同步模式时, 在调用线程里加锁直接写文件
+ */
 class Log {
 public:
     void init(int level, const char* path = "./log", 
@@ -35,14 +44,19 @@ public:
     
 private:
     Log();
-    void AppendLogLevelTitle_(int level);
     virtual ~Log();
+    int Format_(char* dst, size_t cap, int* date, int level, const char* format, va_list vaList);
+    bool NeedRotate_(int date);
+    void Rotate_(int date);
+    void WriteSync_(const char* data, size_t len, int date);
     void AsyncWrite_();
 
 private:
     static const int LOG_PATH_LEN = 256;
     static const int LOG_NAME_LEN = 256;
     static const int MAX_LINES = 50000;
+    // 后台线程一次writev最多写多少条
+    static const int BATCH = 64;
 
     const char* path_;
     const char* suffix_;
@@ -51,22 +65,27 @@ private:
 
     // 行数
     int lineCount_;
-    // 当天日期
+    // 当天日期, 年*10000+月*100+日
     int toDay_;
 
     bool isOpen_;
     
-    // 缓冲区
-    Buffer buff_;
     // 日志级别
-    int level_;
+    std::atomic<int> level_;
     // 是否异步写入
     bool isAsync_;
 
-    FILE* fp_;
-    std::unique_ptr<BlockDeque<std::string>> deque_; 
+    int fd_;
+    std::unique_ptr<LogRing> ring_;
     std::unique_ptr<std::thread> writeThread_;
+    // 保护fd_、行数和日期, 只有后台线程和同步写入时才会用到
     std::mutex mtx_;
+
+    // 后台线程空闲时在cond_上等待, 写者只在它睡眠时才去唤醒
+    std::atomic<bool> sleeping_;
+    std::atomic<bool> isClose_;
+    std::mutex waitMtx_;
+    std::condition_variable cond_;
 };
 
 #define LOG_BASE(level, format, ...) \
@@ -74,7 +93,6 @@ private:
         Log* log = Log::Instance();\
         if (log->IsOpen() && log->GetLevel() <= level) {\
             log->write(level, format, ##__VA_ARGS__); \
-            log->flush();\
         }\
     } while(0);
 
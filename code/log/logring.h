@@ -0,0 +1,97 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-29
+ * @copyleft Apache 2.0
+ */
+#ifndef LOG_RING_H
+#define LOG_RING_H
+
+#include <atomic>
+#include <memory>
+#include <stdint.h>
+#include <assert.h>
+
+/*
+ * 无锁的多生产者单消费者环形队列, 元素是定长的日志记录
+ * 每个槽带一个序号(Vyukov有界队列): 序号 == pos 表示空闲, 可被第pos个写者占用;
+ * 序号 == pos + 1 表示已写好, 可被消费者读取; 消费者读完后把序号设为 pos + 容量, 留给下一圈
+ * 写者用CAS抢到一个槽后直接在槽里格式化, 再发布, 不需要拷贝也不需要加锁
+ * 消费者按顺序取出一批已写好的连续记录(Front), 写完文件后一起释放(Release)
+ */
+class LogRing {
+public:
+    static const size_t RECORD_SIZE = 1024;
+
+    struct alignas(64) Record {
+        std::atomic<size_t> seq;
+        // 记录的日期, 年*10000+月*100+日, 消费者据此切换日志文件
+        int date;
+        uint32_t len;
+        char data[RECORD_SIZE - sizeof(std::atomic<size_t>) - sizeof(int) - sizeof(uint32_t)];
+    };
+
+    explicit LogRing(size_t capacity) {
+        capacity_ = 1;
+        while(capacity_ < capacity) { capacity_ <<= 1; }
+        mask_ = capacity_ - 1;
+        records_.reset(new Record[capacity_]);
+        for(size_t i = 0; i < capacity_; i++) {
+            records_[i].seq.store(i, std::memory_order_relaxed);
+        }
+        tail_.store(0, std::memory_order_relaxed);
+        head_ = 0;
+    }
+
+    size_t capacity() const { return capacity_; }
+
+    // 占用一个槽, 队列已满时返回nullptr; 写完后必须调用Commit
+    Record* TryClaim(size_t* pos) {
+        size_t p = tail_.load(std::memory_order_relaxed);
+        while(true) {
+            Record* rec = &records_[p & mask_];
+            size_t seq = rec->seq.load(std::memory_order_acquire);
+            intptr_t dif = (intptr_t)seq - (intptr_t)p;
+            if(dif == 0) {
+                if(tail_.compare_exchange_weak(p, p + 1, std::memory_order_relaxed)) {
+                    *pos = p;
+                    return rec;
+                }
+            } else if(dif < 0) {
+                return nullptr;
+            } else {
+                p = tail_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    void Commit(Record* rec, size_t pos) {
+        rec->seq.store(pos + 1, std::memory_order_release);
+    }
+
+    // 仅消费者调用: 从队头数第i条记录, 还没写好时返回nullptr
+    Record* Front(size_t i) {
+        Record* rec = &records_[(head_ + i) & mask_];
+        if(rec->seq.load(std::memory_order_acquire) != head_ + i + 1) {
+            return nullptr;
+        }
+        return rec;
+    }
+
+    // 仅消费者调用: 释放队头的n条记录
+    void Release(size_t n) {
+        for(size_t i = 0; i < n; i++) {
+            records_[head_ & mask_].seq.store(head_ + capacity_, std::memory_order_release);
+            head_++;
+        }
+    }
+
+private:
+    size_t capacity_;
+    size_t mask_;
+    std::unique_ptr<Record[]> records_;
+    // 写者和消费者的位置放在不同的缓存行, 避免伪共享
+    alignas(64) std::atomic<size_t> tail_;
+    alignas(64) size_t head_;
+};
+
+#endif //LOG_RING_H
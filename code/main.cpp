@@ -13,7 +13,10 @@ int main() {
     WebServer server(
         1316, 3, 60000, false,             /* 端口 ET模式 timeoutMs 优雅退出  */
         3306, "root", "123456", "mydb", /* Mysql配置 */
-        4, 2, true, 0, 1024);             /* 连接池数量 线程池数量 日志开关 日志等级 日志异步队列容量 */
+        4, 2, true, 0, 1024,              /* 连接池数量 线程池数量(0表示在Reactor线程内处理) 日志开关 日志等级 日志异步队列容量 */
+        0, true, false, true,             /* Reactor数量(0表示每个CPU核心一个) sendfile发送文件 缓存命中的请求在Reactor线程内应答 gzip压缩文本文件 */
+        1800, 4096, 16, true,             /* 登录会话有效期(秒, 0表示不启用) 用户缓存容量(0表示不启用) 连接池最大数量(忙时扩容) 数据库熔断 */
+        "");                              /* 本地用户数据文件(为空时使用MySQL, 否则不连接数据库) */
     server.Start();
 } 
   
\ No newline at end of file
@@ -0,0 +1,93 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-07-12
+ * @copyleft Apache 2.0
+ */
+#include "dbbreaker.h"
+using namespace std;
+
+DbBreaker::DbBreaker(): enabled_(false), state_(CLOSED), bad_{}, pos_(0), calls_(0), badCalls_(0),
+    denied_(0), trips_(0) {}
+
+DbBreaker* DbBreaker::Instance() {
+    static DbBreaker inst;
+    return &inst;
+}
+
+void DbBreaker::Init(bool enable) {
+    lock_guard<mutex> locker(mtx_);
+    enabled_ = enable;
+    Reset_();
+}
+
+DbBreaker::ADMIT DbBreaker::Admit() {
+    if(!enabled_) { return PASS; }
+    lock_guard<mutex> locker(mtx_);
+    if(state_ == CLOSED) { return PASS; }
+    Clock::time_point now = Clock::now();
+    if(state_ == HALF_OPEN && now >= probeUntil_) {
+        /* 探测请求迟迟没有报告结果, 不能一直拒绝下去, 当作失败并马上重新探测 */
+        LOG_WARN("DbBreaker probe lost, probe again");
+        state_ = OPEN;
+        openUntil_ = now;
+        trips_++;
+    }
+    if(state_ == OPEN && now >= openUntil_) {
+        /* 冷却结束, 只放这一个请求去试探 */
+        state_ = HALF_OPEN;
+        probeUntil_ = now + chrono::milliseconds(PROBE_MS);
+        LOG_INFO("DbBreaker half-open, probing");
+        return PROBE;
+    }
+    denied_++;
+    return DENY;
+}
+
+void DbBreaker::Record(ADMIT admit, bool ok, int costMS) {
+    if(!enabled_ || admit == DENY) { return; }
+    bool bad = !ok || costMS >= SLOW_MS;
+    lock_guard<mutex> locker(mtx_);
+    if(admit == PROBE) {
+        /* 超过期限才回来的探测请求, 新的探测已经有了结果, 不再改状态 */
+        if(state_ != HALF_OPEN) { return; }
+        if(bad) {
+            LOG_WARN("DbBreaker probe failed, open again");
+            Open_();
+        } else {
+            LOG_INFO("DbBreaker closed");
+            Reset_();
+        }
+        return;
+    }
+    /* 断开之前放行的请求, 结果已经没有意义 */
+    if(state_ != CLOSED) { return; }
+    if(calls_ == WINDOW) {
+        badCalls_ -= bad_[pos_];
+    } else {
+        calls_++;
+    }
+    bad_[pos_] = bad;
+    badCalls_ += bad;
+    pos_ = (pos_ + 1) % WINDOW;
+    if(calls_ >= MIN_CALLS && badCalls_ >= calls_ * FAIL_RATIO) {
+        LOG_WARN("DbBreaker open: %d of last %d calls failed or slow", badCalls_, calls_);
+        Open_();
+    }
+}
+
+DbBreaker::STATE DbBreaker::State() {
+    lock_guard<mutex> locker(mtx_);
+    return state_;
+}
+
+void DbBreaker::Open_() {
+    state_ = OPEN;
+    openUntil_ = Clock::now() + chrono::milliseconds(OPEN_MS);
+    trips_++;
+}
+
+void DbBreaker::Reset_() {
+    state_ = CLOSED;
+    pos_ = calls_ = badCalls_ = 0;
+    for(bool& bad: bad_) { bad = false; }
+}
@@ -0,0 +1,84 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-07-12
+ * @copyleft Apache 2.0
+ */
+#ifndef DB_BREAKER_H
+#define DB_BREAKER_H
+
+#include <mutex>
+#include <chrono>
+#include <atomic>
+#include "../log/log.h"
+
+/*
+ * 数据库访问的熔断器, 数据库慢或者挂掉时让登录/注册快速失败, 不再占着线程和连接等超时
+ * CLOSED: 正常放行, 记录最近WINDOW次访问的结果, 其中失败和慢(超过SLOW_MS)的比例达到FAIL_RATIO时断开
+ * OPEN: 全部拒绝, OPEN_MS之后放一个探测请求进入HALF_OPEN
+ * HALF_OPEN: 只有探测请求在访问数据库, 成功则恢复CLOSED, 失败则重新OPEN;
+ *            PROBE_MS内没有结果(探测请求丢失或者卡住)时算作失败, 再放一个探测请求
+ * 用法: Admit返回DENY时不访问数据库; 否则访问结束后用Record报告结果和耗时
+ */
+class DbBreaker {
+public:
+    enum STATE {
+        CLOSED,
+        OPEN,
+        HALF_OPEN,
+    };
+    enum ADMIT {
+        DENY,
+        PASS,
+        PROBE,  // 半开状态下的探测请求
+    };
+
+    static DbBreaker* Instance();
+
+    // 不启用时Admit总是返回PASS
+    void Init(bool enable);
+    bool Enabled() const { return enabled_; }
+
+    ADMIT Admit();
+    // ok为false表示数据库出错(连接不上、等连接超时、查询出错), 密码错误之类的业务失败算成功
+    void Record(ADMIT admit, bool ok, int costMS);
+
+    STATE State();
+    size_t Denied() const { return denied_; }
+    // 断开的次数
+    size_t Trips() const { return trips_; }
+
+    static const int WINDOW = 20;
+    // 窗口内至少有这么多次访问才判断
+    static const int MIN_CALLS = 10;
+    static constexpr double FAIL_RATIO = 0.5;
+    static const int SLOW_MS = 1000;
+    static const int OPEN_MS = 5000;
+    static const int PROBE_MS = OPEN_MS + SLOW_MS;
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    DbBreaker();
+    ~DbBreaker() = default;
+
+    // 调用时持有锁
+    void Open_();
+    void Reset_();
+
+    bool enabled_;
+    std::mutex mtx_;
+    STATE state_;
+    Clock::time_point openUntil_;
+    // 探测请求的结果最晚等到这时
+    Clock::time_point probeUntil_;
+    // 最近WINDOW次访问是否失败, 环形覆盖
+    bool bad_[WINDOW];
+    int pos_;
+    int calls_;
+    int badCalls_;
+
+    std::atomic<size_t> denied_;
+    std::atomic<size_t> trips_;
+};
+
+#endif //DB_BREAKER_H
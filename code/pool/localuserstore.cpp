@@ -0,0 +1,139 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-07-15
+ * @copyleft Apache 2.0
+ */
+#include "localuserstore.h"
+using namespace std;
+
+LocalUserStore::LocalUserStore(): fd_(-1), size_(0) {}
+
+LocalUserStore::~LocalUserStore() {
+    if(fd_ >= 0) { close(fd_); }
+}
+
+bool LocalUserStore::Open(const string& path) {
+    unique_lock<shared_mutex> locker(mtx_);
+    path_ = path;
+    fd_ = open(path_.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+    if(fd_ < 0) {
+        LOG_ERROR("UserStore open %s error: %d", path_.c_str(), errno);
+        return false;
+    }
+    bool ok = Load_(&size_);
+    /* 截掉末尾写到一半的记录, 之后的追加从完整的记录后面开始 */
+    if(ok && size_ < lseek(fd_, 0, SEEK_END)) {
+        LOG_WARN("UserStore %s: truncate incomplete record at %lld", path_.c_str(), (long long)size_);
+        if(ftruncate(fd_, size_) < 0) {
+            LOG_ERROR("UserStore truncate error: %d", errno);
+            ok = false;
+        }
+    }
+    if(!ok) {
+        /* 打开失败后Find/Insert都报错, 不能拿着只装入一部分的用户继续服务 */
+        close(fd_);
+        fd_ = -1;
+        users_.clear();
+        return false;
+    }
+    LOG_INFO("UserStore %s: %zu users", path_.c_str(), users_.size());
+    return true;
+}
+
+// pos处是一条完整的记录时返回它之后的偏移, 否则返回0
+size_t LocalUserStore::ParseRecord_(const string& data, size_t pos, size_t* nameLen, size_t* pwdLen) {
+    size_t eol = data.find('\n', pos);
+    if(eol == string::npos) { return 0; }
+    int consumed = 0;
+    string head = data.substr(pos, eol - pos);
+    if(sscanf(head.c_str(), "%zu %zu%n", nameLen, pwdLen, &consumed) != 2 ||
+       consumed != static_cast<int>(head.size())) {
+        return 0;
+    }
+    size_t body = eol + 1;
+    /* 内容后面还有一个换行 */
+    if(*nameLen > data.size() || *pwdLen > data.size() ||
+       body + *nameLen + *pwdLen >= data.size() || data[body + *nameLen + *pwdLen] != '\n') {
+        return 0;
+    }
+    return body + *nameLen + *pwdLen + 1;
+}
+
+// 解析不了的记录后面再没有完整的记录, 才是写到一半时进程退出留下的; 否则是文件损坏, 不能截掉后面的用户
+bool LocalUserStore::Load_(off_t* end) {
+    string data;
+    char buf[65536];
+    lseek(fd_, 0, SEEK_SET);
+    while(true) {
+        ssize_t len = read(fd_, buf, sizeof(buf));
+        if(len == 0) { break; }
+        if(len < 0) {
+            if(errno == EINTR) { continue; }
+            LOG_ERROR("UserStore %s read error: %d", path_.c_str(), errno);
+            return false;
+        }
+        data.append(buf, len);
+    }
+    size_t pos = 0, nameLen, pwdLen;
+    while(pos < data.size()) {
+        size_t next = ParseRecord_(data, pos, &nameLen, &pwdLen);
+        if(next == 0) { break; }
+        size_t body = data.find('\n', pos) + 1;
+        users_[data.substr(body, nameLen)] = data.substr(body + nameLen, pwdLen);
+        pos = next;
+    }
+    for(size_t eol = data.find('\n', pos); eol != string::npos; eol = data.find('\n', eol + 1)) {
+        if(ParseRecord_(data, eol + 1, &nameLen, &pwdLen) != 0) {
+            LOG_ERROR("UserStore %s: corrupted record at %zu", path_.c_str(), pos);
+            return false;
+        }
+    }
+    *end = pos;
+    return true;
+}
+
+bool LocalUserStore::Find(const string& name, UserRecord* rec) {
+    shared_lock<shared_mutex> locker(mtx_);
+    if(fd_ < 0) { return false; }
+    auto it = users_.find(name);
+    rec->found = it != users_.end();
+    rec->pwd = rec->found ? it->second : string();
+    return true;
+}
+
+UserStore::INSERT_RESULT LocalUserStore::Insert(const string& name, const string& pwd) {
+    unique_lock<shared_mutex> locker(mtx_);
+    if(fd_ < 0) { return FAILED; }
+    if(users_.count(name)) { return EXISTS; }
+    string record = to_string(name.size()) + " " + to_string(pwd.size()) + "\n" + name + pwd + "\n";
+    if(!Append_(record)) { return FAILED; }
+    users_[name] = pwd;
+    return INSERTED;
+}
+
+// 写入失败时把文件截回原来的长度, 不留下半条记录
+bool LocalUserStore::Append_(const string& record) {
+    size_t written = 0;
+    while(written < record.size()) {
+        ssize_t len = write(fd_, record.data() + written, record.size() - written);
+        if(len < 0) {
+            if(errno == EINTR) { continue; }
+            break;
+        }
+        written += len;
+    }
+    if(written < record.size() || fdatasync(fd_) < 0) {
+        LOG_ERROR("UserStore %s write error: %d", path_.c_str(), errno);
+        if(ftruncate(fd_, size_) < 0) {
+            LOG_ERROR("UserStore truncate error: %d", errno);
+        }
+        return false;
+    }
+    size_ += record.size();
+    return true;
+}
+
+size_t LocalUserStore::Count() {
+    shared_lock<shared_mutex> locker(mtx_);
+    return users_.size();
+}
@@ -0,0 +1,50 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-07-15
+ * @copyleft Apache 2.0
+ */
+#ifndef LOCAL_USER_STORE_H
+#define LOCAL_USER_STORE_H
+
+#include <unordered_map>
+#include <string>
+#include <shared_mutex>
+#include <fcntl.h>       // open()
+#include <unistd.h>      // write() close()
+#include "userstore.h"
+#include "../log/log.h"
+
+/*
+ * 进程内的用户存储, 不需要数据库服务(测试、压测和小规模部署)
+ * 全部用户在内存哈希表里, 查询只加读锁; 新用户追加到数据文件末尾, 写入并fdatasync之后才算注册成功
+ * 每条记录: "<用户名长度> <密码长度>\n<用户名><密码>\n", 启动时顺序读入, 同名的后一条覆盖前一条
+ * 末尾不完整的记录(写到一半时进程退出)在打开时截掉; 中间有损坏的记录或者读文件出错时打开失败, 不改动文件
+ */
+class LocalUserStore : public UserStore {
+public:
+    LocalUserStore();
+    ~LocalUserStore();
+
+    // 打开(不存在时创建)数据文件并装入全部用户, 失败时返回false
+    bool Open(const std::string& path);
+
+    bool Find(const std::string& name, UserRecord* rec) override;
+    INSERT_RESULT Insert(const std::string& name, const std::string& pwd) override;
+    const char* Name() const override { return "local"; }
+
+    size_t Count();
+
+private:
+    // 从数据文件装入用户, *end是最后一条完整记录之后的偏移; 读出错或者文件中间损坏时返回false
+    bool Load_(off_t* end);
+    static size_t ParseRecord_(const std::string& data, size_t pos, size_t* nameLen, size_t* pwdLen);
+    bool Append_(const std::string& record);
+
+    std::string path_;
+    int fd_;
+    off_t size_;
+    std::shared_mutex mtx_;
+    std::unordered_map<std::string, std::string> users_;
+};
+
+#endif //LOCAL_USER_STORE_H
@@ -0,0 +1,223 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-07-15
+ * @copyleft Apache 2.0
+ */
+#include "mysqluserstore.h"
+using namespace std;
+
+const char MysqlUserStore::SELECT_SQL[] = "SELECT password FROM user WHERE username=? LIMIT 1";
+const char MysqlUserStore::INSERT_SQL[] = "INSERT INTO user(username, password) VALUES(?,?)";
+
+MYSQL_STMT* MysqlUserStore::Stmt_(SqlConnRAII& raii, const char* query) {
+    SqlStmtCache* stmts = raii.Stmts();
+    if(!stmts) {
+        LOG_ERROR("MySql no connection!");
+        return nullptr;
+    }
+    MYSQL_STMT* stmt = stmts->Get(query);
+    if(!stmt) {
+        LOG_ERROR("MySql prepare error: %s", mysql_error(stmts->Conn()));
+    }
+    return stmt;
+}
+
+// 参数直接引用字符串的内容, 不需要转义
+bool MysqlUserStore::BindParams_(MYSQL_STMT* stmt, Binds_* binds, const string& name, const string* pwd) {
+    const string* values[2] = { &name, pwd };
+    memset(binds->param, 0, sizeof(binds->param));
+    for(int i = 0; i < 2 && values[i]; i++) {
+        binds->paramLen[i] = values[i]->size();
+        binds->param[i].buffer_type = MYSQL_TYPE_STRING;
+        binds->param[i].buffer = const_cast<char*>(values[i]->data());
+        binds->param[i].buffer_length = values[i]->size();
+        binds->param[i].length = &binds->paramLen[i];
+    }
+    return !mysql_stmt_bind_param(stmt, binds->param);
+}
+
+bool MysqlUserStore::BindResult_(MYSQL_STMT* stmt, Binds_* binds) {
+    memset(binds->result, 0, sizeof(binds->result));
+    binds->pwdLen = 0;
+    binds->result[0].buffer_type = MYSQL_TYPE_STRING;
+    binds->result[0].buffer = binds->pwd;
+    binds->result[0].buffer_length = sizeof(binds->pwd);
+    binds->result[0].length = &binds->pwdLen;
+    return !mysql_stmt_bind_result(stmt, binds->result);
+}
+
+// 结果集已经整个取到客户端, 不会再访问网络
+// 密码比缓冲区长时pwdLen是实际长度, 用mysql_stmt_fetch_column重新取完整的值, 不会得到截断的记录
+bool MysqlUserStore::Fetch_(MYSQL_STMT* stmt, Binds_* binds, UserRecord* rec) {
+    rec->found = false;
+    rec->pwd.clear();
+    bool ok = true;
+    int ret;
+    while((ret = mysql_stmt_fetch(stmt)) == 0 || ret == MYSQL_DATA_TRUNCATED) {
+        rec->found = true;
+        if(ret == 0) {
+            rec->pwd.assign(binds->pwd, binds->pwdLen);
+            continue;
+        }
+        rec->pwd.resize(binds->pwdLen);
+        MYSQL_BIND column;
+        memset(&column, 0, sizeof(column));
+        column.buffer_type = MYSQL_TYPE_STRING;
+        column.buffer = &rec->pwd[0];
+        column.buffer_length = rec->pwd.size();
+        column.length = &binds->pwdLen;
+        if(mysql_stmt_fetch_column(stmt, &column, 0, 0)) { ok = false; }
+    }
+    if(ret != MYSQL_NO_DATA) { ok = false; }
+    if(!ok) { LOG_ERROR("MySql fetch error: %s", mysql_stmt_error(stmt)); }
+    mysql_stmt_free_result(stmt);
+    return ok;
+}
+
+bool MysqlUserStore::Find(const string& name, UserRecord* rec) {
+    MYSQL* sql;
+    SqlConnRAII raii(&sql, SqlConnPool::Instance());
+    MYSQL_STMT* stmt = Stmt_(raii, SELECT_SQL);
+    if(!stmt) { return false; }
+
+    Binds_ binds;
+    if(!BindParams_(stmt, &binds, name, nullptr) || !BindResult_(stmt, &binds) ||
+       mysql_stmt_execute(stmt) || mysql_stmt_store_result(stmt)) {
+        LOG_ERROR("MySql query error: %s", mysql_stmt_error(stmt));
+        mysql_stmt_free_result(stmt);
+        return false;
+    }
+    return Fetch_(stmt, &binds, rec);
+}
+
+// user表上没有唯一索引, 插入出错只能是数据库的问题
+UserStore::INSERT_RESULT MysqlUserStore::Insert(const string& name, const string& pwd) {
+    MYSQL* sql;
+    SqlConnRAII raii(&sql, SqlConnPool::Instance());
+    MYSQL_STMT* stmt = Stmt_(raii, INSERT_SQL);
+    if(!stmt) { return FAILED; }
+
+    Binds_ binds;
+    if(!BindParams_(stmt, &binds, name, &pwd) || mysql_stmt_execute(stmt)) {
+        LOG_ERROR("MySql insert error: %s", mysql_stmt_error(stmt));
+        return FAILED;
+    }
+    return INSERTED;
+}
+
+#ifdef MYSQL_WAIT_READ
+int MysqlUserStore::Start(Query* query, UserVerifyTask* task, MYSQL* sql) {
+    assert(task && task->NeedQuery());
+    query->task_ = task;
+    query->sql_ = sql;
+    query->stmts_ = sql ? SqlConnPool::Instance()->Stmts(sql) : nullptr;
+    query->stmt_ = nullptr;
+    query->step_ = Query::DONE;
+    if(!query->stmts_) {
+        LOG_ERROR("MySql no connection!");
+        task->Abort();
+        return 0;
+    }
+    LOG_INFO("Verify name:%s", task->Name().c_str());
+    /* UserCache给出了记录时直接从INSERT开始 */
+    if(task->NeedInsert()) {
+        LOG_DEBUG("regirster!");
+        query->step_ = Query::INSERT_PREPARE;
+    } else {
+        query->step_ = Query::SELECT_PREPARE;
+    }
+    int status = query->stmts_->PrepareStart(task->NeedInsert() ? INSERT_SQL : SELECT_SQL, &query->stmt_);
+    return Next_(query, status);
+}
+
+int MysqlUserStore::Continue(Query* query, int ready) {
+    int status = 0;
+    switch(query->step_) {
+    case Query::SELECT_PREPARE:
+    case Query::INSERT_PREPARE:
+        status = query->stmts_->PrepareCont(ready, &query->stmt_);
+        break;
+    case Query::SELECT:
+    case Query::INSERT:
+        status = mysql_stmt_execute_cont(&query->err_, query->stmt_, ready);
+        break;
+    case Query::STORE:
+        status = mysql_stmt_store_result_cont(&query->err_, query->stmt_, ready);
+        break;
+    default:
+        break;
+    }
+    return Next_(query, status);
+}
+
+void MysqlUserStore::Fail_(Query* query, const char* what) {
+    LOG_ERROR("MySql %s error: %s", what, query->stmt_ ? mysql_stmt_error(query->stmt_) : mysql_error(query->sql_));
+    if(query->stmt_) { mysql_stmt_free_result(query->stmt_); }
+    query->task_->Abort();
+    query->step_ = Query::DONE;
+}
+
+int MysqlUserStore::Next_(Query* query, int status) {
+    UserRecord rec;
+    while(status == 0) {
+        switch(query->step_) {
+        case Query::SELECT_PREPARE:
+            if(!query->stmt_) {
+                Fail_(query, "prepare");
+                break;
+            }
+            if(!BindParams_(query->stmt_, &query->binds_, query->task_->Name(), nullptr) ||
+               !BindResult_(query->stmt_, &query->binds_)) {
+                Fail_(query, "bind");
+                break;
+            }
+            query->step_ = Query::SELECT;
+            status = mysql_stmt_execute_start(&query->err_, query->stmt_);
+            break;
+        case Query::SELECT:
+            if(query->err_) {
+                Fail_(query, "query");
+                break;
+            }
+            query->step_ = Query::STORE;
+            status = mysql_stmt_store_result_start(&query->err_, query->stmt_);
+            break;
+        case Query::STORE:
+            if(query->err_ || !Fetch_(query->stmt_, &query->binds_, &rec)) {
+                Fail_(query, "store");
+                break;
+            }
+            LOG_DEBUG("MYSQL ROW: %s %s", query->task_->Name().c_str(), rec.found ? "found" : "none");
+            query->task_->Found(rec);
+            query->step_ = Query::DONE;
+            if(query->task_->NeedInsert()) {
+                LOG_DEBUG("regirster!");
+                query->step_ = Query::INSERT_PREPARE;
+                status = query->stmts_->PrepareStart(INSERT_SQL, &query->stmt_);
+            }
+            break;
+        case Query::INSERT_PREPARE:
+            if(!query->stmt_) {
+                Fail_(query, "prepare");
+                break;
+            }
+            if(!BindParams_(query->stmt_, &query->binds_, query->task_->Name(), &query->task_->Pwd())) {
+                Fail_(query, "bind");
+                break;
+            }
+            query->step_ = Query::INSERT;
+            status = mysql_stmt_execute_start(&query->err_, query->stmt_);
+            break;
+        case Query::INSERT:
+            /* user表上没有唯一索引, 插入出错是数据库的问题 */
+            if(query->err_) { LOG_ERROR("MySql insert error: %s", mysql_stmt_error(query->stmt_)); }
+            query->task_->Inserted(query->err_ ? FAILED : INSERTED);
+            query->step_ = Query::DONE;
+            break;
+        case Query::DONE:
+            return 0;
+        }
+    }
+    return status;
+}
+#endif
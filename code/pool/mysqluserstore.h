@@ -0,0 +1,89 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-07-15
+ * @copyleft Apache 2.0
+ */
+#ifndef MYSQL_USER_STORE_H
+#define MYSQL_USER_STORE_H
+
+#include <mysql/mysql.h>
+#include "userstore.h"
+#include "userverify.h"
+#include "sqlconnpool.h"
+#include "sqlconnRAII.h"
+
+/*
+ * 用户保存在MySQL的user表里, 用连接上缓存的预处理语句查询, 参数和结果都走二进制协议
+ * Find/Insert每次从SqlConnPool取一个连接阻塞执行
+ * MariaDB客户端有非阻塞接口(mysql_stmt_xxx_start/mysql_stmt_xxx_cont)时, Reactor取到连接后用Start/Continue分步验证:
+ *   (语句还没准备过时先准备) SELECT用户 -> 取结果集 -> (注册且用户名未被使用时) INSERT
+ * Start/Continue返回需要等待的事件(MYSQL_WAIT_READ/WRITE/EXCEPT/TIMEOUT), 0表示已经全部完成, 结果已经交给UserVerifyTask
+ * 调用者负责在连接的套接字(mysql_get_socket)上等待这些事件, 就绪后再调用Continue
+ */
+class MysqlUserStore : public UserStore {
+    // 参数: 用户名、密码; 结果: 密码
+    struct Binds_ {
+        MYSQL_BIND param[2];
+        unsigned long paramLen[2];
+        MYSQL_BIND result[1];
+        unsigned long pwdLen;
+        char pwd[256];
+    };
+
+public:
+    bool Find(const std::string& name, UserRecord* rec) override;
+    INSERT_RESULT Insert(const std::string& name, const std::string& pwd) override;
+    const char* Name() const override { return "mysql"; }
+
+#ifdef MYSQL_WAIT_READ
+    // 一次分步验证的状态, 由调用者持有, 结束前不能移动; 语句归连接的缓存所有, 不在这里关闭
+    class Query {
+    public:
+        Query(): task_(nullptr), sql_(nullptr), stmts_(nullptr), stmt_(nullptr), step_(DONE), err_(0) {}
+        MYSQL* Conn() const { return sql_; }
+
+    private:
+        friend class MysqlUserStore;
+        enum STEP {
+            SELECT_PREPARE,
+            SELECT,
+            STORE,
+            INSERT_PREPARE,
+            INSERT,
+            DONE,
+        };
+
+        UserVerifyTask* task_;
+        MYSQL* sql_;
+        SqlStmtCache* stmts_;
+        // 当前步骤使用的语句, 属于stmts_
+        MYSQL_STMT* stmt_;
+        STEP step_;
+        int err_;
+        Binds_ binds_;
+    };
+
+    // sql是SqlConnPool的连接, 等待连接超时时为nullptr, 这时task以DbError结束
+    int Start(Query* query, UserVerifyTask* task, MYSQL* sql);
+    int Continue(Query* query, int ready);
+#endif
+
+    static const char SELECT_SQL[];
+    static const char INSERT_SQL[];
+
+private:
+    // raii的连接上缓存的语句, 没有连接或者准备失败时返回nullptr
+    static MYSQL_STMT* Stmt_(SqlConnRAII& raii, const char* query);
+    // 绑定用户名(pwd不为空时还有密码)
+    static bool BindParams_(MYSQL_STMT* stmt, Binds_* binds, const std::string& name, const std::string* pwd);
+    static bool BindResult_(MYSQL_STMT* stmt, Binds_* binds);
+    // 取出SELECT的结果, 出错时返回false
+    static bool Fetch_(MYSQL_STMT* stmt, Binds_* binds, UserRecord* rec);
+#ifdef MYSQL_WAIT_READ
+    static void Fail_(Query* query, const char* what);
+    // 当前步骤完成(status为0)时推进到下一步, 直到需要等待或者全部完成
+    static int Next_(Query* query, int status);
+#endif
+};
+
+#endif //MYSQL_USER_STORE_H
@@ -21,6 +21,11 @@ public:
     ~SqlConnRAII() {
         if(sql_) { connpool_->FreeConn(sql_); }
     }
+
+    // 这个连接的预处理语句缓存, 没有取到连接时为nullptr
+    SqlStmtCache* Stmts() const {
+        return sql_ ? connpool_->Stmts(sql_) : nullptr;
+    }
     
 private:
     MYSQL *sql_;
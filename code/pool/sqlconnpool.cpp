@@ -2,14 +2,25 @@
  * @Author       : mark
  * @Date         : 2020-06-17
  * @copyleft Apache 2.0
- */ 
+ */
 
 #include "sqlconnpool.h"
 using namespace std;
 
+// 客户端与服务器断开的错误码(errmsg.h中的CR_SERVER_GONE_ERROR和CR_SERVER_LOST)
+static const unsigned int SERVER_GONE_ERROR = 2006;
+static const unsigned int SERVER_LOST = 2013;
+
 SqlConnPool::SqlConnPool() {
-    useCount_ = 0;
-    freeCount_ = 0;
+    port_ = 0;
+    minConn_ = maxConn_ = 0;
+    waitTimeoutMS_ = 0;
+    /* Init之前不提供连接 */
+    isClosed_ = true;
+    total_ = connecting_ = 0;
+    nextWaiterId_ = 0;
+    waits_ = timeouts_ = failures_ = created_ = closed_ = served_ = 0;
+    waitMsSum_ = maxWaitMs_ = 0;
 }
 // 返回一个静态的 SqlConnPool 对象，保证了整个应用程序中只有一个连接池实例。
 SqlConnPool* SqlConnPool::Instance() {
@@ -19,73 +30,373 @@ SqlConnPool* SqlConnPool::Instance() {
 
 void SqlConnPool::Init(const char* host, int port,
             const char* user,const char* pwd, const char* dbName,
-            int connSize = 10){
-    assert(connSize > 0);
-    // 初始化数据库连接池，创建指定数量的连接并放入连接队列
-    for (int i = 0; i < connSize; i++) {
-        MYSQL *sql = nullptr;
-        sql = mysql_init(sql);
-        if (!sql) {
-            LOG_ERROR("MySql init error!");
-            assert(sql);
-        }
-        sql = mysql_real_connect(sql, host,
-                                 user, pwd,
-                                 dbName, port, nullptr, 0);
-        if (!sql) {
-            LOG_ERROR("MySql Connect error!");
-        }
-        connQue_.push(sql);
+            int minConn, int maxConn, int waitTimeoutMS) {
+    assert(minConn > 0);
+    host_ = host;
+    port_ = port;
+    user_ = user;
+    pwd_ = pwd;
+    dbName_ = dbName;
+    minConn_ = minConn;
+    maxConn_ = std::max(minConn, maxConn);
+    waitTimeoutMS_ = waitTimeoutMS;
+    isClosed_ = false;
+    // 先建立minConn个连接, 失败的由后台线程稍后重试
+    for(int i = 0; i < minConn_; i++) {
+        MYSQL* conn = Connect_();
+        if(!conn) { break; }
+        lock_guard<mutex> locker(mtx_);
+        total_++;
+        created_++;
+        idle_.push_back({conn, Clock::now(), Clock::now()});
     }
-    // TODO：connSize使用原子类型，是不是可以达到信号的作用？难道开销会很大？
-    MAX_CONN_ = connSize;
-    // 用来限制并发链接的数量
-    // 信号地址 0表示进程中的线程共享，！0表示进程间共享 信号量初始值
-    sem_init(&semId_, 0, MAX_CONN_);
+    maintainer_ = thread(&SqlConnPool::Maintain_, this);
+    notifier_ = thread(&SqlConnPool::Notify_, this);
 }
 
-// 获取MYSQL连接
-MYSQL* SqlConnPool::GetConn() {
-    MYSQL *sql = nullptr;
-    if(connQue_.empty()){
-        LOG_WARN("SqlConnPool busy!");
+MYSQL* SqlConnPool::Connect_() {
+    MYSQL* sql = mysql_init(nullptr);
+    if(!sql) {
+        LOG_ERROR("MySql init error!");
         return nullptr;
     }
-    // 当获取可以连接时，信号量-1
-    sem_wait(&semId_);
-    {
+    // 服务器没有响应时不会一直阻塞(后台线程建立连接和ping, 同步查询)
+    unsigned int connectTimeout = CONNECT_TIMEOUT_S, ioTimeout = IO_TIMEOUT_S;
+    mysql_options(sql, MYSQL_OPT_CONNECT_TIMEOUT, &connectTimeout);
+    mysql_options(sql, MYSQL_OPT_READ_TIMEOUT, &ioTimeout);
+    mysql_options(sql, MYSQL_OPT_WRITE_TIMEOUT, &ioTimeout);
+#ifdef MYSQL_WAIT_READ
+    // MariaDB客户端: 连接之前打开非阻塞模式, 之后才能使用 *_start/*_cont 接口
+    mysql_options(sql, MYSQL_OPT_NONBLOCK, 0);
+#endif
+    if(!mysql_real_connect(sql, host_.c_str(), user_.c_str(), pwd_.c_str(),
+                           dbName_.c_str(), port_, nullptr, 0)) {
+        // 连接失败的句柄不放进池里
+        LOG_ERROR("MySql Connect error!");
+        mysql_close(sql);
         lock_guard<mutex> locker(mtx_);
-        sql = connQue_.front();
-        connQue_.pop();
+        failures_++;
+        return nullptr;
     }
+    lock_guard<mutex> locker(mtx_);
+    stmts_[sql].reset(new SqlStmtCache(sql));
     return sql;
 }
 
+// 关闭一个已经计入total_的连接, 语句要在连接关闭之前关闭
+void SqlConnPool::Close_(MYSQL* conn) {
+    unique_ptr<SqlStmtCache> stmts;
+    {
+        lock_guard<mutex> locker(mtx_);
+        auto it = stmts_.find(conn);
+        if(it != stmts_.end()) {
+            stmts = std::move(it->second);
+            stmts_.erase(it);
+        }
+        total_--;
+        closed_++;
+        maintainCond_.notify_one();
+    }
+    stmts.reset();
+    mysql_close(conn);
+}
+
+bool SqlConnPool::Broken_(MYSQL* conn) {
+    unsigned int err = mysql_errno(conn);
+    return err == SERVER_GONE_ERROR || err == SERVER_LOST;
+}
 
+// 获取MYSQL连接, 排队等待直到有连接归还、新建或者超时
+MYSQL* SqlConnPool::GetConn(int timeoutMS) {
+    struct Slot {
+        mutex mtx;
+        condition_variable cond;
+        bool done = false;
+        MYSQL* conn = nullptr;
+    };
+    auto slot = make_shared<Slot>();
+    uint64_t id;
+    Clock::time_point deadline;
+    {
+        lock_guard<mutex> locker(mtx_);
+        if(isClosed_) { return nullptr; }
+        if(!idle_.empty() && waiters_.empty()) {
+            MYSQL* conn = idle_.back().conn;
+            idle_.pop_back();
+            return conn;
+        }
+        if(timeoutMS < 0) { timeoutMS = waitTimeoutMS_; }
+        if(timeoutMS == 0) {
+            LOG_WARN("SqlConnPool busy!");
+            timeouts_++;
+            return nullptr;
+        }
+        Clock::time_point now = Clock::now();
+        id = nextWaiterId_++;
+        deadline = now + chrono::milliseconds(timeoutMS);
+        waiters_.push_back({id, [slot](MYSQL* conn) {
+            lock_guard<mutex> locker(slot->mtx);
+            slot->conn = conn;
+            slot->done = true;
+            slot->cond.notify_one();
+        }, now, deadline});
+        waits_++;
+        if(Wanted_() > 0) { maintainCond_.notify_one(); }
+    }
+    {
+        unique_lock<mutex> locker(slot->mtx);
+        if(slot->cond.wait_until(locker, deadline, [&slot] { return slot->done; })) {
+            return slot->conn;
+        }
+    }
+    /* 超时: 还在队列里就退出队列; 已经被取走时连接(或nullptr)马上就会交过来 */
+    bool expired = false;
+    {
+        lock_guard<mutex> locker(mtx_);
+        for(auto it = waiters_.begin(); it != waiters_.end(); ++it) {
+            if(it->id == id) {
+                waiters_.erase(it);
+                timeouts_++;
+                expired = true;
+                break;
+            }
+        }
+    }
+    if(expired) {
+        LOG_WARN("SqlConnPool wait timeout!");
+        return nullptr;
+    }
+    unique_lock<mutex> locker(slot->mtx);
+    slot->cond.wait(locker, [&slot] { return slot->done; });
+    return slot->conn;
+}
+
+void SqlConnPool::GetConnAsync(std::function<void(MYSQL*)> cb) {
+    MYSQL *sql = nullptr;
+    {
+        lock_guard<mutex> locker(mtx_);
+        if(!isClosed_) {
+            if(idle_.empty() || !waiters_.empty()) {
+                // 没有空闲连接, 等别的请求归还或者新建
+                Clock::time_point now = Clock::now();
+                waiters_.push_back({nextWaiterId_++, std::move(cb), now, now + chrono::milliseconds(waitTimeoutMS_)});
+                waits_++;
+                if(Wanted_() > 0) { maintainCond_.notify_one(); }
+                return;
+            }
+            sql = idle_.back().conn;
+            idle_.pop_back();
+        }
+    }
+    cb(sql);
+}
 
-// 释放连接
+// 释放连接, 已经与服务器断开的直接关闭
 void SqlConnPool::FreeConn(MYSQL* sql) {
     assert(sql);
-    lock_guard<mutex> locker(mtx_);
-    connQue_.push(sql);
-    // 释放连接时，信号量+1
-    sem_post(&semId_);
+    if(Broken_(sql)) {
+        LOG_WARN("MySql connection lost: %s", mysql_error(sql));
+        {
+            lock_guard<mutex> locker(mtx_);
+            failures_++;
+        }
+        Close_(sql);
+        return;
+    }
+    Release_(sql, Clock::now());
+}
+
+void SqlConnPool::Release_(MYSQL* conn, Clock::time_point checked, bool defer) {
+    Waiter_ waiter;
+    {
+        lock_guard<mutex> locker(mtx_);
+        if(!isClosed_) {
+            if(waiters_.empty()) {
+                idle_.push_back({conn, Clock::now(), checked});
+                return;
+            }
+            // 有请求在排队, 连接直接转交给它
+            waiter = std::move(waiters_.front());
+            waiters_.pop_front();
+            RecordWait_(waiter.since);
+            if(defer) {
+                ready_.emplace_back(std::move(waiter.cb), conn);
+                notifyCond_.notify_one();
+                return;
+            }
+        }
+    }
+    if(waiter.cb) {
+        waiter.cb(conn);
+    } else {
+        /* 连接池已经关闭 */
+        Close_(conn);
+    }
+}
+
+void SqlConnPool::RecordWait_(Clock::time_point since) {
+    double ms = chrono::duration<double, milli>(Clock::now() - since).count();
+    served_++;
+    waitMsSum_ += ms;
+    maxWaitMs_ = std::max(maxWaitMs_, ms);
+}
+
+// 补足minConn, 以及为排队的请求扩容(不超过maxConn)
+int SqlConnPool::Wanted_() const {
+    int deficit = minConn_ - total_ - connecting_;
+    int demand = std::min(static_cast<int>(waiters_.size()) - connecting_, maxConn_ - total_ - connecting_);
+    return std::max(std::max(deficit, demand), 0);
+}
+
+// 通知线程: 让排队超时的请求以nullptr回调, 执行后台线程交出的连接的回调
+void SqlConnPool::Notify_() {
+    unique_lock<mutex> locker(mtx_);
+    while(!isClosed_) {
+        if(ready_.empty()) {
+            notifyCond_.wait_for(locker, chrono::milliseconds(MAINTAIN_INTERVAL_MS));
+            if(isClosed_) { break; }
+        }
+        Clock::time_point now = Clock::now();
+        vector<function<void(MYSQL*)>> expired;
+        for(auto it = waiters_.begin(); it != waiters_.end();) {
+            if(it->deadline <= now) {
+                expired.push_back(std::move(it->cb));
+                it = waiters_.erase(it);
+                timeouts_++;
+            } else {
+                ++it;
+            }
+        }
+        deque<pair<function<void(MYSQL*)>, MYSQL*>> ready;
+        ready.swap(ready_);
+        if(expired.empty() && ready.empty()) { continue; }
+        locker.unlock();
+        if(!expired.empty()) { LOG_WARN("SqlConnPool wait timeout: %d", (int)expired.size()); }
+        for(auto& cb: expired) { cb(nullptr); }
+        for(auto& item: ready) { item.first(item.second); }
+        locker.lock();
+    }
 }
 
-// 关闭连接池
+// 后台线程: 建立连接、检查和收缩空闲连接, 交给排队请求的连接由通知线程回调
+void SqlConnPool::Maintain_() {
+    unique_lock<mutex> locker(mtx_);
+    Clock::time_point retryAt = Clock::now();
+    while(!isClosed_) {
+        maintainCond_.wait_for(locker, chrono::milliseconds(MAINTAIN_INTERVAL_MS));
+        if(isClosed_) { break; }
+        Clock::time_point now = Clock::now();
+        /* 新建连接, 失败后隔一段时间再试 */
+        while(!isClosed_ && now >= retryAt && Wanted_() > 0) {
+            connecting_++;
+            locker.unlock();
+            MYSQL* conn = Connect_();
+            locker.lock();
+            connecting_--;
+            if(!conn) {
+                retryAt = Clock::now() + chrono::milliseconds(RETRY_INTERVAL_MS);
+                break;
+            }
+            total_++;
+            created_++;
+            locker.unlock();
+            Release_(conn, Clock::now(), true);
+            locker.lock();
+        }
+        /* 最冷的空闲连接在队头: 空闲太久且多于minConn时关闭, 太久没确认过时ping一次 */
+        while(!isClosed_ && !idle_.empty()) {
+            Idle_ item = idle_.front();
+            now = Clock::now();
+            bool close = total_ > minConn_ && now - item.since >= chrono::milliseconds(IDLE_TIMEOUT_MS);
+            bool ping = now - item.checked >= chrono::milliseconds(PING_INTERVAL_MS);
+            if(!close && !ping) { break; }
+            idle_.pop_front();
+            if(close) {
+                locker.unlock();
+                LOG_INFO("SqlConnPool shrink idle connection");
+                Close_(item.conn);
+            } else {
+                locker.unlock();
+                if(mysql_ping(item.conn) != 0) {
+                    LOG_WARN("MySql ping error: %s", mysql_error(item.conn));
+                    locker.lock();
+                    failures_++;
+                    locker.unlock();
+                    Close_(item.conn);
+                } else {
+                    locker.lock();
+                    if(waiters_.empty()) {
+                        /* 放回原来的位置, 空闲时间照旧计算; 后面的连接都比它热 */
+                        item.checked = Clock::now();
+                        idle_.push_front(item);
+                        break;
+                    }
+                    /* ping期间有请求开始排队 */
+                    locker.unlock();
+                    Release_(item.conn, Clock::now(), true);
+                }
+            }
+            locker.lock();
+        }
+    }
+}
+
+// 关闭连接池: 排队的请求(包括已经分到连接还没回调的)以nullptr回调, 空闲连接立即关闭, 使用中的连接归还时关闭
+// 回调在调用线程里执行, 返回之后连接池不再回调
 void SqlConnPool::ClosePool() {
-    lock_guard<mutex> locker(mtx_);
-    while(!connQue_.empty()) {
-        auto item = connQue_.front();
-        connQue_.pop();
-        mysql_close(item);
+    deque<Idle_> idle;
+    deque<Waiter_> waiters;
+    {
+        lock_guard<mutex> locker(mtx_);
+        if(isClosed_) { return; }
+        isClosed_ = true;
+    }
+    maintainCond_.notify_all();
+    notifyCond_.notify_all();
+    if(maintainer_.joinable()) { maintainer_.join(); }
+    if(notifier_.joinable()) { notifier_.join(); }
+    deque<pair<function<void(MYSQL*)>, MYSQL*>> ready;
+    {
+        lock_guard<mutex> locker(mtx_);
+        idle.swap(idle_);
+        waiters.swap(waiters_);
+        ready.swap(ready_);
+    }
+    for(auto& waiter: waiters) { waiter.cb(nullptr); }
+    for(auto& item: ready) {
+        Close_(item.second);
+        item.first(nullptr);
     }
-    mysql_library_end();        
+    for(auto& item: idle) { Close_(item.conn); }
+    mysql_library_end();
 }
-// 返回可用连接数量
+// 返回空闲连接数量
 int SqlConnPool::GetFreeConnCount() {
     lock_guard<mutex> locker(mtx_);
-    return connQue_.size();
+    return idle_.size();
+}
+
+SqlConnPool::Stats SqlConnPool::GetStats() {
+    lock_guard<mutex> locker(mtx_);
+    Stats stats;
+    stats.total = total_;
+    stats.idle = idle_.size();
+    stats.inUse = total_ - static_cast<int>(idle_.size());
+    stats.waiting = waiters_.size();
+    stats.waits = waits_;
+    stats.timeouts = timeouts_;
+    stats.failures = failures_;
+    stats.created = created_;
+    stats.closed = closed_;
+    stats.avgWaitMs = served_ ? waitMsSum_ / served_ : 0;
+    stats.maxWaitMs = maxWaitMs_;
+    return stats;
+}
+
+SqlStmtCache* SqlConnPool::Stmts(MYSQL* conn) {
+    lock_guard<mutex> locker(mtx_);
+    auto it = stmts_.find(conn);
+    return it == stmts_.end() ? nullptr : it->second.get();
 }
 
 SqlConnPool::~SqlConnPool() {
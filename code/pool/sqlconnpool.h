@@ -2,48 +2,138 @@
  * @Author       : mark
  * @Date         : 2020-06-16
  * @copyleft Apache 2.0
- */ 
+ */
 #ifndef SQLCONNPOOL_H
 #define SQLCONNPOOL_H
 
 #include <mysql/mysql.h>
 #include <string>
-#include <queue>
+#include <deque>
 #include <mutex>
-#include <semaphore.h>
+#include <condition_variable>
 #include <thread>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <unordered_map>
+#include <memory>
 #include "../log/log.h"
+#include "sqlstmtcache.h"
 
+/*
+ * 数据库连接池: 连接数在[minConn, maxConn]之间伸缩
+ * 空闲连接按归还顺序后进先出, 常用的连接一直是热的, 冷的连接沉到队头, 空闲超过IDLE_TIMEOUT_MS且多于minConn时关闭
+ * 取不到空闲连接的请求(同步和异步)按先来后到排队, 归还的连接直接交给队头; 排队的请求多于正在建立的连接且没到maxConn时扩容
+ * 后台线程负责建立连接(扩容、补足minConn、替换坏掉的连接)、定期ping空闲连接和关闭多余的空闲连接, 这些都可能阻塞,
+ * 每个连接都设置了连接和读写超时; 另一个通知线程让等待超时的异步请求失败, 并执行后台线程交出的连接的回调,
+ * 异步回调不会被建立连接和ping拖住; 同步请求自己等到截止时间, 超时后退出队列
+ * 归还时连接报告与服务器断开(CR_SERVER_GONE_ERROR/CR_SERVER_LOST)的直接关闭, 由后台线程重新建立
+ */
 class SqlConnPool {
 public:
+    // 运行计数, 用于日志和监控
+    struct Stats {
+        int total;          // 已建立的连接(含使用中)
+        int idle;
+        int inUse;
+        int waiting;        // 排队中的请求
+        size_t waits;       // 需要排队的次数
+        size_t timeouts;    // 排队超时的次数
+        size_t failures;    // 连接失败、ping失败和归还时已断开的次数
+        size_t created;
+        size_t closed;
+        double avgWaitMs;   // 排队请求的平均等待时间
+        double maxWaitMs;
+    };
+
     static SqlConnPool *Instance();
 
-    MYSQL *GetConn();
+    // 等待timeoutMS毫秒, <0时使用Init设置的等待时间; 超时或者连接池没有启用时返回nullptr
+    MYSQL *GetConn(int timeoutMS = -1);
+    // 不阻塞地获取连接: 有空闲连接时立即回调, 否则排队, 等有连接归还时在归还的线程里回调, 新建时在通知线程里回调
+    // 连接池没有启用或者等待超时时以nullptr回调
+    void GetConnAsync(std::function<void(MYSQL*)> cb);
     void FreeConn(MYSQL * conn);
     int GetFreeConnCount();
+    Stats GetStats();
+    // 连接上缓存的预处理语句, 随连接一起由持有者独占使用
+    SqlStmtCache* Stmts(MYSQL* conn);
 
+    // maxConn<minConn时不扩容; waitTimeoutMS是取连接的默认等待时间
     void Init(const char* host, int port,
-              const char* user,const char* pwd, 
-              const char* dbName, int connSize);
+              const char* user,const char* pwd,
+              const char* dbName, int minConn, int maxConn = 0, int waitTimeoutMS = 3000);
     void ClosePool();
 
+    // 空闲连接多久没用就ping一次, 多久没用就关闭(保留minConn个)
+    static const int PING_INTERVAL_MS = 30000;
+    static const int IDLE_TIMEOUT_MS = 60000;
+    // 后台线程至少多久检查一次, 连接失败后多久再试
+    static const int MAINTAIN_INTERVAL_MS = 100;
+    static const int RETRY_INTERVAL_MS = 1000;
+    // 建立连接和每次读写服务器的超时(秒)
+    static const unsigned int CONNECT_TIMEOUT_S = 3;
+    static const unsigned int IO_TIMEOUT_S = 5;
+
 private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Idle_ {
+        MYSQL* conn;
+        Clock::time_point since;    // 归还的时间
+        Clock::time_point checked;  // 上次确认连接可用的时间
+    };
+    struct Waiter_ {
+        // 同步请求超时后按id退出队列
+        uint64_t id;
+        std::function<void(MYSQL*)> cb;
+        Clock::time_point since;
+        Clock::time_point deadline;
+    };
+
     SqlConnPool();
     ~SqlConnPool();
 
-    // 最大链接数
-    int MAX_CONN_;
-    // 使用链接
-    int useCount_;
-    // 空闲链接
-    int freeCount_;
+    MYSQL* Connect_();
+    void Close_(MYSQL* conn);
+    // 把可用的连接交给队头的请求, 没有请求时放回空闲队列; 调用时不持有锁
+    // defer为true时回调交给通知线程执行(后台线程不执行回调)
+    void Release_(MYSQL* conn, Clock::time_point checked, bool defer = false);
+    void Maintain_();
+    void Notify_();
+    // 需要新建的连接数, 调用时持有锁
+    int Wanted_() const;
+    void RecordWait_(Clock::time_point since);
+    static bool Broken_(MYSQL* conn);
+
+    std::string host_, user_, pwd_, dbName_;
+    int port_;
+    int minConn_;
+    int maxConn_;
+    int waitTimeoutMS_;
 
-    // 使用STL的queue创建的连接对象池
-    std::queue<MYSQL *> connQue_;
     std::mutex mtx_;
+    std::condition_variable maintainCond_;
+    std::condition_variable notifyCond_;
+    bool isClosed_;
+    // 已建立的连接数(空闲+使用中)和正在建立的连接数
+    int total_;
+    int connecting_;
+    std::deque<Idle_> idle_;
+    std::deque<Waiter_> waiters_;
+    uint64_t nextWaiterId_;
+    // 后台线程交出的连接, 由通知线程回调
+    std::deque<std::pair<std::function<void(MYSQL*)>, MYSQL*>> ready_;
+    // 每个连接的语句缓存, 连接关闭时一起删除
+    std::unordered_map<MYSQL*, std::unique_ptr<SqlStmtCache>> stmts_;
+    std::thread maintainer_;
+    std::thread notifier_;
 
-    sem_t semId_;
+    size_t waits_, timeouts_, failures_, created_, closed_;
+    // 排到连接的请求数和等待时间
+    size_t served_;
+    double waitMsSum_, maxWaitMs_;
 };
 
 
-#endif // SQLCONNPOOL_H
\ No newline at end of file
+#endif // SQLCONNPOOL_H
@@ -0,0 +1,96 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-07-09
+ * @copyleft Apache 2.0
+ */
+#include "sqlstmtcache.h"
+using namespace std;
+
+SqlStmtCache::SqlStmtCache(MYSQL* sql): sql_(sql) {
+    assert(sql_);
+#ifdef MYSQL_WAIT_READ
+    pendingQuery_ = nullptr;
+    pending_ = nullptr;
+    err_ = 0;
+#endif
+}
+
+SqlStmtCache::~SqlStmtCache() {
+    Clear();
+}
+
+MYSQL_STMT* SqlStmtCache::Find(const char* query) const {
+    for(auto& item: stmts_) {
+        if(item.first == query || strcmp(item.first, query) == 0) {
+            return item.second;
+        }
+    }
+    return nullptr;
+}
+
+MYSQL_STMT* SqlStmtCache::Get(const char* query) {
+    MYSQL_STMT* stmt = Find(query);
+    if(stmt) { return stmt; }
+    stmt = mysql_stmt_init(sql_);
+    if(!stmt) {
+        LOG_ERROR("MySql stmt init error!");
+        return nullptr;
+    }
+    return Add_(query, stmt, mysql_stmt_prepare(stmt, query, strlen(query)));
+}
+
+// 准备失败的语句不缓存, 下次使用时重新准备
+MYSQL_STMT* SqlStmtCache::Add_(const char* query, MYSQL_STMT* stmt, int err) {
+    if(err) {
+        LOG_ERROR("MySql prepare error: %s [%s]", mysql_stmt_error(stmt), query);
+        mysql_stmt_close(stmt);
+        return nullptr;
+    }
+    LOG_DEBUG("Prepared: %s", query);
+    stmts_.emplace_back(query, stmt);
+    return stmt;
+}
+
+#ifdef MYSQL_WAIT_READ
+int SqlStmtCache::PrepareStart(const char* query, MYSQL_STMT** stmt) {
+    assert(pending_ == nullptr);
+    *stmt = Find(query);
+    if(*stmt) { return 0; }
+    pending_ = mysql_stmt_init(sql_);
+    if(!pending_) {
+        LOG_ERROR("MySql stmt init error!");
+        return 0;
+    }
+    pendingQuery_ = query;
+    int status = mysql_stmt_prepare_start(&err_, pending_, query, strlen(query));
+    if(status == 0) { *stmt = FinishPrepare_(); }
+    return status;
+}
+
+int SqlStmtCache::PrepareCont(int ready, MYSQL_STMT** stmt) {
+    assert(pending_);
+    int status = mysql_stmt_prepare_cont(&err_, pending_, ready);
+    if(status == 0) { *stmt = FinishPrepare_(); }
+    return status;
+}
+
+MYSQL_STMT* SqlStmtCache::FinishPrepare_() {
+    MYSQL_STMT* stmt = Add_(pendingQuery_, pending_, err_);
+    pending_ = nullptr;
+    pendingQuery_ = nullptr;
+    return stmt;
+}
+#endif
+
+void SqlStmtCache::Clear() {
+#ifdef MYSQL_WAIT_READ
+    if(pending_) {
+        mysql_stmt_close(pending_);
+        pending_ = nullptr;
+    }
+#endif
+    for(auto& item: stmts_) {
+        mysql_stmt_close(item.second);
+    }
+    stmts_.clear();
+}
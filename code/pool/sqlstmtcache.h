@@ -0,0 +1,56 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-07-09
+ * @copyleft Apache 2.0
+ */
+#ifndef SQL_STMT_CACHE_H
+#define SQL_STMT_CACHE_H
+
+#include <mysql/mysql.h>
+#include <vector>
+#include <string.h>
+#include "../log/log.h"
+
+/*
+ * 一个数据库连接上已经准备好的语句(mysql_stmt_prepare), 每条SQL在每个连接上只准备一次
+ * 之后执行时只发送参数, 结果用二进制协议返回, 服务器不用再解析SQL; 参数不拼进SQL, 也就不用转义
+ * 按SQL文本查找(只保存指针, SQL必须是字符串常量), 语句不多, 顺序比较即可; 连接关闭前由连接池调用Clear关闭所有语句
+ * 只在持有这个连接的线程里使用, 不加锁
+ */
+class SqlStmtCache {
+public:
+    explicit SqlStmtCache(MYSQL* sql);
+    ~SqlStmtCache();
+
+    SqlStmtCache(const SqlStmtCache&) = delete;
+    SqlStmtCache& operator=(const SqlStmtCache&) = delete;
+
+    MYSQL* Conn() const { return sql_; }
+    // 已经准备好的语句, 没有时返回nullptr
+    MYSQL_STMT* Find(const char* query) const;
+    // 没有准备过就阻塞地准备, 失败时返回nullptr
+    MYSQL_STMT* Get(const char* query);
+#ifdef MYSQL_WAIT_READ
+    // 非阻塞地准备语句, 返回需要等待的事件, 0表示已经完成, 这时*stmt为准备好的语句(失败时为nullptr)
+    int PrepareStart(const char* query, MYSQL_STMT** stmt);
+    int PrepareCont(int ready, MYSQL_STMT** stmt);
+#endif
+    void Clear();
+
+private:
+    MYSQL_STMT* Add_(const char* query, MYSQL_STMT* stmt, int err);
+#ifdef MYSQL_WAIT_READ
+    MYSQL_STMT* FinishPrepare_();
+#endif
+
+    MYSQL* sql_;
+    std::vector<std::pair<const char*, MYSQL_STMT*>> stmts_;
+#ifdef MYSQL_WAIT_READ
+    // 正在准备的语句
+    const char* pendingQuery_;
+    MYSQL_STMT* pending_;
+    int err_;
+#endif
+};
+
+#endif //SQL_STMT_CACHE_H
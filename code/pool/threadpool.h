@@ -2,7 +2,7 @@
  * @Author       : mark
  * @Date         : 2020-06-15
  * @copyleft Apache 2.0
- */ 
+ */
 
 #ifndef THREADPOOL_H
 #define THREADPOOL_H
@@ -12,36 +12,27 @@
 #include <queue>
 #include <thread>
 #include <functional>
+#include <atomic>
+#include <vector>
+#include <memory>
+#include <assert.h>
+#include <stdint.h>
+
+/*
+ * 工作窃取线程池
+ * 每个工作线程有自己的无锁任务队列(有界多生产者多消费者环形队列, 每个槽带序号),
+ * AddTask按提交线程各自的轮转顺序分散到各个队列, 工作线程在池内提交时直接放进自己的队列
+ * 工作线程先取自己的队列, 空了再随机挑其他线程的队列窃取, 都取不到时先自旋一会儿再睡眠
+ * 提交任务时只有在确实有线程睡眠时才加锁唤醒; 队列满时放进加锁的溢出队列
+ */
 class ThreadPool {
 public:
-    explicit ThreadPool(size_t threadCount = 8): pool_(std::make_shared<Pool>()) {
+    explicit ThreadPool(size_t threadCount = 8): pool_(std::make_shared<Pool>(threadCount)) {
             assert(threadCount > 0);
-            // 循环创建线程，并且分离线程
+            // 循环创建线程，并且分离线程, 线程通过复制捕获的shared_ptr持有Pool
             for(size_t i = 0; i < threadCount; i++) {
-                // [pool = pool_] 这个部分就是定义了一个名为 pool 的局部变量，
-                // 并将其初始化为外部的 pool_ 变量的副本。这种捕获方式被称为“复制捕获”
-                // （它允许在 lambda 函数内部使用外部的变量 pool_ 的拷贝。
-                // 这个拷贝在 lambda 函数内部称为 pool，而 pool_ 仍然是外部线程池对象的原始引用。
-                // 通过对pool的加锁就可以避免外部直接使用pool_产生竞争
-                std::thread([pool = pool_] {
-                    // 在每个线程内创建了一个unique_lock互斥锁，使其进入临界状态
-                    std::unique_lock<std::mutex> locker(pool->mtx);
-                    while(true) {
-                        // 任务不为空，有任务要处理
-                        if(!pool->tasks.empty()) {
-                            // 使用move将任务移动到变量task里，减少拷贝
-                            auto task = std::move(pool->tasks.front());
-                            pool->tasks.pop();
-                            // 允许线程可以执行任务
-                            locker.unlock();
-                            task();
-                            // 任务结束重新获得锁，用来保证能正常从任务队列中取任务
-                            locker.lock();
-                        } 
-                        else if(pool->isClosed) break;
-                        // 让线程进入等待状态
-                        else pool->cond.wait(locker);
-                    }
+                std::thread([pool = pool_, i] {
+                    pool->Run(i);
                 }).detach();
             }
     }
@@ -49,44 +40,209 @@ public:
     ThreadPool() = default;
 
     ThreadPool(ThreadPool&&) = default;
-    
+
     ~ThreadPool() {
         // 判断线程池是否被创建
         if(static_cast<bool>(pool_)) {
             {
-                // 对线程池自身的锁加锁
                 std::lock_guard<std::mutex> locker(pool_->mtx);
                 pool_->isClosed = true;
             }
-            // 通知所有的线程确保他们退出，等所有线程完成任务后再销毁线程池
+            // 通知所有的线程确保他们退出，线程做完剩余的任务后再退出
             pool_->cond.notify_all();
         }
     }
     // 像线程池中添加任务
     template<class T>
     void AddTask(T&& task) {
-        {
-            // 自动释放锁
-            std::lock_guard<std::mutex> locker(pool_->mtx);
-            // emplace它用于在容器中构造一个元素，而不是像 push_back 或 insert 一样将一个已经构造好的元素复制或移动到容器中
-            // std::forward<F>(task) 是将传递给 AddTask 函数的任务函数 task 转发到 emplace 函数中。
-            // 这确保了在 emplace 中构造任务对象的过程中，使用了正确的参数类型和引用类型。
-            pool_->tasks.emplace(std::forward<T>(task));
-        }
-        pool_->cond.notify_one();
+        pool_->Push(std::forward<T>(task));
     }
 
 private:
+    typedef std::function<void()> Task;
+
+    // 有界多生产者多消费者队列(Vyukov), 序号 == pos 表示空槽, == pos + 1 表示有任务
+    class TaskRing {
+    public:
+        static const size_t CAPACITY = 4096;
+
+        TaskRing(): slots_(new Slot_[CAPACITY]), head_(0), tail_(0) {
+            for(size_t i = 0; i < CAPACITY; i++) {
+                slots_[i].seq.store(i, std::memory_order_relaxed);
+            }
+        }
+
+        template<class T>
+        bool TryPush(T&& task) {
+            size_t pos = tail_.load(std::memory_order_relaxed);
+            while(true) {
+                Slot_& slot = slots_[pos & (CAPACITY - 1)];
+                size_t seq = slot.seq.load(std::memory_order_acquire);
+                intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+                if(dif == 0) {
+                    if(tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                        slot.task = std::forward<T>(task);
+                        slot.seq.store(pos + 1, std::memory_order_release);
+                        return true;
+                    }
+                } else if(dif < 0) {
+                    return false;
+                } else {
+                    pos = tail_.load(std::memory_order_relaxed);
+                }
+            }
+        }
+
+        bool TryPop(Task& task) {
+            size_t pos = head_.load(std::memory_order_relaxed);
+            while(true) {
+                Slot_& slot = slots_[pos & (CAPACITY - 1)];
+                size_t seq = slot.seq.load(std::memory_order_acquire);
+                intptr_t dif = (intptr_t)seq - (intptr_t)(pos + 1);
+                if(dif == 0) {
+                    if(head_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                        task = std::move(slot.task);
+                        slot.task = nullptr;
+                        slot.seq.store(pos + CAPACITY, std::memory_order_release);
+                        return true;
+                    }
+                } else if(dif < 0) {
+                    return false;
+                } else {
+                    pos = head_.load(std::memory_order_relaxed);
+                }
+            }
+        }
+
+        bool Empty() const {
+            size_t pos = head_.load(std::memory_order_relaxed);
+            return slots_[pos & (CAPACITY - 1)].seq.load(std::memory_order_acquire) != pos + 1;
+        }
+
+    private:
+        struct Slot_ {
+            std::atomic<size_t> seq;
+            Task task;
+        };
+        std::unique_ptr<Slot_[]> slots_;
+        alignas(64) std::atomic<size_t> head_;
+        alignas(64) std::atomic<size_t> tail_;
+    };
+
     struct Pool {
+        // 睡眠前自旋尝试的轮数
+        static const int SPIN_COUNT = 64;
+
+        explicit Pool(size_t n): isClosed(false), sleepers(0), overflowSize(0), queues(n),
+            // 单核上自旋只会抢走提交线程的CPU
+            spinCount(std::thread::hardware_concurrency() > 1 ? SPIN_COUNT : 0) {
+            for(auto& q: queues) { q.reset(new TaskRing); }
+        }
+
+        // 当前线程所在的线程池和下标, 用来判断是不是池内提交
+        static Pool*& Current() { static thread_local Pool* pool = nullptr; return pool; }
+        static size_t& CurrentIndex() { static thread_local size_t index = 0; return index; }
+        // 池外提交线程各自轮转, 不共享计数器
+        static size_t& NextQueue() { static thread_local size_t next = 0; return next; }
+
+        template<class T>
+        void Push(T&& task) {
+            size_t n = queues.size();
+            size_t i;
+            if(Current() == this) {
+                i = CurrentIndex();
+            } else {
+                i = NextQueue()++ % n;
+            }
+            if(!queues[i]->TryPush(std::forward<T>(task))) {
+                std::lock_guard<std::mutex> locker(mtx);
+                overflow.emplace(std::forward<T>(task));
+                overflowSize.store(overflow.size(), std::memory_order_relaxed);
+            }
+            // 与Park_中的屏障配对: 要么这里看到有线程睡眠, 要么睡眠的线程在检查队列时看到这个任务
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if(sleepers.load(std::memory_order_relaxed) > 0) {
+                std::lock_guard<std::mutex> locker(mtx);
+                cond.notify_one();
+            }
+        }
+
+        bool TryGet(size_t self, Task& task, uint32_t& rand) {
+            if(queues[self]->TryPop(task)) { return true; }
+            // 随机选一个起点依次窃取
+            size_t n = queues.size();
+            rand ^= rand << 13; rand ^= rand >> 17; rand ^= rand << 5;
+            size_t start = rand % n;
+            for(size_t k = 0; k < n; k++) {
+                size_t victim = (start + k) % n;
+                if(victim != self && queues[victim]->TryPop(task)) { return true; }
+            }
+            if(overflowSize.load(std::memory_order_relaxed) == 0) { return false; }
+            std::lock_guard<std::mutex> locker(mtx);
+            if(!overflow.empty()) {
+                task = std::move(overflow.front());
+                overflow.pop();
+                overflowSize.store(overflow.size(), std::memory_order_relaxed);
+                return true;
+            }
+            return false;
+        }
+
+        bool Empty() {
+            for(auto& q: queues) {
+                if(!q->Empty()) { return false; }
+            }
+            return overflow.empty();
+        }
+
+        // 没有任务可做: 登记睡眠后再检查一遍所有队列, 确实为空才等待; 返回false表示线程池关闭
+        bool Park_() {
+            std::unique_lock<std::mutex> locker(mtx);
+            sleepers.fetch_add(1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            bool closed = false;
+            if(Empty()) {
+                if(isClosed) { closed = true; }
+                else { cond.wait(locker); }
+            }
+            sleepers.fetch_sub(1, std::memory_order_relaxed);
+            return !closed;
+        }
+
+        void Run(size_t self) {
+            Current() = this;
+            CurrentIndex() = self;
+            uint32_t rand = static_cast<uint32_t>(self * 2654435761u + 1);
+            Task task;
+            int idle = 0;
+            while(true) {
+                if(TryGet(self, task, rand)) {
+                    idle = 0;
+                    task();
+                    task = nullptr;
+                } else if(++idle < spinCount) {
+                    std::this_thread::yield();
+                } else {
+                    idle = 0;
+                    if(!Park_()) { break; }
+                }
+            }
+        }
+
         // 线程池自带锁可以保证锁的正常使用与释放，防止外部加锁而忘记解锁
         std::mutex mtx;
         std::condition_variable cond;
         bool isClosed;
-        // 任务队列
-        std::queue<std::function<void()>> tasks;
+        std::atomic<int> sleepers;
+        // 溢出队列长度, 不加锁就能判断是否为空
+        std::atomic<size_t> overflowSize;
+        std::vector<std::unique_ptr<TaskRing>> queues;
+        // 各队列都满时的溢出队列, 由mtx保护
+        std::queue<Task> overflow;
+        const int spinCount;
     };
     std::shared_ptr<Pool> pool_;
 };
 
 
-#endif //THREADPOOL_H
\ No newline at end of file
+#endif //THREADPOOL_H
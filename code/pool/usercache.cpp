@@ -0,0 +1,88 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-07-10
+ * @copyleft Apache 2.0
+ */
+#include "usercache.h"
+using namespace std;
+
+UserCache::UserCache(): capacity_(0), hits_(0), misses_(0), shared_(0) {}
+
+UserCache* UserCache::Instance() {
+    static UserCache inst;
+    return &inst;
+}
+
+void UserCache::Init(size_t capacity) {
+    lock_guard<mutex> locker(mtx_);
+    capacity_ = capacity;
+    lru_.clear();
+    index_.clear();
+}
+
+UserCache::LOOKUP UserCache::Lookup(const string& name, UserRecord* rec, Callback cb, bool needFound) {
+    if(!Enabled()) { return LEAD; }
+    lock_guard<mutex> locker(mtx_);
+    auto it = index_.find(name);
+    if(it != index_.end() && (it->second->second.found || !needFound)) {
+        /* 移到表头 */
+        lru_.splice(lru_.begin(), lru_, it->second);
+        *rec = it->second->second;
+        hits_++;
+        return HIT;
+    }
+    misses_++;
+    auto flight = inflight_.find(name);
+    if(flight != inflight_.end()) {
+        flight->second.push_back(std::move(cb));
+        shared_++;
+        return WAIT;
+    }
+    inflight_[name];
+    return LEAD;
+}
+
+void UserCache::Fill(const string& name, const UserRecord* rec) {
+    if(!Enabled()) { return; }
+    vector<Callback> waiters;
+    {
+        lock_guard<mutex> locker(mtx_);
+        auto flight = inflight_.find(name);
+        if(flight != inflight_.end()) {
+            waiters.swap(flight->second);
+            inflight_.erase(flight);
+        }
+        if(rec) {
+            Put_(name, *rec);
+        } else {
+            auto it = index_.find(name);
+            if(it != index_.end()) {
+                lru_.erase(it->second);
+                index_.erase(it);
+            }
+        }
+    }
+    for(auto& cb: waiters) {
+        cb(rec);
+    }
+}
+
+void UserCache::Put_(const string& name, const UserRecord& rec) {
+    auto it = index_.find(name);
+    if(it != index_.end()) {
+        it->second->second = rec;
+        lru_.splice(lru_.begin(), lru_, it->second);
+        return;
+    }
+    while(lru_.size() >= capacity_) {
+        index_.erase(lru_.back().first);
+        lru_.pop_back();
+    }
+    lru_.emplace_front(name, rec);
+    index_[name] = lru_.begin();
+}
+
+size_t UserCache::Count() {
+    lock_guard<mutex> locker(mtx_);
+    return lru_.size();
+}
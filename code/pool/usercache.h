@@ -0,0 +1,77 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-07-10
+ * @copyleft Apache 2.0
+ */
+#ifndef USER_CACHE_H
+#define USER_CACHE_H
+
+#include <unordered_map>
+#include <list>
+#include <vector>
+#include <string>
+#include <mutex>
+#include <functional>
+#include <atomic>
+#include "../log/log.h"
+
+// 数据库中一个用户名的查询结果, found为false表示没有这个用户
+struct UserRecord {
+    bool found;
+    std::string pwd;
+};
+
+/*
+ * 用户记录的读穿透缓存, 挡在登录/注册的SELECT前面
+ * 按用户名做LRU淘汰, 容量满了淘汰最久没用的记录; 没有这个用户的结果也缓存, 注册时更新或作废
+ * 同一个用户名同时只有一个请求(LEAD)去查数据库, 其他请求登记回调(WAIT), 查询结束后一起得到结果(singleflight)
+ * 回调在交回结果的线程里执行
+ */
+class UserCache {
+public:
+    enum LOOKUP {
+        HIT,    // 命中, 结果已经填好
+        WAIT,   // 已经有查询在进行, 结束后调用回调
+        LEAD,   // 调用者负责查询, 结束后用Fill交回结果
+    };
+    // rec为nullptr表示查询失败
+    typedef std::function<void(const UserRecord* rec)> Callback;
+
+    static UserCache* Instance();
+
+    // capacity为0时不缓存也不合并查询, Lookup总是返回LEAD
+    void Init(size_t capacity);
+    bool Enabled() const { return capacity_ > 0; }
+
+    // 只有返回WAIT时才保存cb; needFound为true时"没有这个用户"的记录不算命中(注册要自己去插入)
+    LOOKUP Lookup(const std::string& name, UserRecord* rec, Callback cb, bool needFound = false);
+    // LEAD的查询结束: rec不为空时缓存结果, 为空时作废旧的记录; 然后唤醒等待的请求
+    void Fill(const std::string& name, const UserRecord* rec);
+
+    size_t Hits() const { return hits_; }
+    size_t Misses() const { return misses_; }
+    // 合并到别的查询上的次数
+    size_t Shared() const { return shared_; }
+    size_t Count();
+
+private:
+    UserCache();
+    ~UserCache() = default;
+
+    // 调用时持有锁
+    void Put_(const std::string& name, const UserRecord& rec);
+
+    size_t capacity_;
+    std::mutex mtx_;
+    // 表头是最近使用的记录
+    std::list<std::pair<std::string, UserRecord>> lru_;
+    std::unordered_map<std::string, std::list<std::pair<std::string, UserRecord>>::iterator> index_;
+    // 正在查询的用户名 -> 等待结果的回调
+    std::unordered_map<std::string, std::vector<Callback>> inflight_;
+
+    std::atomic<size_t> hits_;
+    std::atomic<size_t> misses_;
+    std::atomic<size_t> shared_;
+};
+
+#endif //USER_CACHE_H
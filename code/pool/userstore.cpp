@@ -0,0 +1,8 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-07-15
+ * @copyleft Apache 2.0
+ */
+#include "userstore.h"
+
+std::unique_ptr<UserStore> UserStore::store_;
@@ -0,0 +1,41 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-07-15
+ * @copyleft Apache 2.0
+ */
+#ifndef USER_STORE_H
+#define USER_STORE_H
+
+#include <string>
+#include <memory>
+#include "usercache.h"
+
+/*
+ * 用户数据的存储后端, 登录/注册通过它查询和添加用户, 不关心数据放在哪里
+ * MysqlUserStore: 连接池里的MySQL; LocalUserStore: 进程内的哈希表, 持久化到只追加的数据文件
+ * Find/Insert都是阻塞调用, 可以在任意线程里并发调用; MysqlUserStore另外有给Reactor用的非阻塞接口(Start/Continue)
+ */
+class UserStore {
+public:
+    enum INSERT_RESULT {
+        INSERTED,
+        EXISTS,     // 用户名已被使用
+        FAILED,     // 存储出错
+    };
+
+    virtual ~UserStore() = default;
+
+    // 查到的结果写入rec(没有这个用户时found为false), 存储出错时返回false
+    virtual bool Find(const std::string& name, UserRecord* rec) = 0;
+    virtual INSERT_RESULT Insert(const std::string& name, const std::string& pwd) = 0;
+    virtual const char* Name() const = 0;
+
+    // 服务器使用的存储后端, Init接管store
+    static UserStore* Instance() { return store_.get(); }
+    static void Init(UserStore* store) { store_.reset(store); }
+
+private:
+    static std::unique_ptr<UserStore> store_;
+};
+
+#endif //USER_STORE_H
@@ -0,0 +1,113 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-07-02
+ * @copyleft Apache 2.0
+ */
+#include "userverify.h"
+using namespace std;
+
+// 用户名或密码为空时不用访问存储, 直接失败
+UserVerifyTask::UserVerifyTask(const string& name, const string& pwd, bool isLogin):
+    name_(name), pwd_(pwd), isLogin_(isLogin), step_(name.empty() || pwd.empty() ? DONE : FIND),
+    ok_(false), lead_(false), hasRecord_(false), insertFailed_(false), dbError_(false), record_{false, string()} {
+}
+
+// 注册只相信"用户已存在"的记录, 不存在时要自己查询并插入; 插入的请求也是LEAD, 同一个用户名同时只有一个请求在插入
+UserCache::LOOKUP UserVerifyTask::Lookup(UserCache::Callback cb) {
+    if(!NeedQuery()) { return UserCache::HIT; }
+    UserRecord rec;
+    UserCache::LOOKUP ret = UserCache::Instance()->Lookup(name_, &rec, std::move(cb), !isLogin_);
+    if(ret == UserCache::HIT) {
+        LOG_DEBUG("UserCache hit: %s", name_.c_str());
+        Resume(&rec);
+    }
+    lead_ = ret == UserCache::LEAD;
+    return ret;
+}
+
+bool UserVerifyTask::Resume(const UserRecord* rec) {
+    if(!rec) {
+        /* 别的请求查询失败, 结果同样不确定 */
+        Abort();
+        return true;
+    }
+    if(!isLogin_ && !rec->found) {
+        return false;
+    }
+    record_ = *rec;
+    hasRecord_ = true;
+    Decide_();
+    return true;
+}
+
+// 插入成功后就是新用户的记录; 插入失败时存储里的状态不确定, 作废缓存的记录
+void UserVerifyTask::Publish() const {
+    if(!lead_) { return; }
+    bool known = hasRecord_ && !insertFailed_;
+    UserRecord rec = record_;
+    if(known && !isLogin_ && ok_) {
+        rec = { true, pwd_ };
+    }
+    UserCache::Instance()->Fill(name_, known ? &rec : nullptr);
+}
+
+void UserVerifyTask::Reject() {
+    LOG_WARN("Verify name:%s rejected, database unavailable", name_.c_str());
+    Abort();
+}
+
+void UserVerifyTask::Abort() {
+    if(step_ == INSERT) { insertFailed_ = true; }
+    ok_ = false;
+    dbError_ = true;
+    step_ = DONE;
+}
+
+void UserVerifyTask::Found(const UserRecord& rec) {
+    record_ = rec;
+    hasRecord_ = true;
+    Decide_();
+}
+
+void UserVerifyTask::Inserted(UserStore::INSERT_RESULT ret) {
+    if(ret != UserStore::INSERTED) {
+        LOG_DEBUG("Insert error!");
+        ok_ = false;
+        insertFailed_ = true;
+        dbError_ = ret == UserStore::FAILED;
+    }
+    step_ = DONE;
+}
+
+// 登录: 用户存在且密码一致; 注册: 用户名未被使用, 接下来INSERT
+void UserVerifyTask::Decide_() {
+    if(isLogin_) {
+        ok_ = record_.found && record_.pwd == pwd_;
+        if(!ok_) { LOG_DEBUG("pwd error!"); }
+    } else {
+        ok_ = !record_.found;
+        if(!ok_) { LOG_DEBUG("user used!"); }
+    }
+    step_ = !isLogin_ && ok_ ? INSERT : DONE;
+}
+
+// 通过存储后端阻塞执行: 查询用户 -> (注册且用户名未被使用时) 添加用户
+bool UserVerifyTask::Run(UserStore* store) {
+    assert(store);
+    if(!NeedQuery()) { return ok_; }
+    LOG_INFO("Verify name:%s", name_.c_str());
+    if(step_ == FIND) {
+        UserRecord rec;
+        if(!store->Find(name_, &rec)) {
+            LOG_ERROR("UserStore %s find error", store->Name());
+            Abort();
+            return false;
+        }
+        Found(rec);
+    }
+    if(step_ == INSERT) {
+        LOG_DEBUG("regirster!");
+        Inserted(store->Insert(name_, pwd_));
+    }
+    return ok_;
+}
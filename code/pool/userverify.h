@@ -0,0 +1,78 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-07-02
+ * @copyleft Apache 2.0
+ */
+#ifndef USER_VERIFY_H
+#define USER_VERIFY_H
+
+#include <string>
+#include <assert.h>
+#include "../log/log.h"
+#include "usercache.h"
+#include "userstore.h"
+
+/*
+ * 一次登录/注册的验证: 查询用户 -> (注册且用户名未被使用时) 添加用户, 不关心用户保存在哪里
+ * 用Run通过UserStore阻塞执行; 存储后端也可以自己分步执行(MysqlUserStore::Start/Continue),
+ * 这时按NeedInsert查询或者插入, 结果用Found/Inserted交回, 出错时Abort
+ * 查询之前先用Lookup查UserCache: 命中或者等到别的请求的结果后, 登录和已被使用的用户名不用再访问存储(NeedQuery为false);
+ * 访问存储的任务结束后用Publish把结果交回UserCache
+ * 存储出错(没有连接、查询出错、被熔断拒绝)时DbError为true, 和用户名密码不对区分开
+ */
+class UserVerifyTask {
+public:
+    UserVerifyTask(const std::string& name, const std::string& pwd, bool isLogin);
+
+    // 通过存储后端阻塞执行还需要的步骤
+    bool Run(UserStore* store);
+
+    // 查UserCache, 返回HIT时记录已经用上; 返回WAIT时结果由cb交给Resume; 返回LEAD时由这个任务查询
+    UserCache::LOOKUP Lookup(UserCache::Callback cb);
+    // 等到的结果, rec为nullptr(别的请求查询失败)时这个任务也失败
+    // 注册请求等到"没有这个用户"时返回false, 需要重新Lookup, 由排在最前面的请求去插入
+    bool Resume(const UserRecord* rec);
+    // 结果还需要访问存储才能确定
+    bool NeedQuery() const { return step_ != DONE; }
+    // 任务结束后调用: LEAD交回查询结果并唤醒等待者
+    void Publish() const;
+    // 熔断器拒绝访问存储, 任务直接以DbError结束
+    void Reject();
+
+    // 分步执行时使用: NeedInsert为false时查询用户, 否则添加用户
+    const std::string& Name() const { return name_; }
+    const std::string& Pwd() const { return pwd_; }
+    bool NeedInsert() const { return step_ == INSERT; }
+    void Found(const UserRecord& rec);
+    void Inserted(UserStore::INSERT_RESULT ret);
+    // 存储出错, 以DbError结束
+    void Abort();
+
+    bool Result() const { return ok_; }
+    bool DbError() const { return dbError_; }
+
+private:
+    enum STEP {
+        FIND,
+        INSERT,
+        DONE,
+    };
+
+    // 根据record_确定结果和下一步
+    void Decide_();
+
+    std::string name_;
+    std::string pwd_;
+    bool isLogin_;
+
+    STEP step_;
+    bool ok_;
+    bool lead_;
+    // record_有效: 来自存储或者UserCache
+    bool hasRecord_;
+    bool insertFailed_;
+    bool dbError_;
+    UserRecord record_;
+};
+
+#endif //USER_VERIFY_H
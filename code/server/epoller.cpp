@@ -14,18 +14,18 @@ Epoller::~Epoller() {
     close(epollFd_);
 }
 
-bool Epoller::AddFd(int fd, uint32_t events) {
+bool Epoller::AddFd(int fd, uint32_t events, uint32_t gen) {
     if(fd < 0) return false;
     epoll_event ev = {0};
-    ev.data.fd = fd;
+    ev.data.u64 = Pack_(fd, gen);
     ev.events = events;
     return 0 == epoll_ctl(epollFd_, EPOLL_CTL_ADD, fd, &ev);
 }
 
-bool Epoller::ModFd(int fd, uint32_t events) {
+bool Epoller::ModFd(int fd, uint32_t events, uint32_t gen) {
     if(fd < 0) return false;
     epoll_event ev = {0};
-    ev.data.fd = fd;
+    ev.data.u64 = Pack_(fd, gen);
     ev.events = events;
     return 0 == epoll_ctl(epollFd_, EPOLL_CTL_MOD, fd, &ev);
 }
@@ -42,7 +42,12 @@ int Epoller::Wait(int timeoutMs) {
 
 int Epoller::GetEventFd(size_t i) const {
     assert(i < events_.size() && i >= 0);
-    return events_[i].data.fd;
+    return static_cast<int>(events_[i].data.u64 & 0xffffffff);
+}
+
+uint32_t Epoller::GetEventGen(size_t i) const {
+    assert(i < events_.size() && i >= 0);
+    return static_cast<uint32_t>(events_[i].data.u64 >> 32);
 }
 
 uint32_t Epoller::GetEvents(size_t i) const {
@@ -12,6 +12,7 @@
 #include <assert.h> // close()
 #include <vector>
 #include <errno.h>
+#include <stdint.h>
 
 class Epoller {
 public:
@@ -19,9 +20,10 @@ public:
 
     ~Epoller();
 
-    bool AddFd(int fd, uint32_t events);
+    // gen与fd一起放进epoll_data, 事件返回时用来识别已经关闭并被复用的描述符
+    bool AddFd(int fd, uint32_t events, uint32_t gen = 0);
 
-    bool ModFd(int fd, uint32_t events);
+    bool ModFd(int fd, uint32_t events, uint32_t gen = 0);
 
     bool DelFd(int fd);
 
@@ -29,9 +31,15 @@ public:
 
     int GetEventFd(size_t i) const;
 
+    uint32_t GetEventGen(size_t i) const;
+
     uint32_t GetEvents(size_t i) const;
         
 private:
+    static uint64_t Pack_(int fd, uint32_t gen) {
+        return (static_cast<uint64_t>(gen) << 32) | static_cast<uint32_t>(fd);
+    }
+
     int epollFd_;
 
     std::vector<struct epoll_event> events_;    
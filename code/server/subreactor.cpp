@@ -0,0 +1,533 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-17
+ * @copyleft Apache 2.0
+ */
+
+#include "subreactor.h"
+
+using namespace std;
+
+bool SubReactor::inlineStatic = false;
+
+SubReactor::SubReactor(int id, int port, bool optLinger, int timeoutMS,
+            uint32_t listenEvent, uint32_t connEvent, ThreadPool* threadpool):
+            id_(id), port_(port), openLinger_(optLinger), timeoutMS_(timeoutMS), isClose_(false),
+            listenFd_(-1), listenEvent_(listenEvent), connEvent_(connEvent), threadpool_(threadpool),
+            timer_(new Timer()), epoller_(new Epoller()), users_(MAX_FD)
+    {
+#ifdef MYSQL_WAIT_READ
+    dbPending_ = 0;
+    wakeFd_ = -1;
+#endif
+}
+
+SubReactor::~SubReactor() {
+    isClose_ = true;
+    if(listenFd_ >= 0) { close(listenFd_); }
+#ifdef MYSQL_WAIT_READ
+    if(wakeFd_ >= 0) { close(wakeFd_); }
+#endif
+}
+
+bool SubReactor::Init() {
+    if(!InitSocket_()) {
+        isClose_ = true;
+        return false;
+    }
+#ifdef MYSQL_WAIT_READ
+    wakeFd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(wakeFd_ < 0 || !epoller_->AddFd(wakeFd_, EPOLLIN)) {
+        LOG_ERROR("Reactor[%d] eventfd error: %d", id_, errno);
+        isClose_ = true;
+        return false;
+    }
+#endif
+    if(id_ == 0 && SessionStore::Instance()->Enabled()) {
+        timer_->add(SESSION_TIMER_ID, SessionStore::EXPIRE_INTERVAL_MS, [this] { ExpireSessions_(); });
+    }
+    return true;
+}
+
+void SubReactor::ExpireSessions_() {
+    size_t cnt = SessionStore::Instance()->Expire();
+    if(cnt > 0) { LOG_DEBUG("%zu sessions expired", cnt); }
+    timer_->add(SESSION_TIMER_ID, SessionStore::EXPIRE_INTERVAL_MS, [this] { ExpireSessions_(); });
+}
+
+void SubReactor::Loop() {
+    int timeMS = -1;  /* epoll wait timeout == -1 无事件将阻塞 */
+    if(!isClose_) { LOG_INFO("========== Reactor[%d] start ==========", id_); }
+    while(!isClose_) {
+        /* 没有定时器时返回-1 */
+        timeMS = timer_->GetNextTick();
+        int eventCnt = epoller_->Wait(timeMS);
+        for(int i = 0; i < eventCnt; i++) {
+            /* 处理事件 */
+            int fd = epoller_->GetEventFd(i);
+            uint32_t events = epoller_->GetEvents(i);
+            if(fd == listenFd_) {
+                DealListen_();
+            }
+#ifdef MYSQL_WAIT_READ
+            else if(fd == wakeFd_) {
+                DealDbReady_();
+            }
+            else if(dbPending_ > 0 && DealDb_(fd, events)) {
+                continue;
+            }
+#endif
+            else {
+                assert(fd >= 0 && fd < MAX_FD);
+                HttpConn* client = users_[fd].get();
+                if(!client || client->Gen() != epoller_->GetEventGen(i)) {
+                    /* 同一批事件里这个描述符已经被关闭或复用 */
+                    continue;
+                }
+                if(events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+                    CloseConn_(client);
+                }
+                else if(events & EPOLLIN) {
+                    DealRead_(client);
+                }
+                else if(events & EPOLLOUT) {
+                    DealWrite_(client);
+                } else {
+                    LOG_ERROR("Unexpected event");
+                }
+            }
+        }
+    }
+}
+
+void SubReactor::SendError_(int fd, const char*info) {
+    assert(fd > 0);
+    int ret = send(fd, info, strlen(info), 0);
+    if(ret < 0) {
+        LOG_WARN("send error to client[%d] error!", fd);
+    }
+    close(fd);
+}
+
+void SubReactor::CloseConn_(HttpConn* client) {
+    assert(client);
+    LOG_INFO("Client[%d] quit!", client->GetFd());
+#ifdef MYSQL_WAIT_READ
+    if(dbPending_ > 0) {
+        // 还在等数据库, 查询照常完成以便归还连接, 但不再处理这个请求
+        lock_guard<mutex> locker(dbMtx_);
+        auto it = verifying_.find(client);
+        if(it != verifying_.end()) {
+            it->second->client = nullptr;
+            verifying_.erase(it);
+        }
+    }
+#endif
+    epoller_->DelFd(client->GetFd());
+    client->Close();
+}
+
+void SubReactor::AddClient_(int fd, sockaddr_in addr) {
+    assert(fd > 0 && fd < MAX_FD);
+    if(!users_[fd]) { users_[fd].reset(new HttpConn()); }
+    HttpConn* client = users_[fd].get();
+    client->init(fd, addr);
+    uint32_t gen = client->Gen();
+    if(timeoutMS_ > 0) {
+        /* 超时前连接已经关闭(描述符可能被复用)时什么也不做 */
+        timer_->add(fd, timeoutMS_, [this, client, gen] {
+            if(client->Gen() == gen) { CloseConn_(client); }
+        });
+    }
+    epoller_->AddFd(fd, EPOLLIN | connEvent_, gen);
+    SetFdNonblock(fd);
+    LOG_INFO("Client[%d] in Reactor[%d]!", fd, id_);
+}
+
+void SubReactor::DealListen_() {
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    do {
+        int fd = accept(listenFd_, (struct sockaddr *)&addr, &len);
+        if(fd <= 0) { return;}
+        else if(HttpConn::userCount >= MAX_FD || fd >= MAX_FD) {
+            SendError_(fd, "Server busy!");
+            LOG_WARN("Clients is full!");
+            return;
+        }
+        AddClient_(fd, addr);
+    } while(listenEvent_ & EPOLLET);
+}
+
+// 有线程池时交给工作线程处理, 否则在本Reactor线程内直接处理
+void SubReactor::Submit_(HttpConn* client, void (SubReactor::*handler)(HttpConn*)) {
+    if(!threadpool_) {
+        (this->*handler)(client);
+        return;
+    }
+    uint32_t gen = client->Gen();
+    threadpool_->AddTask([this, client, gen, handler] {
+        if(client->Gen() == gen) { (this->*handler)(client); }
+    });
+}
+
+void SubReactor::DealRead_(HttpConn* client) {
+    assert(client);
+    ExtentTime_(client);
+    if(threadpool_ && inlineStatic) {
+        OnReadInline_(client);
+    } else {
+        Submit_(client, &SubReactor::OnRead_);
+    }
+}
+
+void SubReactor::DealWrite_(HttpConn* client) {
+    assert(client);
+    ExtentTime_(client);
+    Submit_(client, &SubReactor::OnWrite_);
+}
+
+void SubReactor::ExtentTime_(HttpConn* client) {
+    assert(client);
+    if(timeoutMS_ > 0) { timer_->adjust(client->GetFd(), timeoutMS_); }
+}
+
+void SubReactor::OnRead_(HttpConn* client) {
+    assert(client);
+    int ret = -1;
+    int readErrno = 0;
+    ret = client->read(&readErrno);
+    if(ret <= 0 && readErrno != EAGAIN) {
+        CloseConn_(client);
+        return;
+    }
+    OnProcess(client);
+}
+
+// 在Reactor线程内读取并应答命中缓存的请求, 省掉一次线程池调度(加锁、唤醒、切换线程)
+// 遇到需要查数据库或读磁盘的请求时, 它和之后的请求交给线程池处理
+void SubReactor::OnReadInline_(HttpConn* client) {
+    int readErrno = 0;
+    ssize_t ret = client->read(&readErrno);
+    if(ret <= 0 && readErrno != EAGAIN) {
+        CloseConn_(client);
+        return;
+    }
+    while(client->process(true)) {
+        if(!Flush_(client)) { return; }
+    }
+    if(client->HasPendingRequest()) {
+        Submit_(client, &SubReactor::OnProcess);
+    } else {
+        epoller_->ModFd(client->GetFd(), connEvent_ | EPOLLIN, client->Gen());
+    }
+}
+
+// 响应生成后直接在当前线程发送, 套接字缓冲区放得下的响应不用再等一次EPOLLOUT和一次线程池调度
+void SubReactor::OnProcess(HttpConn* client) {
+    while(client->process()) {
+        if(!Flush_(client)) { return; }
+    }
+    if(client->NeedVerify()) {
+        /* 查询期间不监听这个连接(EPOLLONESHOT已经摘掉), 完成后再由OnProcess重新注册 */
+        StartVerify_(client);
+    } else {
+        epoller_->ModFd(client->GetFd(), connEvent_ | EPOLLIN, client->Gen());
+    }
+}
+
+void SubReactor::StartVerify_(HttpConn* client) {
+    const HttpRequest& request = client->request();
+#ifdef MYSQL_WAIT_READ
+    /* MySQL存储在本Reactor里非阻塞地查询 */
+    MysqlUserStore* store = dynamic_cast<MysqlUserStore*>(UserStore::Instance());
+    if(store) {
+        auto task = std::make_shared<DbTask_>(client, store, request.GetPost("username"),
+                                              request.GetPost("password"), request.IsLogin());
+        {
+            lock_guard<mutex> locker(dbMtx_);
+            verifying_[client] = task;
+            dbPending_++;
+        }
+        LookupDbTask_(task);
+        return;
+    }
+#endif
+    /* 客户端库没有非阻塞接口或者使用本地存储, 在当前线程里阻塞查询 */
+    client->SetVerifyResult(HttpRequest::UserVerify(request.GetPost("username"),
+                                                    request.GetPost("password"), request.IsLogin()));
+    OnProcess(client);
+}
+
+#ifdef MYSQL_WAIT_READ
+// MariaDB客户端要等待的事件换成epoll事件
+uint32_t SubReactor::DbEvents_(int status) {
+    uint32_t events = 0;
+    if(status & MYSQL_WAIT_READ) { events |= EPOLLIN; }
+    if(status & MYSQL_WAIT_WRITE) { events |= EPOLLOUT; }
+    if(status & MYSQL_WAIT_EXCEPT) { events |= EPOLLPRI; }
+    return events;
+}
+
+// 先查用户缓存, 同一个用户名正在查询时等它的结果
+void SubReactor::LookupDbTask_(const std::shared_ptr<DbTask_>& task) {
+    if(task->verify.Lookup([this, task](const UserRecord* rec) { ResumeDbTask_(task, rec); }) != UserCache::WAIT) {
+        ContinueDbTask_(task);
+    }
+}
+
+// 等到了别的请求的查询结果, 在交回结果的线程里调用, 只更新查询本身, 后续处理交回本Reactor
+void SubReactor::ResumeDbTask_(const std::shared_ptr<DbTask_>& task, const UserRecord* rec) {
+    if(!task->verify.Resume(rec) &&
+       task->verify.Lookup([this, task](const UserRecord* rec) { ResumeDbTask_(task, rec); }) == UserCache::WAIT) {
+        return;
+    }
+    PostDbTask_(task, DbTask_::CONTINUE);
+}
+
+void SubReactor::PostDbTask_(const std::shared_ptr<DbTask_>& task, DbTask_::STEP step) {
+    task->step = step;
+    {
+        lock_guard<mutex> locker(readyMtx_);
+        dbReady_.push_back(task);
+    }
+    uint64_t one = 1;
+    if(write(wakeFd_, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        LOG_ERROR("Reactor[%d] wakeup error: %d", id_, errno);
+    }
+}
+
+void SubReactor::DealDbReady_() {
+    uint64_t cnt;
+    if(read(wakeFd_, &cnt, sizeof(cnt)) < 0 && errno != EAGAIN) {
+        LOG_ERROR("Reactor[%d] eventfd read error: %d", id_, errno);
+    }
+    std::vector<std::shared_ptr<DbTask_>> ready;
+    {
+        lock_guard<mutex> locker(readyMtx_);
+        ready.swap(dbReady_);
+    }
+    for(auto& task: ready) {
+        if(task->step == DbTask_::RUN) {
+            RunDbTask_(task);
+        } else {
+            ContinueDbTask_(task);
+        }
+    }
+}
+
+// 结果已经确定时直接结束, 否则取数据库连接查询; 熔断时直接失败
+// 从这里开始到FinishDbTask_都在本Reactor线程里执行
+void SubReactor::ContinueDbTask_(const std::shared_ptr<DbTask_>& task) {
+    if(task->verify.NeedQuery()) {
+        task->admit = DbBreaker::Instance()->Admit();
+        if(task->admit == DbBreaker::DENY) { task->verify.Reject(); }
+    }
+    if(!task->verify.NeedQuery()) {
+        FinishDbTask_(task);
+        return;
+    }
+    task->start = std::chrono::steady_clock::now();
+    /* 回调可能在归还连接的其他线程里执行, 连接交回本Reactor再开始查询 */
+    SqlConnPool::Instance()->GetConnAsync([this, task](MYSQL* sql) {
+        task->sql = sql;
+        PostDbTask_(task, DbTask_::RUN);
+    });
+}
+
+// 拿到数据库连接(等待超时时为空)后开始查询
+void SubReactor::RunDbTask_(const std::shared_ptr<DbTask_>& task) {
+    int status = task->store->Start(&task->query, &task->verify, task->sql);
+    WaitDb_(task, status, true);
+}
+
+// 查询还没结束时在数据库套接字上等待, 否则结束查询
+// 客户端库要求超时(MYSQL_WAIT_TIMEOUT)时按它给的时长挂定时器, 到期后告诉它已超时
+void SubReactor::WaitDb_(const std::shared_ptr<DbTask_>& task, int status, bool isNew) {
+    int fd = task->query.Conn() ? mysql_get_socket(task->query.Conn()) : -1;
+    /* 上一次等待的定时器作废: 序号变了, 提前触发也什么都不做 */
+    task->waitSeq++;
+    if(task->timed) {
+        task->timed = false;
+        timer_->doWork(fd);
+    }
+    if(status == 0) {
+        if(!isNew) {
+            {
+                lock_guard<mutex> locker(dbMtx_);
+                dbTasks_.erase(fd);
+            }
+            epoller_->DelFd(fd);
+        }
+        FinishDbTask_(task);
+        return;
+    }
+    /* 只等超时时事件为空, 套接字照样登记, 出错挂断仍会报告 */
+    if(isNew) {
+        /* 先登记再注册事件, 事件可能马上在Reactor线程里触发 */
+        {
+            lock_guard<mutex> locker(dbMtx_);
+            dbTasks_[fd] = task;
+        }
+        epoller_->AddFd(fd, DbEvents_(status) | EPOLLONESHOT);
+    } else {
+        epoller_->ModFd(fd, DbEvents_(status) | EPOLLONESHOT);
+    }
+    if(status & MYSQL_WAIT_TIMEOUT) {
+        uint32_t seq = task->waitSeq;
+        task->timed = true;
+        timer_->add(fd, mysql_get_timeout_value_ms(task->query.Conn()), [this, task, seq] {
+            if(task->waitSeq != seq) { return; }
+            task->timed = false;
+            WaitDb_(task, task->store->Continue(&task->query, MYSQL_WAIT_TIMEOUT), false);
+        });
+    }
+}
+
+// 数据库套接字上的事件, fd不是数据库套接字时返回false
+bool SubReactor::DealDb_(int fd, uint32_t events) {
+    std::shared_ptr<DbTask_> task;
+    {
+        lock_guard<mutex> locker(dbMtx_);
+        auto it = dbTasks_.find(fd);
+        if(it == dbTasks_.end()) { return false; }
+        task = it->second;
+    }
+    int ready = 0;
+    /* 出错时让客户端库自己去读写, 由它报告错误 */
+    if(events & (EPOLLIN | EPOLLHUP | EPOLLERR)) { ready |= MYSQL_WAIT_READ; }
+    if(events & (EPOLLOUT | EPOLLHUP | EPOLLERR)) { ready |= MYSQL_WAIT_WRITE; }
+    if(events & EPOLLPRI) { ready |= MYSQL_WAIT_EXCEPT; }
+    WaitDb_(task, task->store->Continue(&task->query, ready), false);
+    return true;
+}
+
+// 查询结束: 归还数据库连接, 恢复处理挂起的请求
+// 连接关闭和描述符复用都在本线程里进行, 代数检查之后连接不会再变
+void SubReactor::FinishDbTask_(const std::shared_ptr<DbTask_>& task) {
+    HttpConn* client;
+    {
+        lock_guard<mutex> locker(dbMtx_);
+        client = task->client;
+        if(client) { verifying_.erase(client); }
+        dbPending_--;
+    }
+    if(task->query.Conn()) {
+        SqlConnPool::Instance()->FreeConn(task->query.Conn());
+    }
+    if(task->admit != DbBreaker::DENY) {
+        auto cost = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - task->start);
+        DbBreaker::Instance()->Record(task->admit, !task->verify.DbError(), cost.count());
+    }
+    /* 更新用户缓存, 唤醒等这次查询结果的请求 */
+    task->verify.Publish();
+    if(!client || client->Gen() != task->gen) { return; }
+    client->SetVerifyResult(HttpRequest::VerifyResult(task->verify.Result(), task->verify.DbError()));
+    Submit_(client, &SubReactor::OnProcess);
+}
+#endif
+
+void SubReactor::OnWrite_(HttpConn* client) {
+    assert(client);
+    if(Flush_(client)) {
+        OnProcess(client);
+    }
+}
+
+// 发送写队列: 发完且是长连接时返回true; 没发完(EAGAIN或者LT模式下只写了一部分)时等EPOLLOUT;
+// 出错或短连接时关闭连接
+bool SubReactor::Flush_(HttpConn* client) {
+    int writeErrno = 0;
+    ssize_t ret = client->write(&writeErrno);
+    if(client->ToWriteBytes() == 0) {
+        /* 传输完成 */
+        if(client->IsKeepAlive()) {
+            return true;
+        }
+    }
+    else if(ret > 0 || writeErrno == EAGAIN) {
+        /* 继续传输 */
+        epoller_->ModFd(client->GetFd(), connEvent_ | EPOLLOUT, client->Gen());
+        return false;
+    }
+    CloseConn_(client);
+    return false;
+}
+
+/* Create listenFd */
+bool SubReactor::InitSocket_() {
+    int ret;
+    struct sockaddr_in addr;
+    if(port_ > 65535 || port_ < 1024) {
+        LOG_ERROR("Port:%d error!",  port_);
+        return false;
+    }
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port_);
+    struct linger optLinger = { 0 };
+    if(openLinger_) {
+        /* 优雅关闭: 直到所剩数据发送完毕或超时 */
+        optLinger.l_onoff = 1;
+        optLinger.l_linger = 1;
+    }
+
+    listenFd_ = socket(AF_INET, SOCK_STREAM, 0);
+    if(listenFd_ < 0) {
+        LOG_ERROR("Create socket error!", port_);
+        return false;
+    }
+
+    ret = setsockopt(listenFd_, SOL_SOCKET, SO_LINGER, &optLinger, sizeof(optLinger));
+    if(ret < 0) {
+        close(listenFd_);
+        LOG_ERROR("Init linger error!", port_);
+        return false;
+    }
+
+    int optval = 1;
+    /* 端口复用 */
+    /* 只有最后一个套接字会正常接收数据。 */
+    ret = setsockopt(listenFd_, SOL_SOCKET, SO_REUSEADDR, (const void*)&optval, sizeof(int));
+    if(ret == -1) {
+        LOG_ERROR("set socket setsockopt error !");
+        close(listenFd_);
+        return false;
+    }
+
+    /* 每个Reactor各自监听同一端口, 由内核按四元组哈希把新连接分散到各个监听套接字 */
+    ret = setsockopt(listenFd_, SOL_SOCKET, SO_REUSEPORT, (const void*)&optval, sizeof(int));
+    if(ret == -1) {
+        LOG_ERROR("set SO_REUSEPORT error !");
+        close(listenFd_);
+        return false;
+    }
+
+    ret = bind(listenFd_, (struct sockaddr *)&addr, sizeof(addr));
+    if(ret < 0) {
+        LOG_ERROR("Bind Port:%d error!", port_);
+        close(listenFd_);
+        return false;
+    }
+
+    ret = listen(listenFd_, 6);
+    if(ret < 0) {
+        LOG_ERROR("Listen port:%d error!", port_);
+        close(listenFd_);
+        return false;
+    }
+    ret = epoller_->AddFd(listenFd_,  listenEvent_ | EPOLLIN);
+    if(ret == 0) {
+        LOG_ERROR("Add listen error!");
+        close(listenFd_);
+        return false;
+    }
+    SetFdNonblock(listenFd_);
+    LOG_INFO("Reactor[%d] listen port:%d", id_, port_);
+    return true;
+}
+
+int SubReactor::SetFdNonblock(int fd) {
+    assert(fd > 0);
+    return fcntl(fd, F_SETFL, fcntl(fd, F_GETFD, 0) | O_NONBLOCK);
+}
@@ -0,0 +1,160 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-17
+ * @copyleft Apache 2.0
+ */
+#ifndef SUBREACTOR_H
+#define SUBREACTOR_H
+
+#include <unordered_map>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <fcntl.h>       // fcntl()
+#include <unistd.h>      // close()
+#include <sys/eventfd.h> // eventfd()
+#include <assert.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "epoller.h"
+#include "../log/log.h"
+#include "../timer/timer.h"
+#include "../pool/threadpool.h"
+#include "../http/httpconn.h"
+#include "../pool/sqlconnpool.h"
+#include "../pool/mysqluserstore.h"
+#include "../pool/dbbreaker.h"
+
+/*
+ * 从Reactor: 一个线程一个事件循环(one loop per thread)
+ * 每个SubReactor拥有自己的监听套接字(SO_REUSEPORT, 由内核在多个监听套接字间分发新连接)、
+ * Epoller、定时器(见timer.h)和连接表, 不同SubReactor之间不共享任何可变状态
+ * 连接表是按描述符下标的数组, 连接对象第一次用到时创建, 之后地址不变, 描述符复用时原地重新初始化;
+ * epoll事件、线程池任务和超时回调都带着连接的代数, 连接关闭或复用后旧的事件和任务直接丢弃
+ * threadpool为空时, 读写与报文处理直接在本线程内完成; inlineStatic为true时, 命中静态文件缓存的GET请求
+ * 也在本线程内读取、解析并应答, 只有需要查数据库或读磁盘的请求才交给线程池
+ * 登录/注册请求的数据库查询使用MariaDB客户端的非阻塞接口, 数据库连接的套接字也注册在本Epoller上,
+ * 请求在查询期间挂起, 查询完成后再继续处理, 工作线程不会阻塞在数据库上
+ * 连接池和用户缓存在其他线程里回调时只把查询放进本Reactor的就绪队列并写eventfd唤醒, 查询的推进、
+ * 结果的设置和请求的恢复都在本Reactor线程里完成
+ * 启用登录会话时, 0号Reactor的定时器周期性地清理过期会话(定时器id为SESSION_TIMER_ID, 不会与客户端描述符冲突)
+ */
+class SubReactor {
+public:
+    SubReactor(int id, int port, bool optLinger, int timeoutMS,
+               uint32_t listenEvent, uint32_t connEvent, ThreadPool* threadpool);
+
+    ~SubReactor();
+
+    bool Init();
+    void Loop();
+
+    // 有线程池时, 是否在Reactor线程内直接应答命中缓存的静态请求
+    static bool inlineStatic;
+
+private:
+    bool InitSocket_();
+    void AddClient_(int fd, sockaddr_in addr);
+
+    void DealListen_();
+    // 交给线程池或在本线程执行handler, 执行前连接已经关闭或复用就放弃
+    void Submit_(HttpConn* client, void (SubReactor::*handler)(HttpConn*));
+    void DealWrite_(HttpConn* client);
+    void DealRead_(HttpConn* client);
+
+    void SendError_(int fd, const char*info);
+    void ExtentTime_(HttpConn* client);
+    void CloseConn_(HttpConn* client);
+    // 清理过期会话并安排下一次清理
+    void ExpireSessions_();
+
+    void OnRead_(HttpConn* client);
+    void OnReadInline_(HttpConn* client);
+    void OnWrite_(HttpConn* client);
+    void OnProcess(HttpConn* client);
+    bool Flush_(HttpConn* client);
+
+    void StartVerify_(HttpConn* client);
+#ifdef MYSQL_WAIT_READ
+    struct DbTask_ {
+        // 放进就绪队列的原因: 查询结果还不确定需要继续 / 连接池交来了连接(或者等待超时)
+        enum STEP { CONTINUE, RUN };
+
+        DbTask_(HttpConn* conn, MysqlUserStore* store, const std::string& name, const std::string& pwd, bool isLogin):
+            client(conn), gen(conn->Gen()), verify(name, pwd, isLogin), store(store), admit(DbBreaker::DENY),
+            step(CONTINUE), sql(nullptr), waitSeq(0), timed(false) {}
+        // 查询期间连接被关闭时置空
+        HttpConn* client;
+        uint32_t gen;
+        UserVerifyTask verify;
+        // 由存储后端分步执行验证
+        MysqlUserStore* store;
+        MysqlUserStore::Query query;
+        // 熔断器放行时开始计时, 结束时报告结果; DENY表示没有访问数据库
+        DbBreaker::ADMIT admit;
+        std::chrono::steady_clock::time_point start;
+        STEP step;
+        // 连接池交来的连接(等待超时时为空), 在本Reactor线程里开始查询
+        MYSQL* sql;
+        // 每次等待加一, 超时定时器到期时核对, 不是同一次等待就什么都不做
+        uint32_t waitSeq;
+        // 这次等待是否挂了超时定时器(以数据库套接字为id)
+        bool timed;
+    };
+
+    static uint32_t DbEvents_(int status);
+    bool DealDb_(int fd, uint32_t events);
+    void LookupDbTask_(const std::shared_ptr<DbTask_>& task);
+    void ResumeDbTask_(const std::shared_ptr<DbTask_>& task, const UserRecord* rec);
+    void ContinueDbTask_(const std::shared_ptr<DbTask_>& task);
+    void RunDbTask_(const std::shared_ptr<DbTask_>& task);
+    // 可以在任意线程调用: 放进就绪队列并唤醒本Reactor
+    void PostDbTask_(const std::shared_ptr<DbTask_>& task, DbTask_::STEP step);
+    // 本Reactor线程: 取出就绪队列里的查询继续处理
+    void DealDbReady_();
+    void WaitDb_(const std::shared_ptr<DbTask_>& task, int status, bool isNew);
+    void FinishDbTask_(const std::shared_ptr<DbTask_>& task);
+#endif
+
+    static const int MAX_FD = 65536;
+    // 描述符0是标准输入, 不会是客户端连接
+    static const int SESSION_TIMER_ID = 0;
+
+    static int SetFdNonblock(int fd);
+
+    int id_;
+    int port_;
+    bool openLinger_;
+    int timeoutMS_;  /* 毫秒MS */
+    std::atomic<bool> isClose_;
+    int listenFd_;
+
+    uint32_t listenEvent_;
+    uint32_t connEvent_;
+
+    // 不归本对象所有, 可以为空
+    ThreadPool* threadpool_;
+    std::unique_ptr<Timer> timer_;
+    std::unique_ptr<Epoller> epoller_;
+    // 下标是描述符, 大小为MAX_FD
+    std::vector<std::unique_ptr<HttpConn>> users_;
+
+#ifdef MYSQL_WAIT_READ
+    // 数据库套接字 -> 查询, 正在验证的连接 -> 查询; 连接池可能在其他线程回调, 所以需要加锁
+    std::mutex dbMtx_;
+    std::unordered_map<int, std::shared_ptr<DbTask_>> dbTasks_;
+    std::unordered_map<HttpConn*, std::shared_ptr<DbTask_>> verifying_;
+    // 未完成的查询数, 为0时事件循环不用查dbTasks_
+    std::atomic<int> dbPending_;
+    // 其他线程交回来的查询, 由wakeFd_(eventfd)唤醒事件循环处理
+    std::mutex readyMtx_;
+    std::vector<std::shared_ptr<DbTask_>> dbReady_;
+    int wakeFd_;
+#endif
+};
+
+#endif //SUBREACTOR_H
@@ -12,9 +12,12 @@ WebServer::WebServer(
             int port, int trigMode, int timeoutMS, bool OptLinger,
             int sqlPort, const char* sqlUser, const  char* sqlPwd,
             const char* dbName, int connPoolNum, int threadNum,
-            bool openLog, int logLevel, int logQueSize):
+            bool openLog, int logLevel, int logQueSize, int loopNum,
+            bool sendFile, bool inlineStatic, bool gzip,
+            int sessionTTL, int userCacheSize, int connPoolMax, bool dbBreaker,
+            const char* userStore):
             port_(port), openLinger_(OptLinger), timeoutMS_(timeoutMS), isClose_(false),
-            timer_(new HeapTimer()), threadpool_(new ThreadPool(threadNum)), epoller_(new Epoller())
+            threadpool_(threadNum > 0 ? new ThreadPool(threadNum) : nullptr)
     {
     srcDir_ = getcwd(nullptr, 256);
     assert(srcDir_);
@@ -22,10 +25,44 @@ WebServer::WebServer(
     strncat(srcDir_, "/resources/", 16);
     HttpConn::userCount = 0;
     HttpConn::srcDir = srcDir_;
-    SqlConnPool::Instance()->Init("172.17.0.1", sqlPort, sqlUser, sqlPwd, dbName, connPoolNum);
+    HttpResponse::useSendfile = sendFile;
+    HttpResponse::useGzip = gzip;
+    SubReactor::inlineStatic = inlineStatic;
+    /* 在Reactor初始化之前, 0号Reactor据此安排清理会话的定时器 */
+    SessionStore::Instance()->Init(sessionTTL);
+    UserCache::Instance()->Init(userCacheSize > 0 ? userCacheSize : 0);
+    DbBreaker::Instance()->Init(dbBreaker);
+    /* 对端关闭后继续写会收到SIGPIPE, 默认动作会杀死进程; 忽略后由write返回EPIPE */
+    signal(SIGPIPE, SIG_IGN);
+    if(sendFile) {
+        /* 大文件交给sendfile, 缓存只保存小文件 */
+        FileCache::Instance()->Init(srcDir_, 64 << 20, HttpResponse::SENDFILE_MIN_SIZE - 1);
+    } else {
+        FileCache::Instance()->Init(srcDir_);
+    }
+    /* 缓存的文件连同压缩版本和响应头一起准备好 */
+    FileCache::Instance()->SetOnLoad(HttpResponse::PrepareFile);
+    if(userStore && *userStore) {
+        /* 用户保存在本地数据文件里, 不连接数据库 */
+        LocalUserStore* store = new LocalUserStore();
+        if(!store->Open(userStore)) { isClose_ = true; }
+        UserStore::Init(store);
+    } else {
+        /* 连接数在[connPoolNum, connPoolMax]之间伸缩 */
+        SqlConnPool::Instance()->Init("172.17.0.1", sqlPort, sqlUser, sqlPwd, dbName, connPoolNum, connPoolMax);
+        UserStore::Init(new MysqlUserStore());
+    }
 
     InitEventMode_(trigMode);
-    if(!InitSocket_()) { isClose_ = true;}
+    // loopNum <= 0 表示每个CPU核心一个事件循环
+    if(loopNum <= 0) {
+        loopNum = std::max(1u, std::thread::hardware_concurrency());
+    }
+    for(int i = 0; i < loopNum; i++) {
+        reactors_.emplace_back(new SubReactor(i, port_, openLinger_, timeoutMS_,
+                                              listenEvent_, connEvent_, threadpool_.get()));
+        if(!reactors_.back()->Init()) { isClose_ = true; }
+    }
 
     if(openLog) {
         Log::Instance()->init(logLevel, "./log", ".log", logQueSize);
@@ -38,16 +75,37 @@ WebServer::WebServer(
                             (connEvent_ & EPOLLET ? "ET": "LT"));
             LOG_INFO("LogSys level: %d", logLevel);
             LOG_INFO("srcDir: %s", HttpConn::srcDir);
-            LOG_INFO("SqlConnPool num: %d, ThreadPool num: %d", connPoolNum, threadNum);
+            LOG_INFO("FileCache capacity: %zuKB, sendfile: %s, gzip: %s",
+                            FileCache::Instance()->Capacity() >> 10, sendFile ? "true" : "false",
+                            gzip ? "true" : "false");
+            LOG_INFO("SqlConnPool num: %d-%d, ThreadPool num: %d, Reactor num: %d",
+                            connPoolNum, std::max(connPoolNum, connPoolMax), threadNum, loopNum);
+            LOG_INFO("Inline cached requests: %s", threadNum > 0 && inlineStatic ? "true" : "false");
+            LOG_INFO("Session TTL: %ds, UserCache capacity: %d", sessionTTL > 0 ? sessionTTL : 0,
+                            userCacheSize > 0 ? userCacheSize : 0);
+            LOG_INFO("UserStore: %s, DbBreaker: %s", UserStore::Instance()->Name(), dbBreaker ? "true" : "false");
         }
     }
 }
 
 WebServer::~WebServer() {
-    close(listenFd_);
     isClose_ = true;
-    free(srcDir_);
+    /* 先关闭连接池: 排队的异步请求在这里以nullptr回调, 回调会用到它们所在的Reactor */
+    SqlConnPool::Stats pool = SqlConnPool::Instance()->GetStats();
     SqlConnPool::Instance()->ClosePool();
+    reactors_.clear();
+    LOG_INFO("FileCache hits: %zu, misses: %zu, files: %zu, bytes: %zu",
+             FileCache::Instance()->Hits(), FileCache::Instance()->Misses(),
+             FileCache::Instance()->Count(), FileCache::Instance()->Bytes());
+    FileCache::Instance()->Close();
+    LOG_INFO("UserCache hits: %zu, misses: %zu, shared: %zu, users: %zu",
+             UserCache::Instance()->Hits(), UserCache::Instance()->Misses(),
+             UserCache::Instance()->Shared(), UserCache::Instance()->Count());
+    LOG_INFO("DbBreaker trips: %zu, denied: %zu", DbBreaker::Instance()->Trips(), DbBreaker::Instance()->Denied());
+    free(srcDir_);
+    LOG_INFO("SqlConnPool total: %d, waits: %zu, timeouts: %zu, failures: %zu, created: %zu, closed: %zu, wait avg: %.1fms, max: %.1fms",
+             pool.total, pool.waits, pool.timeouts, pool.failures, pool.created, pool.closed,
+             pool.avgWaitMs, pool.maxWaitMs);
 }
 
 void WebServer::InitEventMode_(int trigMode) {
@@ -76,207 +134,14 @@ void WebServer::InitEventMode_(int trigMode) {
 }
 
 void WebServer::Start() {
-    int timeMS = -1;  /* epoll wait timeout == -1 无事件将阻塞 */
-    if(!isClose_) { LOG_INFO("========== Server start =========="); }
-    while(!isClose_) {
-        if(timeoutMS_ > 0) {
-            timeMS = timer_->GetNextTick();
-        }
-        int eventCnt = epoller_->Wait(timeMS);
-        for(int i = 0; i < eventCnt; i++) {
-            /* 处理事件 */
-            int fd = epoller_->GetEventFd(i);
-            uint32_t events = epoller_->GetEvents(i);
-            if(fd == listenFd_) {
-                DealListen_();
-            }
-            else if(events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
-                assert(users_.count(fd) > 0);
-                CloseConn_(&users_[fd]);
-            }
-            else if(events & EPOLLIN) {
-                assert(users_.count(fd) > 0);
-                DealRead_(&users_[fd]);
-            }
-            else if(events & EPOLLOUT) {
-                assert(users_.count(fd) > 0);
-                DealWrite_(&users_[fd]);
-            } else {
-                LOG_ERROR("Unexpected event");
-            }
-        }
+    if(isClose_) { return; }
+    LOG_INFO("========== Server start ==========");
+    /* 其余Reactor各占一个线程, 第0个Reactor在当前线程运行 */
+    for(size_t i = 1; i < reactors_.size(); i++) {
+        loopThreads_.emplace_back(&SubReactor::Loop, reactors_[i].get());
     }
-}
-
-void WebServer::SendError_(int fd, const char*info) {
-    assert(fd > 0);
-    int ret = send(fd, info, strlen(info), 0);
-    if(ret < 0) {
-        LOG_WARN("send error to client[%d] error!", fd);
+    reactors_[0]->Loop();
+    for(auto& t: loopThreads_) {
+        t.join();
     }
-    close(fd);
 }
-
-void WebServer::CloseConn_(HttpConn* client) {
-    assert(client);
-    LOG_INFO("Client[%d] quit!", client->GetFd());
-    epoller_->DelFd(client->GetFd());
-    client->Close();
-}
-
-void WebServer::AddClient_(int fd, sockaddr_in addr) {
-    assert(fd > 0);
-    users_[fd].init(fd, addr);
-    if(timeoutMS_ > 0) {
-        timer_->add(fd, timeoutMS_, std::bind(&WebServer::CloseConn_, this, &users_[fd]));
-    }
-    epoller_->AddFd(fd, EPOLLIN | connEvent_);
-    SetFdNonblock(fd);
-    LOG_INFO("Client[%d] in!", users_[fd].GetFd());
-}
-
-void WebServer::DealListen_() {
-    struct sockaddr_in addr;
-    socklen_t len = sizeof(addr);
-    do {
-        int fd = accept(listenFd_, (struct sockaddr *)&addr, &len);
-        if(fd <= 0) { return;}
-        else if(HttpConn::userCount >= MAX_FD) {
-            SendError_(fd, "Server busy!");
-            LOG_WARN("Clients is full!");
-            return;
-        }
-        AddClient_(fd, addr);
-    } while(listenEvent_ & EPOLLET);
-}
-
-void WebServer::DealRead_(HttpConn* client) {
-    assert(client);
-    ExtentTime_(client);
-    threadpool_->AddTask(std::bind(&WebServer::OnRead_, this, client));
-}
-
-void WebServer::DealWrite_(HttpConn* client) {
-    assert(client);
-    ExtentTime_(client);
-    threadpool_->AddTask(std::bind(&WebServer::OnWrite_, this, client));
-}
-
-void WebServer::ExtentTime_(HttpConn* client) {
-    assert(client);
-    if(timeoutMS_ > 0) { timer_->adjust(client->GetFd(), timeoutMS_); }
-}
-
-void WebServer::OnRead_(HttpConn* client) {
-    assert(client);
-    int ret = -1;
-    int readErrno = 0;
-    ret = client->read(&readErrno);
-    if(ret <= 0 && readErrno != EAGAIN) {
-        CloseConn_(client);
-        return;
-    }
-    OnProcess(client);
-}
-
-void WebServer::OnProcess(HttpConn* client) {
-    if(client->process()) {
-        epoller_->ModFd(client->GetFd(), connEvent_ | EPOLLOUT);
-    } else {
-        epoller_->ModFd(client->GetFd(), connEvent_ | EPOLLIN);
-    }
-}
-
-void WebServer::OnWrite_(HttpConn* client) {
-    assert(client);
-    int ret = -1;
-    int writeErrno = 0;
-    ret = client->write(&writeErrno);
-    if(client->ToWriteBytes() == 0) {
-        /* 传输完成 */
-        if(client->IsKeepAlive()) {
-            OnProcess(client);
-            return;
-        }
-    }
-    else if(ret < 0) {
-        if(writeErrno == EAGAIN) {
-            /* 继续传输 */
-            epoller_->ModFd(client->GetFd(), connEvent_ | EPOLLOUT);
-            return;
-        }
-    }
-    CloseConn_(client);
-}
-
-/* Create listenFd */
-bool WebServer::InitSocket_() {
-    int ret;
-    struct sockaddr_in addr;
-    if(port_ > 65535 || port_ < 1024) {
-        LOG_ERROR("Port:%d error!",  port_);
-        return false;
-    }
-    addr.sin_family = AF_INET;
-    addr.sin_addr.s_addr = htonl(INADDR_ANY);
-    addr.sin_port = htons(port_);
-    struct linger optLinger = { 0 };
-    if(openLinger_) {
-        /* 优雅关闭: 直到所剩数据发送完毕或超时 */
-        optLinger.l_onoff = 1;
-        optLinger.l_linger = 1;
-    }
-
-    listenFd_ = socket(AF_INET, SOCK_STREAM, 0);
-    if(listenFd_ < 0) {
-        LOG_ERROR("Create socket error!", port_);
-        return false;
-    }
-
-    ret = setsockopt(listenFd_, SOL_SOCKET, SO_LINGER, &optLinger, sizeof(optLinger));
-    if(ret < 0) {
-        close(listenFd_);
-        LOG_ERROR("Init linger error!", port_);
-        return false;
-    }
-
-    int optval = 1;
-    /* 端口复用 */
-    /* 只有最后一个套接字会正常接收数据。 */
-    ret = setsockopt(listenFd_, SOL_SOCKET, SO_REUSEADDR, (const void*)&optval, sizeof(int));
-    if(ret == -1) {
-        LOG_ERROR("set socket setsockopt error !");
-        close(listenFd_);
-        return false;
-    }
-
-    ret = bind(listenFd_, (struct sockaddr *)&addr, sizeof(addr));
-    if(ret < 0) {
-        LOG_ERROR("Bind Port:%d error!", port_);
-        close(listenFd_);
-        return false;
-    }
-
-    ret = listen(listenFd_, 6);
-    if(ret < 0) {
-        LOG_ERROR("Listen port:%d error!", port_);
-        close(listenFd_);
-        return false;
-    }
-    ret = epoller_->AddFd(listenFd_,  listenEvent_ | EPOLLIN);
-    if(ret == 0) {
-        LOG_ERROR("Add listen error!");
-        close(listenFd_);
-        return false;
-    }
-    SetFdNonblock(listenFd_);
-    LOG_INFO("Server port:%d", port_);
-    return true;
-}
-
-int WebServer::SetFdNonblock(int fd) {
-    assert(fd > 0);
-    return fcntl(fd, F_SETFL, fcntl(fd, F_GETFD, 0) | O_NONBLOCK);
-}
-
-
@@ -6,22 +6,21 @@
 #ifndef WEBSERVER_H
 #define WEBSERVER_H
 
-#include <unordered_map>
-#include <fcntl.h>       // fcntl()
+#include <vector>
+#include <thread>
 #include <unistd.h>      // close()
 #include <assert.h>
-#include <errno.h>
-#include <sys/socket.h>
-#include <netinet/in.h>
-#include <arpa/inet.h>
+#include <signal.h>
 
-#include "epoller.h"
+#include "subreactor.h"
 #include "../log/log.h"
-#include "../timer/heaptimer.h"
 #include "../pool/sqlconnpool.h"
 #include "../pool/threadpool.h"
 #include "../pool/sqlconnRAII.h"
+#include "../pool/mysqluserstore.h"
+#include "../pool/localuserstore.h"
 #include "../http/httpconn.h"
+#include "../cache/filecache.h"
 
 class WebServer {
 public:
@@ -29,46 +28,30 @@ public:
         int port, int trigMode, int timeoutMS, bool OptLinger, 
         int sqlPort, const char* sqlUser, const  char* sqlPwd, 
         const char* dbName, int connPoolNum, int threadNum,
-        bool openLog, int logLevel, int logQueSize);
+        bool openLog, int logLevel, int logQueSize, int loopNum = 1,
+        bool sendFile = false, bool inlineStatic = false, bool gzip = false,
+        int sessionTTL = 0, int userCacheSize = 0, int connPoolMax = 0, bool dbBreaker = false,
+        const char* userStore = nullptr);
 
     ~WebServer();
     void Start();
 
 private:
-    bool InitSocket_(); 
     void InitEventMode_(int trigMode);
-    void AddClient_(int fd, sockaddr_in addr);
-  
-    void DealListen_();
-    void DealWrite_(HttpConn* client);
-    void DealRead_(HttpConn* client);
-
-    void SendError_(int fd, const char*info);
-    void ExtentTime_(HttpConn* client);
-    void CloseConn_(HttpConn* client);
-
-    void OnRead_(HttpConn* client);
-    void OnWrite_(HttpConn* client);
-    void OnProcess(HttpConn* client);
-
-    static const int MAX_FD = 65536;
-
-    static int SetFdNonblock(int fd);
 
     int port_;
     bool openLinger_;
     int timeoutMS_;  /* 毫秒MS */
     bool isClose_;
-    int listenFd_;
     char* srcDir_;
     
     uint32_t listenEvent_;
     uint32_t connEvent_;
    
-    std::unique_ptr<HeapTimer> timer_;
     std::unique_ptr<ThreadPool> threadpool_;
-    std::unique_ptr<Epoller> epoller_;
-    std::unordered_map<int, HttpConn> users_;
+    // 每个SubReactor运行在独立线程上, reactors_[0]运行在调用Start()的线程
+    std::vector<std::unique_ptr<SubReactor>> reactors_;
+    std::vector<std::thread> loopThreads_;
 };
 
 
@@ -16,14 +16,14 @@ void HeapTimer::SwapNode_(size_t i, size_t j) {
 
 void HeapTimer::siftup_(size_t i) {
     assert(i >= 0 && i < heap_.size());
-    size_t j = (i - 1) / 2;
-    while(j >= 0) {
+    /* size_t恒>=0, 原来的while(j >= 0)在i为0时会越界读取 */
+    while(i > 0) {
+        size_t j = (i - 1) / 2;
         // 保证i节点是最小的
         if(heap_[j] < heap_[i]) { break; }
         // 交换两个节点
         SwapNode_(i, j);
         i = j;
-        j = (i - 1) / 2;
     }
 }
 
@@ -114,10 +114,9 @@ void HeapTimer::tick() {
         if(std::chrono::duration_cast<MS>(node.expires - Clock::now()).count() > 0) { 
             break; 
         }
-        // 执行回调
-        node.cb();
-        // 清除时间戳里面的一个任务
+        // 先从堆中删除再执行回调, 回调里可以安全地增删定时器(包括以同一个id重新添加)
         pop();
+        node.cb();
     }
 }
 
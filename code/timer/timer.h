@@ -0,0 +1,18 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-17
+ * @copyleft Apache 2.0
+ */
+#ifndef TIMER_H
+#define TIMER_H
+
+/* 编译时选择定时器实现: 默认分层时间轮, 定义USE_HEAP_TIMER时使用小根堆 */
+#ifdef USE_HEAP_TIMER
+#include "heaptimer.h"
+typedef HeapTimer Timer;
+#else
+#include "timewheel.h"
+typedef TimeWheel Timer;
+#endif
+
+#endif //TIMER_H
@@ -0,0 +1,179 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-17
+ * @copyleft Apache 2.0
+ */
+#include "timewheel.h"
+
+TimeWheel::TimeWheel(): start_(std::chrono::steady_clock::now()), current_(0), count_(0) {
+    for(int i = 0; i < SLOT_NUM; i++) { slots_[i] = -1; }
+    nodes_.reserve(64);
+}
+
+int64_t TimeWheel::NowMs_() const {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - start_).count();
+}
+
+// 根据过期时间离current_的远近选择层和槽, 挂到槽链表头
+void TimeWheel::Link_(int id) {
+    Node_& node = nodes_[id];
+    int64_t expires = node.expires;
+    int64_t delta = expires - current_;
+    int slot;
+    if(delta < 0) {
+        // 已经过期, 放进马上要处理的槽
+        slot = current_ & (ROOT_SIZE - 1);
+    }
+    else if(delta < ROOT_SIZE) {
+        slot = expires & (ROOT_SIZE - 1);
+    }
+    else {
+        if(delta >= MAX_SPAN) {
+            // 超出最大跨度的先挂在最高层的最远处, 到时再重新挂
+            expires = current_ + MAX_SPAN - 1;
+            delta = MAX_SPAN - 1;
+        }
+        int level = 1;
+        while(delta >= ((int64_t)1 << (ROOT_BITS + level * LEVEL_BITS))) { level++; }
+        int shift = ROOT_BITS + (level - 1) * LEVEL_BITS;
+        slot = ROOT_SIZE + (level - 1) * LEVEL_SIZE + ((expires >> shift) & (LEVEL_SIZE - 1));
+    }
+    node.slot = slot;
+    node.prev = -1;
+    node.next = slots_[slot];
+    if(node.next >= 0) { nodes_[node.next].prev = id; }
+    slots_[slot] = id;
+}
+
+void TimeWheel::Unlink_(int id) {
+    Node_& node = nodes_[id];
+    assert(node.slot >= 0);
+    if(node.prev >= 0) { nodes_[node.prev].next = node.next; }
+    else { slots_[node.slot] = node.next; }
+    if(node.next >= 0) { nodes_[node.next].prev = node.prev; }
+    node.slot = -1;
+}
+
+// 把整个槽摘下来, 返回链表头
+int TimeWheel::Detach_(int slot) {
+    int head = slots_[slot];
+    slots_[slot] = -1;
+    return head;
+}
+
+// 把第level层当前的槽里的结点重新分配到低层, 该层下标为0时还要继续处理更高一层
+bool TimeWheel::Cascade_(int level) {
+    int shift = ROOT_BITS + (level - 1) * LEVEL_BITS;
+    int index = (current_ >> shift) & (LEVEL_SIZE - 1);
+    int id = Detach_(ROOT_SIZE + (level - 1) * LEVEL_SIZE + index);
+    while(id >= 0) {
+        int next = nodes_[id].next;
+        Link_(id);
+        id = next;
+    }
+    return index == 0;
+}
+
+// 处理current_这一毫秒
+void TimeWheel::Step_() {
+    int index = current_ & (ROOT_SIZE - 1);
+    if(index == 0) {
+        for(int level = 1; level < LEVELS && Cascade_(level); level++) {}
+    }
+    std::vector<TimeoutCallBack> expired;
+    int id = Detach_(index);
+    while(id >= 0) {
+        Node_& node = nodes_[id];
+        int next = node.next;
+        if(node.expires > current_) {
+            // adjust延后过的结点, 重新挂
+            Link_(id);
+        } else {
+            node.slot = -1;
+            count_--;
+            expired.push_back(std::move(node.cb));
+            node.cb = nullptr;
+        }
+        id = next;
+    }
+    current_++;
+    // 整批摘下后再回调, 回调里可以安全地增删定时器
+    for(auto& cb: expired) {
+        if(cb) { cb(); }
+    }
+}
+
+void TimeWheel::add(int id, int timeout, const TimeoutCallBack& cb) {
+    assert(id >= 0);
+    if(static_cast<size_t>(id) >= nodes_.size()) {
+        nodes_.resize(std::max(static_cast<size_t>(id) + 1, nodes_.size() * 2), {-1, -1, -1, 0, nullptr});
+    }
+    Node_& node = nodes_[id];
+    if(node.slot >= 0) {
+        Unlink_(id);
+    } else {
+        count_++;
+    }
+    node.expires = NowMs_() + timeout;
+    node.cb = cb;
+    Link_(id);
+}
+
+// 延后只改过期时间, 提前才需要挪动结点
+void TimeWheel::adjust(int id, int timeout) {
+    assert(static_cast<size_t>(id) < nodes_.size() && nodes_[id].slot >= 0);
+    Node_& node = nodes_[id];
+    int64_t expires = NowMs_() + timeout;
+    if(expires >= node.expires) {
+        node.expires = expires;
+        return;
+    }
+    Unlink_(id);
+    node.expires = expires;
+    Link_(id);
+}
+
+void TimeWheel::doWork(int id) {
+    /* 删除指定id结点，并触发回调函数 */
+    if(id < 0 || static_cast<size_t>(id) >= nodes_.size() || nodes_[id].slot < 0) {
+        return;
+    }
+    Unlink_(id);
+    count_--;
+    TimeoutCallBack cb = std::move(nodes_[id].cb);
+    nodes_[id].cb = nullptr;
+    if(cb) { cb(); }
+}
+
+void TimeWheel::clear() {
+    for(int i = 0; i < SLOT_NUM; i++) { slots_[i] = -1; }
+    nodes_.clear();
+    count_ = 0;
+}
+
+void TimeWheel::tick() {
+    int64_t now = NowMs_();
+    if(count_ == 0) {
+        // 空转时直接跳到当前时间
+        if(current_ <= now) { current_ = now + 1; }
+        return;
+    }
+    while(current_ <= now && count_ > 0) {
+        Step_();
+    }
+    if(count_ == 0 && current_ <= now) { current_ = now + 1; }
+}
+
+// 距离下一个非空槽(或下一次层间迁移)的毫秒数, -1表示没有定时器
+int TimeWheel::GetNextTick() {
+    tick();
+    if(count_ == 0) { return -1; }
+    int64_t now = NowMs_();
+    for(int64_t t = current_; ; t++) {
+        if(slots_[t & (ROOT_SIZE - 1)] >= 0 ||
+           (t > current_ && (t & (ROOT_SIZE - 1)) == 0)) {
+            return static_cast<int>(std::max<int64_t>(t - now, 0));
+        }
+    }
+}
@@ -0,0 +1,79 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-17
+ * @copyleft Apache 2.0
+ */
+#ifndef TIME_WHEEL_H
+#define TIME_WHEEL_H
+
+#include <vector>
+#include <functional>
+#include <assert.h>
+#include <chrono>
+#include <stdint.h>
+#include "../log/log.h"
+
+/*
+ * 分层时间轮, 与HeapTimer接口一致(add/adjust/doWork/tick/GetNextTick)
+ * 精度1ms, 第0层256个槽(256ms), 其余三层各64个槽, 每层跨度是下一层的64倍, 最远约18小时
+ * 结点按id(即fd)预先分配, 槽内是用下标串起来的双向链表, 添加/删除都是O(1)
+ * adjust只改过期时间不挪结点(延后过期是常态), 结点所在槽到期时发现还没过期再重新挂到新的槽里
+ * 同一个槽内到期的结点先整体摘下来再依次回调, 批量过期
+ */
+class TimeWheel {
+public:
+    typedef std::function<void()> TimeoutCallBack;
+
+    TimeWheel();
+
+    ~TimeWheel() { clear(); }
+
+    void adjust(int id, int newExpires);
+
+    void add(int id, int timeOut, const TimeoutCallBack& cb);
+
+    void doWork(int id);
+
+    void clear();
+
+    void tick();
+
+    int GetNextTick();
+
+    size_t size() const { return count_; }
+
+private:
+    struct Node_ {
+        int prev;
+        int next;
+        // 所在的槽, -1表示不在时间轮上
+        int slot;
+        // 过期时间(相对于start_的毫秒数)
+        int64_t expires;
+        TimeoutCallBack cb;
+    };
+
+    static const int LEVELS = 4;
+    static const int ROOT_BITS = 8;
+    static const int LEVEL_BITS = 6;
+    static const int ROOT_SIZE = 1 << ROOT_BITS;
+    static const int LEVEL_SIZE = 1 << LEVEL_BITS;
+    static const int SLOT_NUM = ROOT_SIZE + (LEVELS - 1) * LEVEL_SIZE;
+    static const int64_t MAX_SPAN = (int64_t)1 << (ROOT_BITS + (LEVELS - 1) * LEVEL_BITS);
+
+    int64_t NowMs_() const;
+    void Link_(int id);
+    void Unlink_(int id);
+    int Detach_(int slot);
+    bool Cascade_(int level);
+    void Step_();
+
+    std::chrono::steady_clock::time_point start_;
+    // 下一个要处理的毫秒
+    int64_t current_;
+    size_t count_;
+    int slots_[SLOT_NUM];
+    std::vector<Node_> nodes_;
+};
+
+#endif //TIME_WHEEL_H
@@ -0,0 +1,99 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-07-04
+ * @copyleft Apache 2.0
+ */
+#ifndef HDR_HISTOGRAM_H
+#define HDR_HISTOGRAM_H
+
+#include <vector>
+#include <stdint.h>
+#include <assert.h>
+
+/*
+ * HDR直方图: 3位有效数字, 记录1 ~ highest之间的整数(这里用微秒)
+ * 值按2的幂分桶, 每个桶再等分成1024个子桶, 所以任何量级的相对误差都不超过0.1%,
+ * 内存固定(约30个桶 * 1024个计数), 记录一次是几次位运算加一次自增
+ */
+class HdrHistogram {
+public:
+    explicit HdrHistogram(int64_t highest = 3600LL * 1000 * 1000): total_(0), max_(0), sum_(0) {
+        // 覆盖highest需要的桶数
+        int64_t smallestUntrackable = SUB_BUCKET_COUNT;
+        int buckets = 1;
+        while(smallestUntrackable <= highest) {
+            smallestUntrackable <<= 1;
+            buckets++;
+        }
+        highest_ = highest;
+        counts_.assign((buckets + 1) * SUB_BUCKET_HALF_COUNT, 0);
+    }
+
+    void Record(int64_t value) {
+        if(value < 0) { value = 0; }
+        if(value > highest_) { value = highest_; }
+        counts_[Index_(value)]++;
+        total_++;
+        sum_ += value;
+        if(value > max_) { max_ = value; }
+    }
+
+    void Merge(const HdrHistogram& other) {
+        assert(counts_.size() == other.counts_.size());
+        for(size_t i = 0; i < counts_.size(); i++) { counts_[i] += other.counts_[i]; }
+        total_ += other.total_;
+        sum_ += other.sum_;
+        if(other.max_ > max_) { max_ = other.max_; }
+    }
+
+    // 第percentile百分位的值(该子桶内的最大值)
+    int64_t ValueAtPercentile(double percentile) const {
+        if(total_ == 0) { return 0; }
+        int64_t target = static_cast<int64_t>(percentile / 100.0 * total_ + 0.5);
+        if(target < 1) { target = 1; }
+        int64_t cumulative = 0;
+        for(size_t i = 0; i < counts_.size(); i++) {
+            cumulative += counts_[i];
+            if(cumulative >= target) {
+                int64_t value = HighestEquivalent_(i);
+                return value < max_ ? value : max_;
+            }
+        }
+        return max_;
+    }
+
+    int64_t Count() const { return total_; }
+    int64_t Max() const { return max_; }
+    double Mean() const { return total_ ? static_cast<double>(sum_) / total_ : 0; }
+
+private:
+    static const int SUB_BUCKET_HALF_MAG = 10;
+    static const int64_t SUB_BUCKET_HALF_COUNT = 1 << SUB_BUCKET_HALF_MAG;
+    static const int64_t SUB_BUCKET_COUNT = SUB_BUCKET_HALF_COUNT * 2;
+    static const int64_t SUB_BUCKET_MASK = SUB_BUCKET_COUNT - 1;
+
+    static size_t Index_(int64_t value) {
+        int pow2Ceiling = 64 - __builtin_clzll(value | SUB_BUCKET_MASK);
+        int bucket = pow2Ceiling - (SUB_BUCKET_HALF_MAG + 1);
+        int64_t sub = value >> bucket;
+        return ((bucket + 1) << SUB_BUCKET_HALF_MAG) + (sub - SUB_BUCKET_HALF_COUNT);
+    }
+
+    static int64_t HighestEquivalent_(size_t index) {
+        int bucket = static_cast<int>(index >> SUB_BUCKET_HALF_MAG) - 1;
+        int64_t sub = (index & (SUB_BUCKET_HALF_COUNT - 1)) + SUB_BUCKET_HALF_COUNT;
+        if(bucket < 0) {
+            sub -= SUB_BUCKET_HALF_COUNT;
+            bucket = 0;
+        }
+        return (sub << bucket) + (static_cast<int64_t>(1) << bucket) - 1;
+    }
+
+    int64_t highest_;
+    int64_t total_;
+    int64_t max_;
+    int64_t sum_;
+    std::vector<int64_t> counts_;
+};
+
+#endif //HDR_HISTOGRAM_H
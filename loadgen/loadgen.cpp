@@ -0,0 +1,503 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-07-04
+ * @copyleft Apache 2.0
+ */
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <memory>
+#include <algorithm>
+#include <fstream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <signal.h>
+#include <netdb.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "histogram.h"
+
+/*
+ * HTTP/1.1压力测试工具
+ * 多线程, 每个线程一个epoll事件循环管理自己的一组长连接, 每个连接最多同时有depth个请求在途(流水线)
+ * 闭环模式(默认): 每完成一个请求立刻补发一个, 测最大吞吐
+ * 开环模式(-r): 按固定速率计划请求, 延迟从计划发送时间算起, 服务器变慢时排队的时间也计入延迟,
+ *              避免"协调遗漏"(coordinated omission)低估尾延迟
+ * 延迟记入HDR直方图(微秒), 结束后输出p50/p90/p99/p99.9等
+ */
+
+struct Options {
+    std::string host = "127.0.0.1";
+    int port = 80;
+    std::vector<std::string> paths;
+    int threads = 2;
+    int conns = 64;
+    int depth = 1;
+    double duration = 10;
+    // 总请求速率(每秒), 0表示闭环
+    double rate = 0;
+};
+
+static int64_t NowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+struct Conn {
+    int fd = -1;
+    // fd为-1(建立连接失败)时下一次重连的时间(ns)
+    int64_t retryAt = 0;
+    bool connecting = false;
+    // 是否监听了EPOLLOUT
+    bool wantOut = false;
+    // 待发送的请求数据
+    std::string out;
+    size_t outPos = 0;
+    // 在途请求的起始时间(ns), 按发送顺序
+    std::deque<int64_t> inflight;
+    // 下一个要发送的URL下标
+    size_t next = 0;
+
+    // 响应解析: 先攒响应头, 再跳过Content-length个字节的响应体
+    bool inBody = false;
+    std::string head;
+    size_t bodyLeft = 0;
+    bool closeAfter = false;
+    int status = 0;
+};
+
+class Worker {
+public:
+    Worker(const Options& opt, const sockaddr_in& addr, int id, int conns, double rate):
+        requests_(0), bytes_(0), errors_(0), connectErrors_(0), non2xx_(0), backlogMax_(0),
+        opt_(opt), addr_(addr), id_(id), rate_(rate), conns_(conns), rr_(0), broken_(0), epollFd_(-1) {
+        for(auto& path: opt.paths) {
+            reqs_.push_back("GET " + path + " HTTP/1.1\r\nHost: " + opt.host +
+                            "\r\nConnection: keep-alive\r\n\r\n");
+        }
+    }
+
+    void Run(int64_t start, int64_t end) {
+        epollFd_ = epoll_create1(0);
+        for(auto& c: conns_) { Connect_(c); }
+        int64_t interval = rate_ > 0 ? static_cast<int64_t>(1e9 / rate_) : 0;
+        int64_t nextSend = start;
+        // 发送间隔常常不到1毫秒, 用定时器文件描述符按纳秒精度唤醒, 不用忙等
+        int timerFd = -1;
+        if(interval > 0) {
+            timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+            struct epoll_event ev = {};
+            ev.events = EPOLLIN;
+            ev.data.u32 = TIMER_TAG;
+            epoll_ctl(epollFd_, EPOLL_CTL_ADD, timerFd, &ev);
+        }
+        struct epoll_event events[256];
+        while(true) {
+            int64_t now = NowNs();
+            if(now >= end) { break; }
+            int timeout = static_cast<int>((end - now) / 1000000) + 1;
+            if(broken_ > 0) {
+                Retry_(now);
+                if(broken_ > 0) { timeout = std::min(timeout, RETRY_MS); }
+            }
+            if(interval > 0) {
+                // 开环: 到点的请求进入积压队列, 再分给有空位的连接
+                while(nextSend <= now) {
+                    backlog_.push_back(nextSend);
+                    nextSend += interval;
+                }
+                if(backlog_.size() > backlogMax_) { backlogMax_ = backlog_.size(); }
+                Dispatch_();
+                struct itimerspec its = {};
+                its.it_value.tv_sec = nextSend / 1000000000;
+                its.it_value.tv_nsec = nextSend % 1000000000;
+                timerfd_settime(timerFd, TFD_TIMER_ABSTIME, &its, nullptr);
+            }
+            int n = epoll_wait(epollFd_, events, 256, timeout);
+            for(int i = 0; i < n; i++) {
+                if(events[i].data.u32 == TIMER_TAG) {
+                    uint64_t expirations;
+                    read(timerFd, &expirations, sizeof(expirations));
+                    continue;
+                }
+                Conn& c = conns_[events[i].data.u32];
+                if(events[i].events & (EPOLLERR | EPOLLHUP)) {
+                    if(c.connecting) {
+                        AbortConnect_(c);
+                    } else {
+                        Reset_(c);
+                    }
+                    continue;
+                }
+                if(events[i].events & EPOLLOUT) { OnWritable_(c); }
+                if((events[i].events & EPOLLIN) && c.fd >= 0) { OnReadable_(c); }
+            }
+        }
+        for(auto& c: conns_) {
+            if(c.fd >= 0) { close(c.fd); }
+        }
+        if(timerFd >= 0) { close(timerFd); }
+        close(epollFd_);
+    }
+
+    HdrHistogram hist;
+    int64_t requests_;
+    int64_t bytes_;
+    int64_t errors_;
+    int64_t connectErrors_;
+    int64_t non2xx_;
+    size_t backlogMax_;
+
+private:
+    // epoll事件里表示定时器的标记, 其余值是连接下标
+    static const uint32_t TIMER_TAG = UINT32_MAX;
+    // 建立连接失败(描述符用完、连接被立即拒绝等)后隔多久重试
+    static const int RETRY_MS = 100;
+
+    void Connect_(Conn& c) {
+        c = Conn{};
+        // 各连接从不同的URL开始, 避免所有连接同时请求同一个路径
+        c.next = id_ + (&c - &conns_[0]);
+        c.fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+        if(c.fd < 0) {
+            ConnectFailed_(c);
+            return;
+        }
+        int one = 1;
+        setsockopt(c.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        int ret = connect(c.fd, (struct sockaddr*)&addr_, sizeof(addr_));
+        if(ret < 0 && errno != EINPROGRESS) {
+            close(c.fd);
+            c.fd = -1;
+            ConnectFailed_(c);
+            return;
+        }
+        c.connecting = true;
+        c.wantOut = true;
+        struct epoll_event ev = {};
+        ev.events = EPOLLIN | EPOLLOUT;
+        ev.data.u32 = &c - &conns_[0];
+        epoll_ctl(epollFd_, EPOLL_CTL_ADD, c.fd, &ev);
+    }
+
+    void ConnectFailed_(Conn& c) {
+        connectErrors_++;
+        c.retryAt = NowNs() + RETRY_MS * 1000000LL;
+        broken_++;
+    }
+
+    // 异步连接失败(被拒绝、超时): 关掉描述符, 和立即失败一样隔RETRY_MS再重连, 不在这里空转
+    void AbortConnect_(Conn& c) {
+        epoll_ctl(epollFd_, EPOLL_CTL_DEL, c.fd, nullptr);
+        close(c.fd);
+        c.fd = -1;
+        ConnectFailed_(c);
+    }
+
+    // 重连到了重试时间的连接, 再次失败的会重新计入broken_
+    void Retry_(int64_t now) {
+        for(auto& c: conns_) {
+            if(c.fd < 0 && c.retryAt <= now) {
+                broken_--;
+                Connect_(c);
+            }
+        }
+    }
+
+    // 只有数据没写完时才监听EPOLLOUT
+    void WantOut_(Conn& c, bool want) {
+        if(c.wantOut == want) { return; }
+        c.wantOut = want;
+        struct epoll_event ev = {};
+        ev.events = EPOLLIN | (want ? EPOLLOUT : 0);
+        ev.data.u32 = &c - &conns_[0];
+        epoll_ctl(epollFd_, EPOLL_CTL_MOD, c.fd, &ev);
+    }
+
+    // 连接出错或被关闭: 在途请求记为错误, 开环模式下放回积压队列, 然后重连
+    void Reset_(Conn& c, bool error = true) {
+        if(error) { errors_ += c.inflight.empty() ? 1 : c.inflight.size(); }
+        if(rate_ > 0) {
+            backlog_.insert(backlog_.begin(), c.inflight.begin(), c.inflight.end());
+        }
+        epoll_ctl(epollFd_, EPOLL_CTL_DEL, c.fd, nullptr);
+        close(c.fd);
+        Connect_(c);
+    }
+
+    void Enqueue_(Conn& c, int64_t start) {
+        c.out += reqs_[c.next++ % reqs_.size()];
+        c.inflight.push_back(start);
+    }
+
+    // 闭环: 补满流水线深度
+    void Fill_(Conn& c) {
+        while(c.inflight.size() < static_cast<size_t>(opt_.depth)) {
+            Enqueue_(c, NowNs());
+        }
+    }
+
+    void Dispatch_() {
+        size_t n = conns_.size();
+        for(size_t k = 0; k < n && !backlog_.empty(); k++) {
+            Conn& c = conns_[rr_++ % n];
+            if(c.fd < 0 || c.connecting) { continue; }
+            bool added = false;
+            while(!backlog_.empty() && c.inflight.size() < static_cast<size_t>(opt_.depth)) {
+                Enqueue_(c, backlog_.front());
+                backlog_.pop_front();
+                added = true;
+            }
+            if(added) { Flush_(c); }
+        }
+    }
+
+    void Flush_(Conn& c) {
+        while(c.outPos < c.out.size()) {
+            ssize_t len = write(c.fd, c.out.data() + c.outPos, c.out.size() - c.outPos);
+            if(len < 0) {
+                if(errno == EAGAIN) { WantOut_(c, true); return; }
+                Reset_(c);
+                return;
+            }
+            c.outPos += len;
+        }
+        c.out.clear();
+        c.outPos = 0;
+        WantOut_(c, false);
+    }
+
+    void OnWritable_(Conn& c) {
+        if(c.connecting) {
+            int err = 0;
+            socklen_t len = sizeof(err);
+            getsockopt(c.fd, SOL_SOCKET, SO_ERROR, &err, &len);
+            if(err) {
+                AbortConnect_(c);
+                return;
+            }
+            c.connecting = false;
+            if(rate_ <= 0) { Fill_(c); }
+        }
+        Flush_(c);
+    }
+
+    void OnReadable_(Conn& c) {
+        static thread_local char buf[1 << 16];
+        while(true) {
+            ssize_t len = read(c.fd, buf, sizeof(buf));
+            if(len == 0 || (len < 0 && errno != EAGAIN)) {
+                Reset_(c);
+                return;
+            }
+            if(len < 0) { break; }
+            bytes_ += len;
+            if(!Parse_(c, buf, len)) { return; }
+        }
+        if(rate_ <= 0) { Fill_(c); }
+        Flush_(c);
+    }
+
+    // 返回false表示连接已被重置
+    bool Parse_(Conn& c, const char* p, size_t len) {
+        const char* end = p + len;
+        while(p < end) {
+            if(c.inBody) {
+                size_t n = std::min<size_t>(c.bodyLeft, end - p);
+                c.bodyLeft -= n;
+                p += n;
+                if(c.bodyLeft == 0 && !Complete_(c)) { return false; }
+                continue;
+            }
+            // 在响应头里找空行
+            size_t old = c.head.size();
+            c.head.append(p, end - p);
+            size_t pos = c.head.find("\r\n\r\n", old >= 3 ? old - 3 : 0);
+            if(pos == std::string::npos) {
+                if(c.head.size() > 65536) { Reset_(c); return false; }
+                return true;
+            }
+            p += pos + 4 - old;
+            ParseHead_(c, pos + 4);
+            c.inBody = true;
+            if(c.bodyLeft == 0 && !Complete_(c)) { return false; }
+        }
+        return true;
+    }
+
+    void ParseHead_(Conn& c, size_t len) {
+        c.status = 0;
+        c.bodyLeft = 0;
+        c.closeAfter = false;
+        const char* h = c.head.data();
+        if(len > 12 && strncmp(h, "HTTP/1.", 7) == 0) { c.status = atoi(h + 9); }
+        size_t lineStart = c.head.find("\r\n") + 2;
+        while(lineStart < len - 2) {
+            size_t lineEnd = c.head.find("\r\n", lineStart);
+            const char* line = h + lineStart;
+            if(strncasecmp(line, "Content-length:", 15) == 0) {
+                c.bodyLeft = strtoull(line + 15, nullptr, 10);
+            } else if(strncasecmp(line, "Connection:", 11) == 0) {
+                const char* v = line + 11;
+                while(*v == ' ') { v++; }
+                c.closeAfter = strncasecmp(v, "close", 5) == 0;
+            }
+            lineStart = lineEnd + 2;
+        }
+        c.head.clear();
+    }
+
+    // 一个响应结束
+    bool Complete_(Conn& c) {
+        c.inBody = false;
+        requests_++;
+        if(c.status < 200 || c.status >= 400) { non2xx_++; }
+        if(!c.inflight.empty()) {
+            hist.Record((NowNs() - c.inflight.front()) / 1000);
+            c.inflight.pop_front();
+        }
+        if(c.closeAfter) {
+            // 服务器要求关闭, 剩下的在途请求不会有响应
+            Reset_(c, !c.inflight.empty());
+            return false;
+        }
+        return true;
+    }
+
+    const Options& opt_;
+    sockaddr_in addr_;
+    int id_;
+    double rate_;
+    std::vector<Conn> conns_;
+    std::vector<std::string> reqs_;
+    std::deque<int64_t> backlog_;
+    size_t rr_;
+    // 等待重连的连接数
+    size_t broken_;
+    int epollFd_;
+};
+
+static void Usage(const char* prog) {
+    fprintf(stderr,
+        "用法: %s [选项] http://host:port/path\n"
+        "  -t 线程数        (默认2)\n"
+        "  -c 连接总数      (默认64)\n"
+        "  -d 持续秒数      (默认10)\n"
+        "  -p 流水线深度    每个连接最多同时在途的请求数(默认1)\n"
+        "  -r 总速率        每秒请求数, 开环模式; 不指定为闭环模式\n"
+        "  -u URL文件       每行一个路径, 按顺序轮流请求, 重复的行即为权重\n", prog);
+    exit(1);
+}
+
+static bool ParseUrl(const char* url, Options& opt) {
+    const char* p = url;
+    if(strncmp(p, "http://", 7) == 0) { p += 7; }
+    const char* slash = strchr(p, '/');
+    std::string hostPort = slash ? std::string(p, slash) : std::string(p);
+    size_t colon = hostPort.find(':');
+    opt.host = hostPort.substr(0, colon);
+    if(colon != std::string::npos) { opt.port = atoi(hostPort.c_str() + colon + 1); }
+    if(opt.paths.empty()) { opt.paths.push_back(slash ? slash : "/"); }
+    return !opt.host.empty() && opt.port > 0;
+}
+
+int main(int argc, char* argv[]) {
+    Options opt;
+    std::string urlFile;
+    int ch;
+    while((ch = getopt(argc, argv, "t:c:d:p:r:u:h")) != -1) {
+        switch(ch) {
+        case 't': opt.threads = atoi(optarg); break;
+        case 'c': opt.conns = atoi(optarg); break;
+        case 'd': opt.duration = atof(optarg); break;
+        case 'p': opt.depth = atoi(optarg); break;
+        case 'r': opt.rate = atof(optarg); break;
+        case 'u': urlFile = optarg; break;
+        default: Usage(argv[0]);
+        }
+    }
+    if(optind >= argc || opt.threads <= 0 || opt.conns < opt.threads || opt.depth <= 0) { Usage(argv[0]); }
+    if(!urlFile.empty()) {
+        std::ifstream in(urlFile);
+        std::string line;
+        while(std::getline(in, line)) {
+            if(!line.empty() && line.back() == '\r') { line.pop_back(); }
+            if(!line.empty() && line[0] == '/') { opt.paths.push_back(line); }
+        }
+        if(opt.paths.empty()) {
+            fprintf(stderr, "URL文件%s中没有路径\n", urlFile.c_str());
+            return 1;
+        }
+    }
+    if(!ParseUrl(argv[optind], opt)) { Usage(argv[0]); }
+
+    struct addrinfo hints = {}, *res = nullptr;
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if(getaddrinfo(opt.host.c_str(), nullptr, &hints, &res) != 0 || !res) {
+        fprintf(stderr, "无法解析主机 %s\n", opt.host.c_str());
+        return 1;
+    }
+    sockaddr_in addr = *reinterpret_cast<sockaddr_in*>(res->ai_addr);
+    addr.sin_port = htons(opt.port);
+    freeaddrinfo(res);
+    signal(SIGPIPE, SIG_IGN);
+
+    printf("%s:%d  %d个线程 %d个连接 流水线深度%d  %s  %.0f秒  %zu个URL\n",
+           opt.host.c_str(), opt.port, opt.threads, opt.conns, opt.depth,
+           opt.rate > 0 ? ("开环 " + std::to_string((int64_t)opt.rate) + " req/s").c_str() : "闭环",
+           opt.duration, opt.paths.size());
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    for(int i = 0; i < opt.threads; i++) {
+        int conns = opt.conns / opt.threads + (i < opt.conns % opt.threads ? 1 : 0);
+        workers.emplace_back(new Worker(opt, addr, i, conns, opt.rate / opt.threads));
+    }
+    int64_t start = NowNs();
+    int64_t end = start + static_cast<int64_t>(opt.duration * 1e9);
+    std::vector<std::thread> threads;
+    for(auto& w: workers) {
+        threads.emplace_back([&w, start, end] { w->Run(start, end); });
+    }
+    for(auto& t: threads) { t.join(); }
+    double sec = (NowNs() - start) / 1e9;
+
+    HdrHistogram hist;
+    int64_t requests = 0, bytes = 0, errors = 0, connectErrors = 0, non2xx = 0;
+    size_t backlogMax = 0;
+    for(auto& w: workers) {
+        hist.Merge(w->hist);
+        requests += w->requests_;
+        bytes += w->bytes_;
+        errors += w->errors_;
+        connectErrors += w->connectErrors_;
+        non2xx += w->non2xx_;
+        backlogMax = std::max(backlogMax, w->backlogMax_);
+    }
+    printf("请求 %lld  耗时 %.2fs  %.0f req/s  %.2f MB/s\n",
+           (long long)requests, sec, requests / sec, bytes / sec / (1 << 20));
+    printf("错误: 连接 %lld  读写 %lld  非2xx/3xx %lld", (long long)connectErrors,
+           (long long)errors, (long long)non2xx);
+    if(opt.rate > 0) { printf("  最大积压 %zu", backlogMax); }
+    printf("\n延迟(us)  mean %.0f", hist.Mean());
+    const double PERCENTILES[] = { 50, 75, 90, 99, 99.9, 99.99 };
+    for(double p: PERCENTILES) {
+        printf("  p%g %lld", p, (long long)hist.ValueAtPercentile(p));
+    }
+    printf("  max %lld\n", (long long)hist.Max());
+    return 0;
+}
@@ -5,7 +5,11 @@
  */ 
 #include "../code/log/log.h"
 #include "../code/pool/threadpool.h"
+#include "../code/http/httpresponse.h"
+#include "../code/pool/localuserstore.h"
 #include <features.h>
+#include <assert.h>
+#include <sys/stat.h>
 
 #if __GLIBC__ == 2 && __GLIBC_MINOR__ < 30
 #include <sys/syscall.h>
@@ -50,7 +54,194 @@ void TestThreadPool() {
     getchar();
 }
 
+// 生成一次响应, 返回响应头(响应体引用文件内容, 不在缓冲区里)
+static std::string Respond(const char* range, const char* ifRange = "", const char* ifNoneMatch = "",
+                           const char* acceptEncoding = "", std::shared_ptr<const CachedFile> file = nullptr) {
+    std::string path = "/range.txt";
+    HttpResponse response;
+    Buffer buff;
+    response.Init("./testresponse", path, false, -1);
+    response.SetCachedFile(file);
+    response.SetRange(range, ifRange);
+    response.SetConditional(ifNoneMatch, "");
+    response.SetAcceptEncoding(acceptEncoding);
+    response.MakeResponse(buff);
+    return buff.RetrieveAllToStr();
+}
+
+static bool StartsWith(const std::string& str, const char* prefix) {
+    return str.compare(0, strlen(prefix), prefix) == 0;
+}
+
+static bool Has(const std::string& str, const char* part) {
+    return str.find(part) != std::string::npos;
+}
+
+void TestResponse() {
+    mkdir("./testresponse", 0755);
+    std::string content;
+    for(int i = 0; i < 100; i++) { content += "0123456789"; }
+    FILE* fp = fopen("./testresponse/range.txt", "w");
+    fwrite(content.data(), 1, content.size(), fp);
+    fclose(fp);
+
+    std::string head = Respond("");
+    assert(StartsWith(head, "HTTP/1.1 200 OK\r\n"));
+    assert(Has(head, "Content-length: 1000\r\n"));
+    size_t pos = head.find("ETag: ") + 6;
+    std::string etag = head.substr(pos, head.find("\r\n", pos) - pos);
+
+    /* 后缀范围: 最后n个字节, 超过文件大小时是整个文件 */
+    head = Respond("bytes=-100");
+    assert(StartsWith(head, "HTTP/1.1 206 Partial Content\r\n"));
+    assert(Has(head, "Content-Range: bytes 900-999/1000\r\n"));
+    assert(Has(head, "Content-length: 100\r\n"));
+    head = Respond("bytes=-2000");
+    assert(Has(head, "Content-Range: bytes 0-999/1000\r\n"));
+    /* 结尾超出文件时截到文件末尾 */
+    head = Respond("bytes=990-2000");
+    assert(Has(head, "Content-Range: bytes 990-999/1000\r\n"));
+    assert(Has(head, "Content-length: 10\r\n"));
+    /* first > last是格式错误, 忽略Range */
+    head = Respond("bytes=500-100");
+    assert(StartsWith(head, "HTTP/1.1 200 OK\r\n"));
+    assert(Has(head, "Content-length: 1000\r\n"));
+    /* 全部从文件末尾之后开始: 416 */
+    head = Respond("bytes=1000-");
+    assert(StartsWith(head, "HTTP/1.1 416 Range Not Satisfiable\r\n"));
+    assert(Has(head, "Content-Range: bytes */1000\r\n"));
+    assert(Has(head, "Content-length: 0\r\n"));
+    head = Respond("bytes=2000-3000, -0");
+    assert(StartsWith(head, "HTTP/1.1 416 "));
+    /* MAX_RANGES(16)个范围还可以, 再多就忽略Range */
+    std::string ranges = "bytes=0-0";
+    for(int i = 1; i < 16; i++) { ranges += "," + std::to_string(i * 10) + "-" + std::to_string(i * 10); }
+    head = Respond(ranges.c_str());
+    assert(StartsWith(head, "HTTP/1.1 206 "));
+    assert(Has(head, "multipart/byteranges"));
+    ranges += ",500-500";
+    head = Respond(ranges.c_str());
+    assert(StartsWith(head, "HTTP/1.1 200 OK\r\n"));
+    assert(Has(head, "Content-length: 1000\r\n"));
+    /* If-Range不匹配时发送整个文件 */
+    head = Respond("bytes=0-9", "\"0-0-0\"");
+    assert(StartsWith(head, "HTTP/1.1 200 OK\r\n"));
+    head = Respond("bytes=0-9", etag.c_str());
+    assert(Has(head, "Content-Range: bytes 0-9/1000\r\n"));
+
+    /* If-None-Match弱比较 */
+    assert(StartsWith(Respond("", "", etag.c_str()), "HTTP/1.1 304 Not Modified\r\n"));
+    assert(StartsWith(Respond("", "", ("W/" + etag).c_str()), "HTTP/1.1 304 "));
+    assert(StartsWith(Respond("", "", ("\"x\", W/" + etag).c_str()), "HTTP/1.1 304 "));
+    assert(StartsWith(Respond("", "", "*"), "HTTP/1.1 304 "));
+    assert(StartsWith(Respond("", "", "\"x\""), "HTTP/1.1 200 "));
+    assert(StartsWith(Respond("", "", "W/\"x\""), "HTTP/1.1 200 "));
+
+    /* gzip版本只在缓存的文件上生成 */
+    auto file = std::make_shared<CachedFile>();
+    file->path = "/range.txt";
+    stat("./testresponse/range.txt", &file->st);
+    file->data.reset(new char[content.size()]);
+    memcpy(file->data.get(), content.data(), content.size());
+    HttpResponse::useGzip = true;
+    HttpResponse::PrepareFile(*file);
+    HttpResponse::useGzip = false;
+    assert(!file->gzip.empty());
+    assert(Has(Respond("", "", "", "gzip", file), "Content-Encoding: gzip\r\n"));
+    assert(Has(Respond("", "", "", "deflate, GZIP;q=0.5", file), "Content-Encoding: gzip\r\n"));
+    assert(Has(Respond("", "", "", "br, *", file), "Content-Encoding: gzip\r\n"));
+    assert(!Has(Respond("", "", "", "gzip;q=0", file), "Content-Encoding"));
+    assert(!Has(Respond("", "", "", "gzip; q=0.000", file), "Content-Encoding"));
+    assert(!Has(Respond("", "", "", "*;q=0", file), "Content-Encoding"));
+    assert(!Has(Respond("", "", "", "gzip;q=0, *", file), "Content-Encoding"));
+    assert(!Has(Respond("", "", "", "identity", file), "Content-Encoding"));
+    /* 两个版本都带Vary; 范围请求总是按原文件 */
+    head = Respond("", "", "", "identity", file);
+    assert(Has(head, "Vary: Accept-Encoding\r\n"));
+    assert(Has(head, "Content-length: 1000\r\n"));
+    head = Respond("bytes=0-9", "", "", "gzip", file);
+    assert(StartsWith(head, "HTTP/1.1 206 "));
+    assert(!Has(head, "Content-Encoding"));
+    /* gzip版本的ETag不同, 304也要按发送的版本比较 */
+    assert(StartsWith(Respond("", "", file->etag[1].c_str(), "gzip", file), "HTTP/1.1 304 "));
+    assert(StartsWith(Respond("", "", file->etag[1].c_str(), "", file), "HTTP/1.1 200 "));
+
+    unlink("./testresponse/range.txt");
+    rmdir("./testresponse");
+}
+
+// 数据文件: 同名的后一条覆盖前一条, 末尾不完整的记录在打开时截掉, 之后的追加接在完整的记录后面
+void TestLocalUserStore() {
+    const char* path = "./testusers.dat";
+    unlink(path);
+    {
+        LocalUserStore store;
+        assert(store.Open(path));
+        assert(store.Count() == 0);
+        assert(store.Insert("alice", "pw1") == UserStore::INSERTED);
+        assert(store.Insert("bob", "secret") == UserStore::INSERTED);
+        assert(store.Insert("alice", "other") == UserStore::EXISTS);
+        /* 用户名和密码里可以有空格和换行 */
+        assert(store.Insert("c d", "x\ny") == UserStore::INSERTED);
+        assert(store.Count() == 3);
+    }
+    struct stat st;
+    stat(path, &st);
+    off_t good = st.st_size + strlen("5 3\nalicepw2\n");
+    /* 追加一条同名记录, 再追加写到一半的记录 */
+    FILE* fp = fopen(path, "a");
+    fputs("5 3\nalicepw2\n", fp);
+    fputs("3 10\neveshort", fp);
+    fclose(fp);
+
+    UserRecord rec;
+    {
+        LocalUserStore store;
+        assert(store.Open(path));
+        assert(store.Count() == 3);
+        assert(store.Find("alice", &rec) && rec.found && rec.pwd == "pw2");
+        assert(store.Find("bob", &rec) && rec.found && rec.pwd == "secret");
+        assert(store.Find("c d", &rec) && rec.found && rec.pwd == "x\ny");
+        assert(store.Find("eve", &rec) && !rec.found);
+        stat(path, &st);
+        assert(st.st_size == good);
+        assert(store.Insert("eve", "pw3") == UserStore::INSERTED);
+    }
+    /* 末尾不合法的长度头后面没有完整记录, 当作写到一半的记录截掉 */
+    stat(path, &st);
+    good = st.st_size;
+    fp = fopen(path, "a");
+    fputs("x 1\nab\n", fp);
+    fclose(fp);
+    {
+        LocalUserStore store;
+        assert(store.Open(path));
+        assert(store.Count() == 4);
+        assert(store.Find("eve", &rec) && rec.found && rec.pwd == "pw3");
+        assert(store.Find("alice", &rec) && rec.found && rec.pwd == "pw2");
+        stat(path, &st);
+        assert(st.st_size == good);
+    }
+    /* 损坏的记录后面还有完整的记录: 打开失败, 文件不动, 不会丢掉后面的用户 */
+    fp = fopen(path, "a");
+    fputs("x 1\nab\n3 3\nfoopw4\n", fp);
+    fclose(fp);
+    stat(path, &st);
+    good = st.st_size;
+    {
+        LocalUserStore store;
+        assert(!store.Open(path));
+        assert(!store.Find("alice", &rec));
+        assert(store.Insert("zoe", "pw5") == UserStore::FAILED);
+        stat(path, &st);
+        assert(st.st_size == good);
+    }
+    unlink(path);
+}
+
 int main() {
+    TestResponse();
+    TestLocalUserStore();
     TestLog();
     TestThreadPool();
 }
\ No newline at end of file